@@ -0,0 +1,395 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -DEXCLUDE_TESTS -c -o ffaio.o ffaio.cpp"  -*-
+
+/** @file */
+
+#include "ffaio.hpp"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>         // for free()
+#include <string.h>
+#include <stdint.h>         // for uintptr_t
+#include <unistd.h>
+#include <fcntl.h>          // for posix_fadvise()
+#include <sys/mman.h>       // for mmap()
+#include <sys/syscall.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define FF_HAVE_URING 1
+#endif
+#endif
+
+/**
+ * @brief Constructor, setting up an io_uring if @p use_uring and the
+ *        kernel allows, or else the helper threads.
+ */
+FFAsyncIO::FFAsyncIO(bool use_uring)
+   : m_mutex(), m_changed(), m_in_flight(0), m_closing(false), m_failed_writes(0),
+     m_ring_fd(-1), m_sq_map(nullptr), m_sq_map_size(0),
+     m_cq_map(nullptr), m_cq_map_size(0), m_sqes(nullptr), m_sqes_size(0),
+     m_sq_head(nullptr), m_sq_tail(nullptr), m_sq_mask(nullptr), m_sq_array(nullptr),
+     m_cq_head(nullptr), m_cq_tail(nullptr), m_cq_mask(nullptr), m_cqes(nullptr),
+     m_sq_mutex(), m_queue(), m_queue_head(0), m_threads(nullptr), m_thread_count(0)
+{
+   if (use_uring && setup_ring())
+   {
+      m_thread_count = 1;
+      m_threads = new std::thread[1];
+      m_threads[0] = std::thread(&FFAsyncIO::reap, this);
+   }
+   else
+   {
+      m_thread_count = HELPER_COUNT;
+      m_threads = new std::thread[HELPER_COUNT];
+      for (int i=0; i<HELPER_COUNT; ++i)
+         m_threads[i] = std::thread(&FFAsyncIO::help, this);
+   }
+}
+
+/** @brief Destructor, waiting for the requests in flight. */
+FFAsyncIO::~FFAsyncIO()
+{
+   drain();
+
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_closing = true;
+   }
+   m_changed.notify_all();
+
+   // A no-op wakes the thread waiting for completions:
+   if (uses_uring())
+      push_sqe(nullptr);
+
+   for (int i=0; i<m_thread_count; ++i)
+      m_threads[i].join();
+   delete [] m_threads;
+
+   close_ring();
+   delete [] m_queue.items;
+}
+
+/**
+ * @brief Start @p req, waiting first if RING_ENTRIES requests are already
+ *        in flight.
+ */
+void FFAsyncIO::submit(Request *req)
+{
+   req->done = 0;
+   req->error = 0;
+
+   {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      while (m_in_flight==RING_ENTRIES)
+         m_changed.wait(lock);
+
+      ++m_in_flight;
+
+      if (!uses_uring())
+      {
+         m_queue.append(req);
+         m_changed.notify_all();
+         return;
+      }
+   }
+
+   push_sqe(req);
+}
+
+/** @brief Wait for every request in flight to finish. */
+void FFAsyncIO::drain(void)
+{
+   std::unique_lock<std::mutex> lock(m_mutex);
+   while (m_in_flight)
+      m_changed.wait(lock);
+}
+
+/**
+ * @brief Set up the io_uring and map its rings.
+ *
+ * @return False, leaving no ring, if the kernel has no io_uring, refuses
+ *         one, or is older than the IORING_OP_FADVISE of Linux 5.6.
+ */
+bool FFAsyncIO::setup_ring(void)
+{
+#ifdef FF_HAVE_URING
+   struct io_uring_params params;
+   memset(&params, 0, sizeof(params));
+
+   int fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+   if (fd<0)
+      return false;
+
+   // IORING_FEAT_RW_CUR_POS came with IORING_OP_WRITE and IORING_OP_FADVISE:
+   if (!(params.features & IORING_FEAT_RW_CUR_POS))
+   {
+      close(fd);
+      return false;
+   }
+
+   m_ring_fd = fd;
+   m_sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+   m_cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+   m_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+   bool single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+   if (single_map && m_cq_map_size > m_sq_map_size)
+      m_sq_map_size = m_cq_map_size;
+
+   const int prot = PROT_READ | PROT_WRITE;
+   const int flags = MAP_SHARED | MAP_POPULATE;
+   void *map = mmap(nullptr, m_sq_map_size, prot, flags, fd, IORING_OFF_SQ_RING);
+   if (map==MAP_FAILED)
+   {
+      close_ring();
+      return false;
+   }
+   m_sq_map = map;
+
+   if (single_map)
+      m_cq_map_size = 0;
+   else
+   {
+      map = mmap(nullptr, m_cq_map_size, prot, flags, fd, IORING_OFF_CQ_RING);
+      if (map==MAP_FAILED)
+      {
+         close_ring();
+         return false;
+      }
+      m_cq_map = map;
+   }
+
+   map = mmap(nullptr, m_sqes_size, prot, flags, fd, IORING_OFF_SQES);
+   if (map==MAP_FAILED)
+   {
+      close_ring();
+      return false;
+   }
+   m_sqes = map;
+
+   char *sq = static_cast<char*>(m_sq_map);
+   char *cq = static_cast<char*>(single_map ? m_sq_map : m_cq_map);
+   m_sq_head  = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+   m_sq_tail  = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+   m_sq_mask  = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+   m_sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+   m_cq_head  = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+   m_cq_tail  = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+   m_cq_mask  = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+   m_cqes     = cq + params.cq_off.cqes;
+
+   return true;
+#else
+   return false;
+#endif
+}
+
+/** @brief Unmap the rings and close the io_uring, if any. */
+void FFAsyncIO::close_ring(void)
+{
+   if (m_sqes)
+      munmap(m_sqes, m_sqes_size);
+   if (m_cq_map)
+      munmap(m_cq_map, m_cq_map_size);
+   if (m_sq_map)
+      munmap(m_sq_map, m_sq_map_size);
+   if (m_ring_fd>=0)
+      close(m_ring_fd);
+
+   m_sqes = m_cq_map = m_sq_map = nullptr;
+   m_ring_fd = -1;
+}
+
+/**
+ * @brief Queue the rest of @p req to the ring and submit it, or a no-op
+ *        if @p req is nullptr.
+ */
+void FFAsyncIO::push_sqe(Request *req)
+{
+#ifdef FF_HAVE_URING
+   std::lock_guard<std::mutex> lock(m_sq_mutex);
+
+   unsigned tail = *m_sq_tail;
+   unsigned index = tail & *m_sq_mask;
+   struct io_uring_sqe *sqe = static_cast<struct io_uring_sqe*>(m_sqes) + index;
+   memset(sqe, 0, sizeof(*sqe));
+
+   if (!req)
+      sqe->opcode = IORING_OP_NOP;
+   else if (req->op==IO_WILLNEED)
+   {
+      sqe->opcode = IORING_OP_FADVISE;
+      sqe->fd = req->fd;
+      sqe->len = req->length <= 0xffffffff ? req->length : 0;
+      sqe->off = req->offset;
+      sqe->fadvise_advice = POSIX_FADV_WILLNEED;
+   }
+   else
+   {
+      // A write is limited to what a write() can move at once:
+      size_t len = req->length - req->done;
+      if (len > 0x7ffff000)
+         len = 0x7ffff000;
+
+      sqe->opcode = IORING_OP_WRITE;
+      sqe->fd = req->fd;
+      sqe->addr = reinterpret_cast<uintptr_t>(req->buffer + req->done);
+      sqe->len = len;
+      sqe->off = req->offset + req->done;
+   }
+
+   sqe->user_data = reinterpret_cast<uintptr_t>(req);
+   m_sq_array[index] = index;
+   __atomic_store_n(m_sq_tail, tail+1, __ATOMIC_RELEASE);
+
+   // Also submit any entry a failed call left behind:
+   for (;;)
+   {
+      unsigned count = tail + 1 - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+      if (count==0 || syscall(__NR_io_uring_enter, m_ring_fd, count, 0, 0, nullptr, 0)>=0)
+         break;
+      if (errno!=EINTR && errno!=EAGAIN && errno!=EBUSY)
+      {
+         fprintf(stderr, "Unable to submit to io_uring: %s.\n", strerror(errno));
+         break;
+      }
+      std::this_thread::yield();
+   }
+#endif
+}
+
+/** @brief Body of the io_uring thread, which handles completions until closing. */
+void FFAsyncIO::reap(void)
+{
+#ifdef FF_HAVE_URING
+   for (;;)
+   {
+      unsigned head = *m_cq_head;
+      if (head==__atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE))
+      {
+         {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_closing && m_in_flight==0)
+               return;
+         }
+
+         syscall(__NR_io_uring_enter, m_ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+         continue;
+      }
+
+      const struct io_uring_cqe *cqe = static_cast<const struct io_uring_cqe*>(m_cqes)
+         + (head & *m_cq_mask);
+      Request *req = reinterpret_cast<Request*>(static_cast<uintptr_t>(cqe->user_data));
+      long result = cqe->res;
+      __atomic_store_n(m_cq_head, head+1, __ATOMIC_RELEASE);
+
+      if (req)
+      {
+         if (advance(req, result))
+            push_sqe(req);
+         else
+            finish(req);
+      }
+   }
+#endif
+}
+
+/** @brief Body of a helper thread, which makes queued requests until closing. */
+void FFAsyncIO::help(void)
+{
+   std::unique_lock<std::mutex> lock(m_mutex);
+   for (;;)
+   {
+      while (!m_closing && m_queue_head==m_queue.count)
+         m_changed.wait(lock);
+
+      if (m_queue_head==m_queue.count)
+         return;
+
+      Request *req = m_queue.items[m_queue_head++];
+
+      // Reuse the array once empty:
+      if (m_queue_head==m_queue.count)
+         m_queue_head = m_queue.count = 0;
+
+      lock.unlock();
+      perform(req);
+      lock.lock();
+   }
+}
+
+/** @brief Make the whole of @p req with blocking calls. */
+void FFAsyncIO::perform(Request *req)
+{
+   long result;
+   do
+   {
+      if (req->op==IO_WILLNEED)
+         result = -posix_fadvise(req->fd, req->offset, req->length, POSIX_FADV_WILLNEED);
+      else
+      {
+         result = pwrite(req->fd, req->buffer + req->done, req->length - req->done,
+                         req->offset + req->done);
+         if (result<0)
+            result = -errno;
+      }
+   }
+   while (advance(req, result));
+
+   finish(req);
+}
+
+/**
+ * @brief Account for a @p result of @p req, which is a byte count or
+ *        a negated errno.
+ *
+ * @return True if more of the request is left to make.
+ */
+bool FFAsyncIO::advance(Request *req, long result)
+{
+   if (result<0)
+   {
+      if (result==-EINTR || result==-EAGAIN)
+         return true;
+
+      req->error = -result;
+      return false;
+   }
+
+   if (req->op==IO_WILLNEED)
+      return false;
+
+   if (result==0)
+   {
+      req->error = EIO;
+      return false;
+   }
+
+   req->done += result;
+   return req->done < req->length;
+}
+
+/**
+ * @brief Report a failed write of @p req, then release it.
+ *
+ * A failed read ahead costs nothing but the wait for the pages when they
+ * are used, so is not reported.
+ */
+void FFAsyncIO::finish(Request *req)
+{
+   if (req->error && req->op==IO_WRITE)
+   {
+      fprintf(stderr, "Unable to write file \"%s\": %s.\n", req->path, strerror(req->error));
+      ++m_failed_writes;
+   }
+
+   close(req->fd);
+   free(req->buffer);
+   delete req;
+
+   std::lock_guard<std::mutex> lock(m_mutex);
+   --m_in_flight;
+   m_changed.notify_all();
+}
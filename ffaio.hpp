@@ -0,0 +1,120 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -DEXCLUDE_TESTS -c -o ffaio.o ffaio.cpp"  -*-
+
+/** @file */
+
+#ifndef FFAIO_HPP
+#define FFAIO_HPP
+
+#include "hllist.hpp"
+
+#include <stddef.h>
+#include <sys/types.h>      // for off_t
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/**
+ * @brief Makes file I/O requests in the background.
+ *
+ * Requests are submitted to an io_uring where the kernel allows one, so
+ * that many of them are in flight at once without a thread for each.  A
+ * thread of the object collects the completions, and submits the rest of
+ * a write that the kernel cut short.  Where io_uring cannot be set up, as
+ * under a seccomp filter that denies it, a few threads make the requests
+ * with blocking calls instead.
+ *
+ * The ring is set up with raw system calls, so there is no dependency on
+ * liburing.
+ */
+class FFAsyncIO
+{
+public:
+   /** @brief What a Request does. */
+   enum Op
+   {
+      IO_WRITE,      /**< Write the buffer to the file. */
+      IO_WILLNEED    /**< Read the file into the page cache, as `posix_fadvise` POSIX_FADV_WILLNEED. */
+   };
+
+   /**
+    * @brief A request, which is deleted, its @p fd closed and its @p buffer
+    *        freed once it is finished.
+    */
+   struct Request
+   {
+      Op         op;
+      int        fd;
+      char       *buffer;     /**< From malloc(), or nullptr. */
+      size_t     length;      /**< Bytes to transfer, 0 to read ahead to the end of the file. */
+      off_t      offset;      /**< Position in the file of buffer[0]. */
+      const char *path;       /**< Path of the file, for an error message. */
+      size_t     done;        /**< Bytes transferred. */
+      int        error;       /**< errno of a failure, or 0. */
+   };
+
+   FFAsyncIO(bool use_uring);
+   ~FFAsyncIO();
+
+   /** @brief Returns true if the requests are made by an io_uring. */
+   inline bool uses_uring(void) const     { return m_ring_fd>=0; }
+
+   void submit(Request *req);
+   void drain(void);
+
+   /** @brief Returns the number of writes that failed, complete after drain(). */
+   inline int failed_writes(void) const   { return m_failed_writes.load(); }
+
+private:
+   enum
+   {
+      RING_ENTRIES = 64,   /**< Submission queue size, and most requests in flight. */
+      HELPER_COUNT = 4     /**< Threads making requests without io_uring. */
+   };
+
+   std::mutex              m_mutex;
+   std::condition_variable m_changed;  /**< Signaled when a request finishes or is queued. */
+   int                     m_in_flight;
+   bool                    m_closing;
+   std::atomic<int>        m_failed_writes;
+
+   // io_uring backend:
+   int                     m_ring_fd;
+   void                    *m_sq_map;
+   size_t                  m_sq_map_size;
+   void                    *m_cq_map;
+   size_t                  m_cq_map_size;
+   void                    *m_sqes;
+   size_t                  m_sqes_size;
+   unsigned                *m_sq_head;
+   unsigned                *m_sq_tail;
+   unsigned                *m_sq_mask;
+   unsigned                *m_sq_array;
+   unsigned                *m_cq_head;
+   unsigned                *m_cq_tail;
+   unsigned                *m_cq_mask;
+   void                    *m_cqes;
+   std::mutex              m_sq_mutex;   /**< Serializes submissions to the ring. */
+
+   // Thread backend:
+   HLList<Request*>        m_queue;      /**< Requests not yet taken by a helper. */
+   int                     m_queue_head;
+
+   std::thread             *m_threads;
+   int                     m_thread_count;
+
+   bool setup_ring(void);
+   void close_ring(void);
+   void push_sqe(Request *req);
+   void reap(void);
+   void help(void);
+   void perform(Request *req);
+   bool advance(Request *req, long result);
+   void finish(Request *req);
+
+   // Delete effc++ requested operators
+   FFAsyncIO(const FFAsyncIO &)             = delete;
+   FFAsyncIO & operator=(const FFAsyncIO &) = delete;
+};
+
+#endif
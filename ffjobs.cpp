@@ -0,0 +1,529 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -DEXCLUDE_TESTS -c -o ffjobs.o ffjobs.cpp"  -*-
+
+/** @file */
+
+#include "ffjobs.hpp"
+#include "ffmap.hpp"
+
+#include <errno.h>
+#include <stdlib.h>         // for qsort(), free()
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>          // for open()
+#include <sys/stat.h>       // for stat(), mkdir()
+#include <thread>
+
+/**
+ * @brief An FFEmitter that notes where a document may be split.
+ *
+ * A fenced code block outside of comments and strings leaves an FFScanner
+ * in its initial state, so a new scanner may begin after the closing fence.
+ * The first such place at least @p part_size from the previous one ends
+ * a part.
+ */
+class SplitFinder : public FFEmitter
+{
+public:
+   SplitFinder(size_t part_size) : m_part_size(part_size), m_ends() { }
+   virtual ~SplitFinder() { delete [] m_ends.items; }
+
+   virtual void text(const char *str, size_t len) { }
+   virtual void fence_open(const FFFence &fence) { }
+   virtual void code_line(const char *line, size_t offset, const HLSpan *spans, int count) { }
+
+   virtual void fence_close(const FFFence &fence)
+   {
+      size_t last = m_ends.count ? m_ends.items[m_ends.count-1] : 0;
+      if (fence.top_level && fence.end-last >= m_part_size)
+         m_ends.append(fence.end);
+   }
+
+   /** @brief Number of parts ended before the end of the document. */
+   inline int end_count(void) const     { return m_ends.count; }
+   inline size_t end(int i) const       { return m_ends.items[i]; }
+
+private:
+   size_t         m_part_size;
+   HLList<size_t> m_ends;
+
+   // Delete effc++ requested operators
+   SplitFinder(const SplitFinder &)             = delete;
+   SplitFinder & operator=(const SplitFinder &) = delete;
+};
+
+/**
+ * @brief Constructor.
+ *
+ * @param format  Output format, as for new_markup_emitter().
+ * @param compact Merge neighboring spans, as for new_markup_emitter().
+ * @param load    Function to filter a document.
+ */
+FFJobs::FFJobs(const char *format, bool compact, FFLoad_Func load)
+   : m_format(format), m_compact(compact), m_load(load),
+     m_files(), m_deques(nullptr), m_deque_count(0), m_pending(0), m_failures(0),
+     m_use_uring(true), m_io(nullptr), m_read_mutex(), m_read_order(),
+     m_read_next(0), m_read_count(0), m_read_bytes(0)
+{
+}
+
+FFJobs::~FFJobs()
+{
+   for (int i=0; i<m_files.count; ++i)
+      delete [] m_files.items[i].out_path;
+   delete [] m_files.items;
+   delete [] m_deques;
+   delete [] m_read_order.items;
+}
+
+/**
+ * @brief Add the document at @p path to those filtered by run().
+ *
+ * A document whose output would have the name of an added document's,
+ * as `b/x.md` after `a/x.md`, is rejected rather than overwrite it, and
+ * counts as a failure in the status of run().
+ *
+ * @return FALSE if the document was rejected.
+ */
+bool FFJobs::add_file(const char *path)
+{
+   const char *slash = strrchr(path, '/');
+   const char *name = slash ? slash+1 : path;
+
+   for (int i=0; i<m_files.count; ++i)
+      if (strcmp(m_files.items[i].name, name)==0)
+      {
+         fprintf(stderr, "Not filtering \"%s\", whose output would replace that of \"%s\".\n",
+                 path, m_files.items[i].path);
+         ++m_failures;
+         return false;
+      }
+
+   File file = { path, name, nullptr, 0, nullptr, 0, 0, nullptr, nullptr, false, READ_NONE };
+
+   struct stat st;
+   if (stat(path, &st)==0)
+      file.size = st.st_size;
+
+   m_files.append(file);
+   return true;
+}
+
+/**
+ * @brief Filter the added documents to files of the same names in @p out_dir.
+ *
+ * @param out_dir Directory for the filtered documents, created if necessary.
+ * @param threads Number of threads to filter with, including the caller's.
+ * @return Exit status of the program, 1 if any document could not be
+ *         filtered or its output written, 0 otherwise.
+ */
+int FFJobs::run(const char *out_dir, int threads)
+{
+   if (mkdir(out_dir, 0777) && errno!=EEXIST)
+   {
+      fprintf(stderr, "Unable to create directory \"%s\": %s.\n", out_dir, strerror(errno));
+      return 1;
+   }
+
+   if (threads<1)
+      threads = 1;
+
+   // A task for each document, largest first:
+   Task *tasks = new Task[m_files.count];
+   for (int i=0; i<m_files.count; ++i)
+   {
+      File &file = m_files.items[i];
+
+      size_t len = strlen(out_dir) + strlen(file.name) + 2;
+      file.out_path = new char[len];
+      snprintf(file.out_path, len, "%s/%s", out_dir, file.name);
+
+      Task &task = tasks[i];
+      task.kind = file.size > SPLIT_SIZE ? TASK_SPLIT : TASK_WHOLE;
+      task.file = i;
+      task.part = 0;
+      task.begin = 0;
+      task.end = file.size;
+   }
+
+   qsort(tasks, m_files.count, sizeof(Task), task_sorter);
+
+   // Deal the tasks, so each deque is in order of size, too:
+   m_deques = new Deque[threads];
+   m_deque_count = threads;
+   for (int i=0; i<m_files.count; ++i)
+      push(i % threads, tasks[i]);
+
+   for (int i=0; i<m_files.count; ++i)
+      if (tasks[i].kind==TASK_WHOLE)
+         m_read_order.append(tasks[i].file);
+
+   delete [] tasks;
+
+   m_io = new FFAsyncIO(m_use_uring);
+   read_ahead();
+
+   std::thread *helpers = new std::thread[threads-1];
+   for (int i=1; i<threads; ++i)
+      helpers[i-1] = std::thread(&FFJobs::work, this, i);
+
+   work(0);
+
+   for (int i=1; i<threads; ++i)
+      helpers[i-1].join();
+
+   delete [] helpers;
+
+   // Wait for the writes:
+   m_io->drain();
+   int failures = m_failures.load() + m_io->failed_writes();
+   delete m_io;
+   m_io = nullptr;
+
+   return failures ? 1 : 0;
+}
+
+/** @brief Body of a thread, which runs tasks until no task is left anywhere. */
+void FFJobs::work(int self)
+{
+   Task task;
+   while (m_pending.load() > 0)
+   {
+      if (pop(self, task) || steal(self, task))
+      {
+         File &file = m_files.items[task.file];
+         switch(task.kind)
+         {
+            case TASK_WHOLE:
+               filter_whole(file, -1);
+               break;
+            case TASK_SPLIT:
+               split(self, task.file);
+               break;
+            case TASK_PART:
+               filter_part(file, task);
+               break;
+         }
+
+         --m_pending;
+      }
+      else
+         std::this_thread::yield();
+   }
+}
+
+/** @brief Add @p task to the back of the deque of thread @p self. */
+void FFJobs::push(int self, const Task &task)
+{
+   ++m_pending;
+
+   Deque &deque = m_deques[self];
+   std::lock_guard<std::mutex> lock(deque.mutex);
+   deque.tasks.append(task);
+}
+
+/** @brief Take the task at the front of the deque of thread @p self. */
+bool FFJobs::pop(int self, Task &task)
+{
+   Deque &deque = m_deques[self];
+   std::lock_guard<std::mutex> lock(deque.mutex);
+   if (deque.head < deque.tasks.count)
+   {
+      task = deque.tasks.items[deque.head++];
+
+      // Reuse the array once empty:
+      if (deque.head==deque.tasks.count)
+         deque.head = deque.tasks.count = 0;
+
+      return true;
+   }
+
+   return false;
+}
+
+/** @brief Take the task at the back of the deque of a thread other than @p self. */
+bool FFJobs::steal(int self, Task &task)
+{
+   for (int i=1; i<m_deque_count; ++i)
+   {
+      Deque &deque = m_deques[(self+i) % m_deque_count];
+      std::lock_guard<std::mutex> lock(deque.mutex);
+      if (deque.head < deque.tasks.count)
+      {
+         task = deque.tasks.items[--deque.tasks.count];
+
+         if (deque.head==deque.tasks.count)
+            deque.head = deque.tasks.count = 0;
+
+         return true;
+      }
+   }
+
+   return false;
+}
+
+/**
+ * @brief Filter @p file to its output file in one piece.
+ *
+ * @param fd The document open for reading, or -1 to open it here.  The
+ *           output file is created only once the document is open.
+ */
+void FFJobs::filter_whole(File &file, int fd)
+{
+   begin_read(file);
+
+   if (fd<0 && (fd=open_document(file.path))<0)
+   {
+      ++m_failures;
+      return;
+   }
+
+   int out_fd = open(file.out_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+   if (out_fd<0)
+   {
+      fprintf(stderr, "Unable to write file \"%s\".\n", file.out_path);
+      ++m_failures;
+      close(fd);
+      return;
+   }
+
+   {
+      OutSink out(out_fd);
+      FFEmitter *emitter = new_markup_emitter(m_format, m_compact, out);
+      FFScanner scanner(*emitter);
+
+      if (!(*m_load)(scanner, out, fd, file.path))
+         ++m_failures;
+      delete emitter;
+   }
+
+   close(out_fd);
+}
+
+/**
+ * @brief Split the document @p index of m_files into parts, each a task
+ *        pushed to the deque of thread @p self.
+ *
+ * A document that cannot be mapped, such as a gzipped document, or that
+ * has no place to split, is filtered whole.
+ */
+void FFJobs::split(int self, int index)
+{
+   File &file = m_files.items[index];
+
+   int fd = open_document(file.path);
+   if (fd<0)
+   {
+      ++m_failures;
+      return;
+   }
+
+   size_t size;
+   const char *buff = map_document(fd, &size);
+   if (!buff)
+   {
+      filter_whole(file, fd);
+      return;
+   }
+
+   close(fd);
+
+   // A quick scan for the places to split:
+   SplitFinder finder(PART_SIZE);
+   {
+      FFScanner scanner(finder);
+      scanner.set_log(nullptr);
+      scanner.set_highlighting(false);
+      scanner.scan_buffer(buff, size);
+   }
+
+   // Don't leave a small part at the end:
+   int count = finder.end_count();
+   if (count && size-finder.end(count-1) < PART_SIZE)
+      --count;
+
+   if (count==0)
+   {
+      unmap_document(buff, size);
+      filter_whole(file, -1);
+      return;
+   }
+
+   file.map = buff;
+   file.size = size;
+   file.part_count = count+1;
+   file.parts_left = count+1;
+   file.outputs = new char*[count+1];
+   file.output_lengths = new size_t[count+1];
+
+   Task task = { TASK_PART, index, 0, 0, 0 };
+   for (int i=0; i<=count; ++i)
+   {
+      task.part = i;
+      task.begin = task.end;
+      task.end = i<count ? finder.end(i) : size;
+      push(self, task);
+   }
+}
+
+/** @brief Filter a part of a split document to memory, writing the document after its last part. */
+void FFJobs::filter_part(File &file, const Task &task)
+{
+   OutSink out;
+   out.set_buffer(nullptr, 0, true);
+   {
+      FFEmitter *emitter = new_markup_emitter(m_format, m_compact, out);
+      FFScanner scanner(*emitter);
+
+      scanner.scan_buffer(file.map+task.begin, task.end-task.begin);
+      out.flush();
+      delete emitter;
+   }
+
+   if (out.failed())
+   {
+      fprintf(stderr, "Out of memory filtering \"%s\".\n", file.path);
+      free(out.buffer());
+      file.outputs[task.part] = nullptr;
+      file.output_lengths[task.part] = 0;
+      file.part_failed = true;
+   }
+   else
+   {
+      file.outputs[task.part] = out.buffer();
+      file.output_lengths[task.part] = out.length();
+   }
+
+   if (__atomic_sub_fetch(&file.parts_left, 1, __ATOMIC_ACQ_REL)==0)
+      write_parts(file);
+}
+
+/**
+ * @brief Write the outputs of the parts of @p file, each at its offset in
+ *        the output file, then release them.
+ *
+ * Nothing is written if a part failed, rather than a truncated output.
+ */
+void FFJobs::write_parts(File &file)
+{
+   int fd = -1;
+   if (!file.part_failed)
+   {
+      fd = open(file.out_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+      if (fd<0)
+         fprintf(stderr, "Unable to write file \"%s\".\n", file.out_path);
+   }
+
+   if (fd<0)
+   {
+      ++m_failures;
+      for (int i=0; i<file.part_count; ++i)
+         free(file.outputs[i]);
+   }
+   else
+   {
+      // Each write closes a descriptor of its own:
+      off_t offset = 0;
+      for (int i=0; i<file.part_count; ++i)
+      {
+         write_output(file.out_path, dup(fd), file.outputs[i], file.output_lengths[i], offset);
+         offset += file.output_lengths[i];
+      }
+      close(fd);
+   }
+
+   delete [] file.outputs;
+   delete [] file.output_lengths;
+   file.outputs = nullptr;
+   file.output_lengths = nullptr;
+
+   unmap_document(file.map, file.size);
+   file.map = nullptr;
+}
+
+/**
+ * @brief Read the whole documents next in m_read_order into the page cache,
+ *        while fewer than READ_AHEAD_FILES and READ_AHEAD_BYTES are read
+ *        ahead and not yet begun.
+ *
+ * A document already taken by a thread, having been stolen out of order,
+ * is passed over, as is one that cannot be opened, for the thread to report.
+ */
+void FFJobs::read_ahead(void)
+{
+   std::lock_guard<std::mutex> lock(m_read_mutex);
+   while (m_read_next < m_read_order.count
+          && m_read_count < READ_AHEAD_FILES && m_read_bytes < READ_AHEAD_BYTES)
+   {
+      File &file = m_files.items[m_read_order.items[m_read_next++]];
+      if (file.read_state!=READ_NONE || file.size==0)
+         continue;
+
+      int fd = open(file.path, O_RDONLY | O_CLOEXEC);
+      if (fd<0)
+         continue;
+
+      file.read_state = READ_AHEAD;
+      ++m_read_count;
+      m_read_bytes += file.size;
+
+      FFAsyncIO::Request *req = new FFAsyncIO::Request;
+      req->op = FFAsyncIO::IO_WILLNEED;
+      req->fd = fd;
+      req->buffer = nullptr;
+      req->length = 0;
+      req->offset = 0;
+      req->path = file.path;
+      m_io->submit(req);
+   }
+}
+
+/** @brief Note that a thread takes @p file to filter, and read further ahead. */
+void FFJobs::begin_read(File &file)
+{
+   {
+      std::lock_guard<std::mutex> lock(m_read_mutex);
+      if (file.read_state==READ_AHEAD)
+      {
+         --m_read_count;
+         m_read_bytes -= file.size;
+      }
+      file.read_state = READ_BEGUN;
+   }
+
+   read_ahead();
+}
+
+/**
+ * @brief Write the @p length characters of @p buffer at @p offset of the
+ *        file open as @p fd, then close @p fd and free() @p buffer.
+ *
+ * The write is left to m_io, and may not be finished on return.
+ */
+void FFJobs::write_output(const char *path, int fd, char *buffer, size_t length, off_t offset)
+{
+   if (length==0)
+   {
+      close(fd);
+      free(buffer);
+      return;
+   }
+
+   FFAsyncIO::Request *req = new FFAsyncIO::Request;
+   req->op = FFAsyncIO::IO_WRITE;
+   req->fd = fd;
+   req->buffer = buffer;
+   req->length = length;
+   req->offset = offset;
+   req->path = path;
+   m_io->submit(req);
+}
+
+/** @brief qsort() function to order tasks by descending size. */
+int FFJobs::task_sorter(const void *lh, const void *rh)
+{
+   const Task *lt = static_cast<const Task*>(lh);
+   const Task *rt = static_cast<const Task*>(rh);
+   size_t lsize = lt->end - lt->begin;
+   size_t rsize = rt->end - rt->begin;
+   return lsize>rsize ? -1 : lsize<rsize ? 1 : 0;
+}
@@ -0,0 +1,151 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -DEXCLUDE_TESTS -c -o ffjobs.o ffjobs.cpp"  -*-
+
+/** @file */
+
+#ifndef FFJOBS_HPP
+#define FFJOBS_HPP
+
+#include "markupemitter.hpp"
+#include "ffaio.hpp"
+#include "hllist.hpp"
+
+#include <atomic>
+#include <mutex>
+
+/**
+ * @brief Filters many documents to an output directory with several threads.
+ *
+ * Documents are filtered largest first, by their `stat` sizes, so that no
+ * large document is left for last.  Each thread has a deque of tasks, dealt
+ * in order of size, and takes its next task from the front of its deque.
+ * A thread whose deque is empty steals a task from the back of another's.
+ *
+ * A document larger than SPLIT_SIZE is first scanned without highlighting to
+ * find the fenced code blocks outside of comments, after which a scan may
+ * begin anew.  The parts between them, of at least PART_SIZE, become tasks
+ * of their own, pushed to the back of the deque for idle threads to steal.
+ * The output of the parts is collected in memory, and written in order by
+ * the thread that finishes the last part.
+ *
+ * So that the threads filter rather than wait on storage, the whole
+ * documents next in line are read into the page cache ahead of their
+ * threads by an FFAsyncIO, up to READ_AHEAD_FILES of them and
+ * READ_AHEAD_BYTES, and the outputs of the parts of split documents,
+ * already in memory, are written by it while the threads move on.  The
+ * documents are still mapped rather than read into buffers, so text that
+ * passes through unchanged is written from the page cache without a copy.
+ */
+class FFJobs
+{
+public:
+   FFJobs(const char *format, bool compact, FFLoad_Func load);
+   ~FFJobs();
+
+   bool add_file(const char *path);
+   int run(const char *out_dir, int threads);
+
+   /** @brief Use an io_uring for the file I/O, if the kernel allows, or else threads. */
+   inline void set_uring(bool on)   { m_use_uring = on; }
+
+private:
+   enum
+   {
+      SPLIT_SIZE = 4 << 20,   /**< Size above which a document is split. */
+      PART_SIZE  = 1 << 20,   /**< Least size of a part of a split document. */
+      READ_AHEAD_FILES = 32,       /**< Most documents read ahead and not yet filtered. */
+      READ_AHEAD_BYTES = 64 << 20  /**< Most bytes read ahead and not yet filtered. */
+   };
+
+   /** @brief How far a whole document is read, see read_ahead(). */
+   enum Read_State
+   {
+      READ_NONE,     /**< Not yet read ahead. */
+      READ_AHEAD,    /**< Being read ahead, counted in m_read_count and m_read_bytes. */
+      READ_BEGUN     /**< Taken by a thread to filter. */
+   };
+
+   /** @brief A document to filter. */
+   struct File
+   {
+      const char *path;
+      const char *name;           /**< Name of the output file, the last part of @p path. */
+      char       *out_path;
+      size_t     size;            /**< Size from `stat`, for the order of the work. */
+      const char *map;            /**< The mapped document, while parts are filtered. */
+      int        part_count;
+      int        parts_left;      /**< Parts not yet filtered, counted down atomically. */
+      char       **outputs;       /**< Output of each part, from OutSink::buffer(). */
+      size_t     *output_lengths;
+      bool       part_failed;     /**< A part could not be filtered, so none is written. */
+      Read_State read_state;      /**< Guarded by m_read_mutex. */
+   };
+
+   /** @brief What a Task does with its document. */
+   enum Task_Kind
+   {
+      TASK_WHOLE,    /**< Filter the document. */
+      TASK_SPLIT,    /**< Split the document into TASK_PART tasks. */
+      TASK_PART      /**< Filter a part of a split document. */
+   };
+
+   /** @brief A unit of work. */
+   struct Task
+   {
+      Task_Kind kind;
+      int       file;       /**< Index of the document in m_files. */
+      int       part;       /**< Part number of a TASK_PART. */
+      size_t    begin;      /**< Offset of the work in the document. */
+      size_t    end;        /**< Offset following the work, the size for a whole document. */
+   };
+
+   /** @brief The tasks of one thread. */
+   struct Deque
+   {
+      std::mutex   mutex;
+      HLList<Task> tasks;
+      int          head;    /**< Index of the front task in @p tasks. */
+
+      Deque(void) : mutex(), tasks(), head(0) { }
+      ~Deque() { delete [] tasks.items; }
+   };
+
+   const char       *m_format;
+   bool             m_compact;
+   FFLoad_Func      m_load;
+
+   HLList<File>     m_files;
+   Deque            *m_deques;
+   int              m_deque_count;
+   std::atomic<int> m_pending;   /**< Tasks pushed and not yet finished. */
+   std::atomic<int> m_failures;  /**< Documents that could not be filtered. */
+
+   bool             m_use_uring;   /**< See set_uring(). */
+   FFAsyncIO        *m_io;          /**< Reads ahead and writes during run(). */
+   std::mutex       m_read_mutex;   /**< Guards the read-ahead members. */
+   HLList<int>      m_read_order;   /**< Whole documents, by index in m_files, in task order. */
+   int              m_read_next;    /**< Index in m_read_order of the next document to read. */
+   int              m_read_count;   /**< Documents read ahead and not yet begun. */
+   size_t           m_read_bytes;   /**< Bytes read ahead and not yet begun. */
+
+   void work(int self);
+   void push(int self, const Task &task);
+   bool pop(int self, Task &task);
+   bool steal(int self, Task &task);
+
+   void filter_whole(File &file, int fd);
+   void split(int self, int index);
+   void filter_part(File &file, const Task &task);
+   void write_parts(File &file);
+
+   void read_ahead(void);
+   void begin_read(File &file);
+   void write_output(const char *path, int fd, char *buffer, size_t length, off_t offset);
+
+   static int task_sorter(const void *lh, const void *rh);
+
+   // Delete effc++ requested operators
+   FFJobs(const FFJobs &)             = delete;
+   FFJobs & operator=(const FFJobs &) = delete;
+};
+
+#endif
@@ -0,0 +1,75 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -fsyntax-only ffmap.hpp"  -*-
+
+/** @file */
+
+#ifndef FFMAP_HPP
+#define FFMAP_HPP
+
+#include <stddef.h>
+#include <stdio.h>
+#include <fcntl.h>          // for open()
+#include <sys/mman.h>       // for mmap()
+#include <sys/stat.h>       // for fstat()
+
+/**
+ * @brief Open the document at @p path for reading, reporting a failure.
+ *
+ * A document is opened before its output file is created, so that a
+ * missing document leaves no empty output behind.
+ *
+ * @return The descriptor, or -1 if the document could not be opened.
+ */
+inline int open_document(const char *path)
+{
+   int fd = open(path, O_RDONLY | O_CLOEXEC);
+   if (fd<0)
+      fprintf(stderr, "Unable to open file \"%s\".\n", path);
+   return fd;
+}
+
+/** @brief Returns TRUE if the @p len characters at @p buff start with the gzip magic number. */
+inline bool is_gzipped(const char *buff, size_t len)
+{
+   return len>=2 && buff[0]=='\x1f' && buff[1]=='\x8b';
+}
+
+/**
+ * @brief Map the document open as @p fd into memory to scan in place.
+ *
+ * A document that is not a non-empty regular file, that cannot be mapped,
+ * or that is gzipped, is not mapped, and must be read through zlib if at
+ * all.  @p fd may be closed while the document stays mapped.
+ *
+ * @param fd   Descriptor of the document, open for reading.
+ * @param size Set to the size of the mapped document.
+ * @return The mapped document, to be released with unmap_document(), or
+ *         nullptr if not mapped.
+ */
+inline const char *map_document(int fd, size_t *size)
+{
+   struct stat st;
+   if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size<=0)
+      return nullptr;
+
+   void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   if (map==MAP_FAILED)
+      return nullptr;
+
+   const char *buff = static_cast<const char*>(map);
+   if (is_gzipped(buff, st.st_size))
+   {
+      munmap(map, st.st_size);
+      return nullptr;
+   }
+
+   *size = st.st_size;
+   return buff;
+}
+
+/** @brief Release the @p size characters at @p buff mapped by map_document(). */
+inline void unmap_document(const char *buff, size_t size)
+{
+   munmap(const_cast<char*>(buff), size);
+}
+
+#endif
@@ -0,0 +1,311 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -pthread -o ffpreload ffpreload.cpp -lz"  -*-
+
+/** @file */
+
+#include "ffpreload.hpp"
+#include "ffscanner.hpp"
+#include "hlindex.hpp"
+#include "ffmap.hpp"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>          // for open()
+
+/**
+ * @brief An FFEmitter that preloads the language of each fenced block.
+ */
+class FenceFinder : public FFEmitter
+{
+public:
+   FenceFinder(FFPreloader &preloader) : m_preloader(preloader) { }
+
+   virtual void text(const char *str, size_t len) { }
+   virtual void code_line(const char *line, size_t offset, const HLSpan *spans, int count) { }
+   virtual void fence_close(const FFFence &fence) { }
+
+   virtual void fence_open(const FFFence &fence)
+   {
+      if (*fence.language)
+         m_preloader.preload(fence.language, strlen(fence.language));
+   }
+
+private:
+   FFPreloader &m_preloader;
+
+   // Delete effc++ requested operators
+   FenceFinder(const FenceFinder &)             = delete;
+   FenceFinder & operator=(const FenceFinder &) = delete;
+};
+
+/**
+ * @brief Constructor.
+ *
+ * The worker threads are started by the first preload(), so an object
+ * that is never asked to preload costs nothing.
+ *
+ * @param threads Number of highlighting files that may be loaded at once.
+ */
+FFPreloader::FFPreloader(int threads)
+   : m_mutex(), m_wake(), m_types(), m_next(0), m_closing(false),
+     m_workers(nullptr), m_worker_count(threads>0 ? threads : 1), m_scanner()
+{
+}
+
+/**
+ * @brief Destructor, waiting for the prescan and the loads under way.
+ *
+ * Types queued and not yet begun are dropped, the documents that would
+ * have needed them being filtered by now.
+ */
+FFPreloader::~FFPreloader()
+{
+   if (m_scanner.joinable())
+      m_scanner.join();
+
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_closing = true;
+   }
+   m_wake.notify_all();
+
+   if (m_workers)
+   {
+      for (int i=0; i<m_worker_count; ++i)
+         m_workers[i].join();
+      delete [] m_workers;
+   }
+
+   for (int i=0; i<m_types.count; ++i)
+      delete [] m_types.items[i];
+   delete [] m_types.items;
+}
+
+/** @brief Queue the @p len characters at @p type for loading, unless already queued. */
+void FFPreloader::preload(const char *type, size_t len)
+{
+   if (len==0)
+      return;
+
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      for (int i=0; i<m_types.count; ++i)
+      {
+         const char *queued = m_types.items[i];
+         if (strncmp(queued, type, len)==0 && queued[len]=='\0')
+            return;
+      }
+
+      char *copy = new char[len+1];
+      memcpy(copy, type, len);
+      copy[len] = '\0';
+      m_types.append(copy);
+
+      if (!m_workers)
+      {
+         m_workers = new std::thread[m_worker_count];
+         for (int i=0; i<m_worker_count; ++i)
+            m_workers[i] = std::thread(&FFPreloader::work, this);
+      }
+   }
+
+   m_wake.notify_one();
+}
+
+/** @brief Preload each type of the comma-separated @p list, as given to `--preload`. */
+void FFPreloader::preload_list(const char *list)
+{
+   while (*list)
+   {
+      const char *comma = strchr(list, ',');
+      size_t len = comma ? comma-list : strlen(list);
+      preload(list, len);
+      list += comma ? len+1 : len;
+   }
+}
+
+/**
+ * @brief Start a thread to preload the languages of the fenced blocks of
+ *        the @p count documents at @p paths, which must outlast the object.
+ *
+ * Only one prescan may be started.
+ */
+void FFPreloader::prescan(const char **paths, int count)
+{
+   if (!m_scanner.joinable())
+      m_scanner = std::thread(&FFPreloader::scan_files, this, paths, count);
+}
+
+/** @brief Body of a worker thread, which loads queued types until closing. */
+void FFPreloader::work(void)
+{
+   std::unique_lock<std::mutex> lock(m_mutex);
+   for (;;)
+   {
+      while (!m_closing && m_next==m_types.count)
+         m_wake.wait(lock);
+
+      if (m_closing)
+         return;
+
+      const char *type = m_types.items[m_next++];
+
+      // m_types may grow, but its strings stay put while loading:
+      lock.unlock();
+      HLIndex::get_index(type);
+      lock.lock();
+   }
+}
+
+/** @brief Body of the prescan thread. */
+void FFPreloader::scan_files(const char **paths, int count)
+{
+   for (int i=0; i<count; ++i)
+      scan_file(paths[i]);
+}
+
+/**
+ * @brief Preload the languages of the fenced blocks of the document at @p path.
+ *
+ * A document that cannot be mapped, such as a gzipped document, is skipped
+ * rather than decompressed twice, and its languages are loaded when met.
+ */
+void FFPreloader::scan_file(const char *path)
+{
+   int fd = open(path, O_RDONLY | O_CLOEXEC);
+   if (fd<0)
+      return;
+
+   size_t size;
+   const char *buff = map_document(fd, &size);
+   close(fd);
+
+   if (buff)
+   {
+      FenceFinder finder(*this);
+      FFScanner scanner(finder);
+      scanner.set_log(nullptr);
+      scanner.set_highlighting(false);
+      scanner.scan_buffer(buff, size);
+
+      unmap_document(buff, size);
+   }
+}
+
+
+
+#ifndef EXCLUDE_TESTS
+#define EXCLUDE_TESTS
+
+#include "ffscanner.cpp"
+#include "hltoken.cpp"
+#include "hlindex.cpp"
+#include "hlnode.cpp"
+#include "hlpath.cpp"
+#include "hlregex.cpp"
+
+#include <stdio.h>
+#include <limits.h>   // for PATH_MAX
+#include <signal.h>   // for alarm()
+
+/**
+ * @brief Write a highlighting file for @p type in @p dir that includes
+ *        @p include, with enough tags to be slow to parse.
+ */
+void write_including_file(const char *dir, const char *type, const char *include)
+{
+   char path[PATH_MAX];
+   snprintf(path, sizeof(path), "%s/%s.hl", dir, type);
+
+   FILE *file = fopen(path, "w");
+   if (!file)
+      return;
+
+   fprintf(file, "!include %s\n\nkeyword : span.keyword\n", include);
+   for (int i=0; i<20000; ++i)
+      fprintf(file, "   %s%d\n", type, i);
+   fclose(file);
+}
+
+/** @brief Abort a test that deadlocked. */
+void report_deadlock(int signum)
+{
+   static const char msg[] = "test_preload_circular deadlocked.\n";
+   ssize_t written = write(STDERR_FILENO, msg, sizeof(msg)-1);
+   _exit(written>0 ? 2 : 3);
+}
+
+/**
+ * @brief Preload `yN` while scanning a document with an `xN` block, where
+ *        `xN.hl` and `yN.hl` include each other, returning TRUE if every
+ *        document was highlighted.
+ *
+ * This is `fencedfilter --preload y` on such a document: a worker loads
+ * `yN` while the scanner loads `xN`, and each reaches its include while
+ * the other type is claimed.
+ */
+bool test_preload_circular(void)
+{
+   printf("\nBeginning test_preload_circular:\n");
+
+   char dir[] = "/tmp/ffpreload-XXXXXX";
+   if (!mkdtemp(dir))
+   {
+      printf("Unable to make a directory for the test.\n");
+      return false;
+   }
+
+   const int rounds = 8;
+   char types[rounds][2][16];
+   for (int i=0; i<rounds; ++i)
+   {
+      snprintf(types[i][0], sizeof(types[i][0]), "x%d", i);
+      snprintf(types[i][1], sizeof(types[i][1]), "y%d", i);
+      write_including_file(dir, types[i][0], types[i][1]);
+      write_including_file(dir, types[i][1], types[i][0]);
+   }
+
+   HLPath::add_search_dirs(dir);
+
+   signal(SIGALRM, report_deadlock);
+   alarm(30);
+
+   int highlighted = 0;
+   for (int i=0; i<rounds; ++i)
+   {
+      char doc[128];
+      int len = snprintf(doc, sizeof(doc), "~~~%s\n%s0 %s1\n~~~\n",
+                         types[i][0], types[i][0], types[i][1]);
+
+      FFPreloader preloader(2);
+      preloader.preload(types[i][1], strlen(types[i][1]));
+
+      FFSpanCollector spans;
+      FFScanner scanner(spans);
+      scanner.set_log(nullptr);
+      scanner.scan_buffer(doc, len);
+
+      if (spans.span_count()>0)
+         ++highlighted;
+   }
+
+   alarm(0);
+   printf("%d of %d documents highlighted.\n", highlighted, rounds);
+
+   for (int i=0; i<rounds; ++i)
+      for (int j=0; j<2; ++j)
+      {
+         char path[PATH_MAX];
+         snprintf(path, sizeof(path), "%s/%s.hl", dir, types[i][j]);
+         unlink(path);
+      }
+   rmdir(dir);
+
+   return highlighted==rounds;
+}
+
+int main(int argc, char **argv)
+{
+   return test_preload_circular() ? 0 : 1;
+}
+
+#endif
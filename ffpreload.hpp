@@ -0,0 +1,59 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -DEXCLUDE_TESTS -c -o ffpreload.o ffpreload.cpp"  -*-
+
+/** @file */
+
+#ifndef FFPRELOAD_HPP
+#define FFPRELOAD_HPP
+
+#include "hllist.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/**
+ * @brief Loads highlighting files on background threads before they are needed.
+ *
+ * Without it, a highlighting file is opened and parsed the first time the
+ * FFScanner meets its language, and the output stalls meanwhile.  The types
+ * given to preload() are instead loaded by a pool of worker threads calling
+ * HLIndex::get_index(), several at once, while the scanner proceeds.  The
+ * registry makes a scanner reaching a block whose index is still being
+ * loaded wait for that load only, and an index loaded before it is reached
+ * costs nothing more.
+ *
+ * prescan() finds the types worth loading: a thread runs a quick FFScanner
+ * pass without highlighting over each document, preloading the language of
+ * every fenced block as it goes.
+ */
+class FFPreloader
+{
+public:
+   FFPreloader(int threads);
+   ~FFPreloader();
+
+   void preload(const char *type, size_t len);
+   void preload_list(const char *list);
+   void prescan(const char **paths, int count);
+
+private:
+   std::mutex              m_mutex;
+   std::condition_variable m_wake;       /**< Signaled when a type is queued or on closing. */
+   HLList<char*>           m_types;      /**< Types preloaded, each queued once. */
+   int                     m_next;       /**< Index in m_types of the next type to load. */
+   bool                    m_closing;    /**< Set by the destructor to end the workers. */
+
+   std::thread             *m_workers;
+   int                     m_worker_count;
+   std::thread             m_scanner;    /**< Runs scan_files() once prescan() is called. */
+
+   void work(void);
+   void scan_files(const char **paths, int count);
+   void scan_file(const char *path);
+
+   // Delete effc++ requested operators
+   FFPreloader(const FFPreloader &)             = delete;
+   FFPreloader & operator=(const FFPreloader &) = delete;
+};
+
+#endif
@@ -0,0 +1,747 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -DEXCLUDE_TESTS -c -o ffscanner.o ffscanner.cpp"  -*-
+
+/** @file */
+
+#include "ffscanner.hpp"
+#include "skipscan.hpp"
+
+#include <stdio.h>
+#include <string.h>  // for strlen
+#include <ctype.h>   // for isspace
+#include <stdint.h>  // for uint16_t
+
+/** Cast a string to unsigned 16-bit integer for fast comparisons. */
+inline uint16_t castui16(const char *str)
+{
+   return *reinterpret_cast<const uint16_t*>(str);
+}
+
+/** Constant value for testing the beginning of lines in a fenced code block. */
+const uint16_t asterisk_space = castui16("* ");
+/** Constant value to test for end-of-block-comment. */
+const uint16_t asterisk_slash = castui16("*/");
+
+/**
+ * @brief Function for comparing a string with a uint16_t string constant.
+ * @sa @ref castui16
+ */
+inline bool cmpuint(uint16_t v, const char *s) { return v==castui16(s); }
+
+/** Bytes that may change processing of an S_CODE line. */
+const SkipScanner code_line_scanner("\\\"/`~");
+/** Bytes that may end a doxygen comment block or open a fence within one. */
+const SkipScanner doxy_line_scanner("/`~");
+
+/**
+ * @brief Returns the start of the line following the last newline in [@p p, @p end).
+ *
+ * If there is no newline, @p p is returned.
+ */
+inline const char *after_last_newline(const char *p, const char *end)
+{
+   const char *nl = static_cast<const char*>(memrchr(p, '\n', end-p));
+   return nl ? nl+1 : p;
+}
+
+
+FFScanner::FFScanner(FFEmitter &emitter)
+   : m_emitter(emitter), m_log(stderr),
+     m_state(S_CODE), m_fence_return_state(S_CODE),
+     m_in_string(false), m_highlighting(true), m_fence_indent(0),
+     m_fence_char('\0'), m_fence_char_count(0),
+     m_fenced_language(nullptr), m_fenced_language_size(0),
+     m_fence(), m_tokenizer(),
+     m_scan_buff(nullptr), m_scan_buff_size(0),
+     m_line_offset(0), m_line_length(0)
+{
+   reserve_fenced_language(0);
+   m_fenced_language[0] = '\0';
+   m_fence.language = m_fenced_language;
+}
+
+FFScanner::~FFScanner()
+{
+   delete [] m_fenced_language;
+   delete [] m_scan_buff;
+}
+
+/** @brief Prepare to scan a new document. */
+void FFScanner::reset(void)
+{
+   m_state = m_fence_return_state = S_CODE;
+   m_in_string = false;
+   m_fence_indent = 0;
+   m_fence_char = '\0';
+   m_fence_char_count = 0;
+   m_fenced_language[0] = '\0';
+   m_tokenizer.set_index(nullptr);
+}
+
+/** @brief Pass @p str through unchanged. */
+void FFScanner::emit(const char *str)
+{
+   m_emitter.text(str, strlen(str));
+}
+
+/** @brief Pass @p str through unchanged, restoring the newline removed from its line. */
+void FFScanner::emit_line(const char *str)
+{
+   emit(str);
+   m_emitter.text("\n", 1);
+}
+
+/** Make m_fenced_language large enough for a language name of @p len characters. */
+void FFScanner::reserve_fenced_language(size_t len)
+{
+   if (len >= m_fenced_language_size)
+   {
+      delete [] m_fenced_language;
+      m_fenced_language_size = len + 32;
+      m_fenced_language = new char[m_fenced_language_size];
+      m_fence.language = m_fenced_language;
+   }
+}
+
+/** Compare fenced language to @p str. */
+inline bool FFScanner::is_fenced_language(const char *str) const
+{
+   return 0==strcmp(m_fenced_language, str);
+}
+
+/**
+ * @brief Set the mode of the fenced code block from its language.
+ *
+ * Compare various languages against the m_fenced_language value
+ * to decide how the lines of the block are handled.
+ */
+void FFScanner::set_fenced_language_mode(void)
+{
+   m_fence.index = HLIndex::get_index(m_fenced_language);
+   if (m_fence.index)
+   {
+      m_fence.mode = FF_HIGHLIGHT;
+      m_tokenizer.set_index(m_fence.index);
+   }
+   else if (is_fenced_language("text") || is_fenced_language("txt"))
+      m_fence.mode = FF_TEXT;
+   else if (m_log)
+      fprintf(m_log, "*** Unable to find %s.hl. ***\n", m_fenced_language);
+}
+
+/**
+ * @brief Set fence values once end of fence string is detected:
+ *
+ * @return Number of characters to advance the string pointer.
+ * @param fence Pointer to string just past the last fence character.
+ * @param indented Number of characters before the fence on its line.
+ *
+ * This function will prepare the fence-related members, including
+ * m_fence_indent, m_fence_char, m_fence_char_count, m_fenced_language
+ * and m_fence.
+ *
+ * Blocks without a language, or with a language for which no highlighting
+ * file can be found, are left for Doxygen.
+ */
+int FFScanner::set_fence_values(const char *fence, int indented)
+{
+   int advance = 0;
+   m_fence_indent = indented;
+   m_fence_char = *(fence-1);
+   m_fenced_language[0] = '\0';
+   m_fence_return_state = m_state;
+   m_state = S_FENCED;
+
+   m_fence.mode = FF_DOXYGEN;
+   m_fence.index = nullptr;
+   m_fence.start = m_line_offset;
+   m_fence.end = m_line_offset;
+   m_fence.top_level = m_fence_return_state==S_CODE && !m_in_string;
+
+   if (*fence=='\0' || isspace(*fence))
+      return 0;
+   else
+   {
+      // Use new pointer, preserving start of string for later
+      // calculation of number of characters to advance;
+      const char *p = fence;
+
+      // Check first character to see if the language is brace-enclosed.
+      bool braced = *p=='{';
+
+      // Skip brace, if found
+      if (braced)
+         ++p;
+
+      // Skip optional period before extension
+      if (*p=='.')
+         ++p;
+
+      // Find the end of the language, a closing brace
+      // if braced, otherwise a space:
+      const char *language = p;
+      while (*p && (braced ? *p!='}' : !isspace(*p)))
+         ++p;
+
+      size_t len = p - language;
+      reserve_fenced_language(len);
+      memcpy(m_fenced_language, language, len);
+      m_fenced_language[len] = '\0';
+
+      // Advance past the closing brace, if any:
+      advance = p - fence;
+      if (braced && *p=='}')
+         ++advance;
+
+      if (m_fenced_language[0] && m_highlighting)
+         set_fenced_language_mode();
+
+      return advance;
+   }
+}
+
+/**
+ * @brief Report the opening of the fenced code block of the current line.
+ *
+ * @param line Text of the fence line to pass through if Doxygen is to
+ *             handle the block.
+ */
+void FFScanner::open_fence(const char *line)
+{
+   m_emitter.fence_open(m_fence);
+
+   if (m_fence.mode==FF_DOXYGEN)
+      emit_line(line);
+}
+
+/**
+ * @brief Hand one line of a fenced code block to the emitter.
+ *
+ * Highlighted lines are first tokenized, continuing any block comment
+ * or string left open by the previous line.
+ */
+void FFScanner::print_fenced_line(const char *str)
+{
+   switch(m_fence.mode)
+   {
+      case FF_DOXYGEN:
+         emit_line(str);
+         break;
+      case FF_TEXT:
+         m_emitter.code_line(str, offset_of(str), nullptr, 0);
+         break;
+      case FF_HIGHLIGHT:
+      {
+         int count = m_highlighting ? m_tokenizer.tokenize_line(str) : 0;
+         m_emitter.code_line(str, offset_of(str), m_tokenizer.spans(), count);
+         break;
+      }
+   }
+}
+
+void FFScanner::process_line_comment_line(char *str)
+{
+   emit_line(str);
+}
+
+void FFScanner::process_block_comment_line(char *str)
+{
+   // look for the end of the comment block
+
+   // if block:
+   //    set state  to S_CODE
+   //    print up to end-of-comment
+   //    hand-off to process_code_line()
+   // else
+   //    print comment line
+
+   emit_line(str);
+}
+
+/**
+ * @brief Looks for closing code fence before passing the string to be highlighted.
+ *
+ * I make assumptions about fenced code that may not be official but seem to be
+ * common practice: that, in addition to the code fences being the same length of
+ * the same character, that the opening and closing code fences start on the same
+ * column.  This leads to my practice removing from each fenced code line the
+ * count of characters before the fence code begins.  This may have to change if
+ * this results in a problem with code blocks indented in a list element.
+ */
+void FFScanner::process_fenced_line(char *str)
+{
+   // Print empty line if line is shorter than the fence_indent.
+   if (strlen(str) <= static_cast<size_t>(m_fence_indent))
+   {
+      if (m_fence.mode==FF_DOXYGEN)
+         emit_line(str);
+      else
+         m_emitter.code_line("", offset_of(str+strlen(str)), nullptr, 0);
+      return;
+   }
+
+   // Remove fence indent before any other consideration:
+   char *start = str + m_fence_indent;
+
+   // I'm assuming that if we delete from the beginning of each line
+   // the same number of characters that separate the start of the fence
+   // tag from the start of the line, it any asterisks that fall after
+   // the indent are part of the code, not a comment-block border.
+
+   // look for the end of the closing code fence:
+   char *end_of_fence = NULL;
+
+   char *p = strchr(start, m_fence_char);
+   if (p)
+   {
+      end_of_fence = p;
+
+      int i;
+      for (i=0; i<m_fence_char_count; ++i,++p)
+      {
+         if (*p != m_fence_char)
+            break;
+      }
+
+      // If the count doesn't match, it's not the terminator:
+      if (i!=m_fence_char_count || *p==m_fence_char)
+      {
+         end_of_fence = NULL;
+      }
+   }
+
+   if (end_of_fence)
+   {
+      if (m_fence.mode==FF_DOXYGEN)
+         emit_line(start);
+
+      m_fence.end = m_line_offset + m_line_length;
+      m_emitter.fence_close(m_fence);
+
+      // Nothing should follow an end-of-fence marker, so
+      // just change the flag without further processing.
+      m_state = m_fence_return_state;
+      m_fence_return_state = S_CODE;
+      if (m_log)
+         fprintf(m_log, "Reached the end of the fenced code block.\n");
+   }
+   else
+      print_fenced_line(start);
+}
+
+/**
+ * @brief Look for a fenced area in a doxy block.
+ *
+ * Looks for the beginning of a fenced code block.  If no fenced area,
+ * it simply prints the buffer and adds a newline at the end (all code lines
+ * replace the ending newline with a '\0').
+ *
+ * If a fenced area is found, the text up to the fence is printed,
+ * the state flag is set and then control is handed over to the
+ * fenced area function to finish processing the line.
+ */
+void FFScanner::process_doxy_block_comment_line(char *str)
+{
+   int findent = 0;
+
+   // find first non-space character:
+   char *p = str;
+   while (*p && isspace(*p))
+      ++p;
+
+   // Print out unchanged if empty line:
+   if (*p=='\0')
+      emit_line(str);
+   else  // if (*p)
+   {
+      // If at end-of-comment:
+      if (cmpuint(asterisk_slash,p))
+      {
+         // Skip asterisk and slash to continue just after the comment:
+         p+=2;
+
+         // Print out up to end-of-comment:
+         m_emitter.text(str, p-str);
+
+         // Revert to regular code processing from here:
+         m_state = S_CODE;
+         process_code_line(p);
+
+         // process_code finished the line, so abort continued processing:
+         return;
+      }
+      else if (cmpuint(asterisk_space,p))
+         p += 2;
+      else if (*p=='*')
+         ++p;
+
+      // Skip spaces before a possible fence so that a line of
+      // only spaces is printed rather than dropped:
+      while (*p && isspace(*p))
+         ++p;
+
+      if (!*p)
+         emit_line(str);
+
+      // Scan characters for a fence line opening:
+      while (*p)
+      {
+         // Ignoring leading spaces:
+         if (!isspace(*p))
+         {
+            // If a fence character
+            if (*p=='`' || *p=='~')
+            {
+               findent = p - str;
+               m_fence_char = *p;
+
+               // And if at least three of same fence character
+               if (m_fence_char==*(p+1) && m_fence_char==*(p+2))
+               {
+                  p += 3;
+
+                  // count and save the number of fence characters:
+                  for (m_fence_char_count=3;
+                       *p && *p==m_fence_char;
+                       ++p,++m_fence_char_count)
+                     ;
+
+                  set_fence_values(p, findent);
+
+                  if (m_fence.mode==FF_DOXYGEN)
+                  {
+                     // Reset fence_indent to 0 to prevent any modification
+                     // of comment lines.
+                     m_fence_indent = 0;
+                  }
+                  else if (m_log)
+                     fputs("*** Begin fenced code, fencedfilter handling! ***\n", m_log);
+
+                  // print line from start of code fence, or replace it:
+                  open_fence(str);
+
+                  // Do not process the rest of this fence line:
+                  return;
+               }
+            }
+
+            /*
+             * As soon as a non-fence character is found, we stop checking
+             * for a fence because the fence opener must be first thing on
+             * line (after optional '*' and spaces).
+             *
+             * We still need to look for the end of an end-of-comment marker
+             */
+            else
+            {
+               // Looking for an end-of-comment marker:
+               while (*p)
+               {
+                  // If end-of-comment found:
+                  if (cmpuint(asterisk_slash,p))
+                  {
+                     // Exit XXX_BLOCK_COMMENT state:
+                     m_state = S_CODE;
+
+                     // print up to and including the end-of-comment marker:
+                     p += 2;
+                     m_emitter.text(str, p-str);
+                     // Note, no newline here
+
+                     // Then process the line as normal code:
+                     process_code_line(p);
+
+                     // set flag to skip printing the rest of the line:
+                     str = NULL;
+                     break;
+                  }
+                  ++p;
+               }
+
+               if (str)
+                  emit_line(str);
+
+               // Break outer while, too, after finding non-fence character
+               break;
+            }
+         }
+         ++p;
+
+      } // end of scanning for fence character
+   }
+}
+
+/**
+ * @brief Scan a source file line to find and begin a comment block.
+ *
+ * This function processes raw lines from an input file.  It looks for the
+ * beginning of block comments, both normal (slash-asterisk) and
+ * Doxygen-recognized ("slash-asterisk-asterisk-space").
+ *
+ * Upon finding the block-comment start, it prints the text to that point,
+ * sets the state variable to S_BLOCK_COMMENT or S_DOXY_BLOCK_COMMENT and then
+ * passes a pointer to the text just following the block start to either
+ * process_block_comment_line() or process_doxy_block_comment_line() to finish
+ * processing the line.
+ */
+void FFScanner::process_code_line(char *str)
+{
+   char *p = str;
+   bool escaped = false;
+
+   int count_fence = 0;
+   char firstchar = *p;
+
+   if (firstchar=='`' || firstchar=='~')
+   {
+      while (*p==firstchar)
+      {
+         ++p;
+         ++count_fence;
+      }
+
+      if (count_fence>2)
+      {
+         m_fence_char_count = count_fence;
+         set_fence_values(p, 0);
+         open_fence(str);
+
+         // Line has already been printed:
+         return;
+      }
+   }
+
+   // look for beginning of a comment or a code fence:
+   p = str;
+   while (*p)
+   {
+      switch(*p)
+      {
+         case '\\':
+            escaped = !escaped;
+            break;
+         case '"':
+            if (!escaped)
+               m_in_string = !m_in_string;
+            break;
+         case '/':
+         {
+            if (!m_in_string)
+            {
+               if (*++p == '*')
+               {
+                  m_state = S_BLOCK_COMMENT;
+                  ++p;
+                  if (*p=='*' || *p=='!')
+                  {
+                     ++p;
+
+                     // A doxy comment is always /*! or /**, then a space or newline
+                     if (!*p || isspace(*p))
+                     {
+                        m_state = S_DOXY_BLOCK_COMMENT;
+                        m_fence_char_count = 0;
+                     }
+                  }
+
+                  if (*p=='\0')
+                  {
+                     emit_line(str);
+                     return;
+                  }
+                  else
+                  {
+                     m_emitter.text(str, p-str);
+
+                     switch(m_state)
+                     {
+                        case S_BLOCK_COMMENT:
+                           process_block_comment_line(p);
+                           return;
+                        case S_DOXY_BLOCK_COMMENT:
+                           process_doxy_block_comment_line(p);
+                           return;
+                        default:
+                           break;
+                     }
+                  }
+               }
+               else
+                  // If "/" but not "/*", continue before ++p increment below
+                  continue;
+            }
+            break;
+         }
+      }
+      ++p;
+   }
+
+   emit_line(str);
+}
+
+
+void FFScanner::process_line(char *str)
+{
+   switch(m_state)
+   {
+      case S_CODE:
+         process_code_line(str);
+         break;
+      case S_LINE_COMMENT:
+         process_line_comment_line(str);
+         break;
+      case S_BLOCK_COMMENT:
+         process_block_comment_line(str);
+         break;
+      case S_DOXY_BLOCK_COMMENT:
+         process_doxy_block_comment_line(str);
+         break;
+      case S_FENCED:
+         process_fenced_line(str);
+         break;
+   };
+}
+
+/**
+ * @brief Find the first line, starting at @p p, that needs the line processors.
+ *
+ * Using the SkipScanner for the current state, this function jumps over
+ * complete lines that the line processor for the state would print unchanged.
+ * Fence characters only matter in S_CODE if they start a line, so other fence
+ * characters are skipped without stopping.
+ *
+ * A final line without a newline is always left for the line processors,
+ * which add the missing newline.
+ *
+ * @param p   Start of a line in the input buffer.
+ * @param end End of the input buffer.
+ * @return Start of the first line to be processed, or @p end if none.
+ */
+const char *FFScanner::seek_line_to_process(const char *p, const char *end) const
+{
+   const SkipScanner *scanner = nullptr;
+   switch(m_state)
+   {
+      case S_CODE:
+         scanner = &code_line_scanner;
+         break;
+      case S_DOXY_BLOCK_COMMENT:
+         scanner = &doxy_line_scanner;
+         break;
+      case S_LINE_COMMENT:
+      case S_BLOCK_COMMENT:
+         // These states print every line unchanged:
+         return after_last_newline(p, end);
+      case S_FENCED:
+         return p;
+   }
+
+   const char *hit = p;
+   while ((hit=scanner->find(hit, end)) < end)
+   {
+      // Fence characters are only significant at the start of an S_CODE line:
+      if (m_state==S_CODE
+          && (*hit=='`' || *hit=='~')
+          && hit>p && *(hit-1)!='\n')
+      {
+         ++hit;
+         continue;
+      }
+
+      return after_last_newline(p, hit);
+   }
+
+   return after_last_newline(p, end);
+}
+
+/**
+ * @brief Process a buffer holding an entire input document.
+ *
+ * Runs of lines that would be passed through unchanged are handed to the
+ * emitter in a single call.  Each remaining line is copied to m_scan_buff,
+ * where the line processors are free to modify it, and handed to
+ * process_line().
+ *
+ * Offsets reported to the emitter are from the start of @p buff.
+ */
+void FFScanner::scan_buffer(const char *buff, size_t len)
+{
+   const char *p = buff;
+   const char *end = buff + len;
+
+   while (p < end)
+   {
+      const char *stop = seek_line_to_process(p, end);
+      if (stop > p)
+      {
+         m_emitter.text_ref(p, stop-p);
+         p = stop;
+         continue;
+      }
+
+      const char *eol = static_cast<const char*>(memchr(p, '\n', end-p));
+      size_t linelen = (eol ? eol : end) - p;
+
+      if (linelen >= m_scan_buff_size)
+      {
+         delete [] m_scan_buff;
+         m_scan_buff_size = linelen + 1024;
+         m_scan_buff = new char[m_scan_buff_size];
+      }
+
+      memcpy(m_scan_buff, p, linelen);
+      m_scan_buff[linelen] = '\0';
+
+      m_line_offset = p - buff;
+      m_line_length = linelen + (eol ? 1 : 0);
+      process_line(m_scan_buff);
+
+      p += m_line_length;
+   }
+}
+
+
+FFSpanCollector::~FFSpanCollector()
+{
+   clear();
+   delete [] m_fences.items;
+   delete [] m_spans.items;
+}
+
+/** @brief Forget the fences and spans collected so far. */
+void FFSpanCollector::clear(void)
+{
+   for (int i=0; i<m_fences.count; ++i)
+      delete [] m_fences.items[i].language;
+
+   m_fences.count = 0;
+   m_spans.count = 0;
+}
+
+/** @brief Save a copy of @p fence, with a copy of its language. */
+void FFSpanCollector::fence_open(const FFFence &fence)
+{
+   size_t len = strlen(fence.language);
+   char *language = new char[len+1];
+   memcpy(language, fence.language, len+1);
+
+   FFFence copy = fence;
+   copy.language = language;
+   m_fences.append(copy);
+}
+
+/** @brief Save the spans of @p line with offsets from the start of the input. */
+void FFSpanCollector::code_line(const char *line, size_t offset, const HLSpan *spans, int count)
+{
+   for (int i=0; i<count; ++i)
+   {
+      HLSpan span = spans[i];
+      span.offset += offset;
+      m_spans.append(span);
+   }
+}
+
+/** @brief Record the end of the last fence opened. */
+void FFSpanCollector::fence_close(const FFFence &fence)
+{
+   m_fences.items[m_fences.count-1].end = fence.end;
+}
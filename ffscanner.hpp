@@ -0,0 +1,208 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -DEXCLUDE_TESTS -c -o ffscanner.o ffscanner.cpp"  -*-
+
+/** @file */
+
+#ifndef FFSCANNER_HPP
+#define FFSCANNER_HPP
+
+#include <stddef.h>
+#include <stdio.h>
+#include "hlindex.hpp"
+#include "hllist.hpp"
+#include "hltoken.hpp"
+
+/** @brief How the lines of a fenced code block are handled. */
+enum FFFenceMode
+{
+   FF_DOXYGEN,     /**< Passed through unchanged for Doxygen to interpret. */
+   FF_TEXT,        /**< Wrapped as lines of plain text, for `text` and `txt` blocks. */
+   FF_HIGHLIGHT    /**< Highlighted with the HLIndex of the block's language. */
+};
+
+/** @brief A fenced code block found by FFScanner. */
+struct FFFence
+{
+   FFFenceMode   mode;
+   const char    *language;  /**< Language of the info string, empty if none.
+                              *   Valid only during the FFEmitter call.
+                              */
+   const HLIndex *index;     /**< Highlighting index if mode is FF_HIGHLIGHT. */
+   size_t        start;      /**< Offset of the opening fence line in the input. */
+   size_t        end;        /**< Offset after the closing fence line, once closed. */
+   bool          top_level;  /**< The block is in code rather than a comment or
+                              *   string, so a scan may begin anew after it.
+                              */
+};
+
+/**
+ * @brief Receives the output of an FFScanner.
+ *
+ * The scanner reports text outside of fenced code blocks as text to be
+ * passed through, and each line of a fenced code block as a line of code
+ * with the HLSpan runs found by an HLTokenizer.  An emitter decides what to
+ * make of them, for example HTML for Doxygen, or a list of spans for tools.
+ */
+class FFEmitter
+{
+public:
+   virtual ~FFEmitter() { }
+
+   /** @brief Text to pass through unchanged, which may not outlive the call. */
+   virtual void text(const char *str, size_t len) = 0;
+
+   /**
+    * @brief Text to pass through unchanged, in the input buffer.
+    *
+    * The text stays in place until FFScanner::scan_buffer() returns.
+    */
+   virtual void text_ref(const char *str, size_t len) { text(str, len); }
+
+   /** @brief A fenced code block begins, before any of its lines. */
+   virtual void fence_open(const FFFence &fence) = 0;
+
+   /**
+    * @brief A line of an FF_TEXT or FF_HIGHLIGHT fenced code block.
+    *
+    * @param line   The line, '\0'-terminated, without indent or newline.
+    * @param offset Offset of @p line in the input.
+    * @param spans  Highlighted runs, with offsets from @p line.
+    * @param count  Number of @p spans.
+    */
+   virtual void code_line(const char *line, size_t offset, const HLSpan *spans, int count) = 0;
+
+   /** @brief A fenced code block ends, after its closing fence line. */
+   virtual void fence_close(const FFFence &fence) = 0;
+};
+
+/**
+ * @brief An FFEmitter that collects the fenced code blocks and spans of a document.
+ *
+ * For tools that need to know where the keywords and comments are rather
+ * than the HTML.  The offsets of the spans are from the start of the
+ * scanned buffer, and each span belongs to the last fence opened before it,
+ * whose index names the span's category.  The collector keeps its own copy
+ * of the language of each fence.
+ */
+class FFSpanCollector : public FFEmitter
+{
+public:
+   FFSpanCollector(void) : m_fences(), m_spans() { }
+   virtual ~FFSpanCollector();
+
+   virtual void text(const char *str, size_t len) { }
+   virtual void fence_open(const FFFence &fence);
+   virtual void code_line(const char *line, size_t offset, const HLSpan *spans, int count);
+   virtual void fence_close(const FFFence &fence);
+
+   inline int fence_count(void) const               { return m_fences.count; }
+   inline const FFFence &fence(int i) const         { return m_fences.items[i]; }
+   inline int span_count(void) const                { return m_spans.count; }
+   inline const HLSpan &span(int i) const           { return m_spans.items[i]; }
+
+   void clear(void);
+
+private:
+   HLList<FFFence> m_fences;
+   HLList<HLSpan>  m_spans;
+
+   // Delete effc++ requested operators
+   FFSpanCollector(const FFSpanCollector &)             = delete;
+   FFSpanCollector & operator=(const FFSpanCollector &) = delete;
+};
+
+/**
+ * @brief The FencedFilter state machine, which finds fenced code blocks in source files.
+ *
+ * The scanner follows a source file through code, block comments, Doxygen
+ * comments and fenced code blocks, handing everything it finds to an
+ * FFEmitter.  A scanner holds the state of one document at a time, and
+ * can be reused for another document after reset().
+ */
+class FFScanner
+{
+public:
+   FFScanner(FFEmitter &emitter);
+   ~FFScanner();
+
+   void reset(void);
+   void scan_buffer(const char *buff, size_t len);
+
+   /** @brief Set the stream for progress and error messages, nullptr for none. */
+   inline void set_log(FILE *log)          { m_log = log; }
+
+   /**
+    * @brief Turn highlighting of fenced blocks on or off.
+    *
+    * With highlighting off, no highlighting file is loaded, and every block
+    * is reported as FF_DOXYGEN, for a quick pass that only needs the fences.
+    */
+   inline void set_highlighting(bool on)   { m_highlighting = on; }
+
+private:
+   enum STATE
+   {
+      S_CODE,
+      S_LINE_COMMENT,
+      S_BLOCK_COMMENT,
+      S_DOXY_BLOCK_COMMENT,
+      S_FENCED
+   };
+
+   FFEmitter &m_emitter;
+   FILE      *m_log;            /**< Stream for messages, stderr unless set_log(). */
+
+   STATE m_state;               /**< State variable to track current processing mode. */
+   STATE m_fence_return_state;  /**< State to return to after processing a fenced
+                                 *   code block.
+                                 */
+
+   bool m_in_string;            /**< Another state variable to avoid
+                                 *   interpreting characters in a string.
+                                 */
+   bool m_highlighting;         /**< Load and tokenize languages, see set_highlighting(). */
+   int  m_fence_indent;         /**< Count of characters in line before fence.
+                                 *   Remove this number of characters before each
+                                 *   fenced line before highlighting.
+                                 */
+   char m_fence_char;           /**< Character of the current fence, '\0' if none. */
+   int  m_fence_char_count;     /**< Number of characters in the opening code fence.*/
+
+   char   *m_fenced_language;   /**< Language of fenced area, if designated. */
+   size_t m_fenced_language_size;
+
+   FFFence     m_fence;         /**< The current fenced code block. */
+   HLTokenizer m_tokenizer;     /**< Finds the spans of highlighted lines. */
+
+   char   *m_scan_buff;         /**< Copy of the current line, for the line processors. */
+   size_t m_scan_buff_size;
+   size_t m_line_offset;        /**< Offset of m_scan_buff in the input. */
+   size_t m_line_length;        /**< Length of the line in the input, with its newline. */
+
+   /** @brief Offset in the input of @p p, a position in m_scan_buff. */
+   inline size_t offset_of(const char *p) const { return m_line_offset + (p - m_scan_buff); }
+
+   void emit(const char *str);
+   void emit_line(const char *str);
+
+   void reserve_fenced_language(size_t len);
+   bool is_fenced_language(const char *str) const;
+   void set_fenced_language_mode(void);
+   int  set_fence_values(const char *fence, int indented);
+   void open_fence(const char *line);
+
+   void process_line(char *str);
+   void process_code_line(char *str);
+   void process_line_comment_line(char *str);
+   void process_block_comment_line(char *str);
+   void process_doxy_block_comment_line(char *str);
+   void process_fenced_line(char *str);
+   void print_fenced_line(const char *str);
+
+   const char *seek_line_to_process(const char *p, const char *end) const;
+
+   // Delete effc++ requested operators
+   FFScanner(const FFScanner &)             = delete;
+   FFScanner & operator=(const FFScanner &) = delete;
+};
+
+#endif
@@ -0,0 +1,488 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -DEXCLUDE_TESTS -c -o ffwatch.o ffwatch.cpp"  -*-
+
+/** @file */
+
+#include "ffwatch.hpp"
+#include "hlindex.hpp"
+#include "hlpath.hpp"
+#include "ffmap.hpp"
+
+#include <errno.h>
+#include <stdlib.h>         // for realpath()
+#include <string.h>
+#include <limits.h>         // for PATH_MAX
+#include <time.h>           // for clock_gettime()
+#include <unistd.h>
+#include <fcntl.h>          // for open()
+#include <dirent.h>         // for opendir()
+#include <poll.h>
+#include <sys/stat.h>       // for mkdir()
+#include <sys/inotify.h>
+#include <thread>
+
+/**
+ * @brief Passes the output of an FFScanner to another FFEmitter, noting
+ *        the language of each fenced block on the way.
+ */
+class LanguageRecorder : public FFEmitter
+{
+public:
+   LanguageRecorder(FFEmitter &emitter, HLList<char*> &languages)
+      : m_emitter(emitter), m_languages(languages) { }
+
+   virtual void text(const char *str, size_t len)     { m_emitter.text(str, len); }
+   virtual void text_ref(const char *str, size_t len) { m_emitter.text_ref(str, len); }
+
+   virtual void fence_open(const FFFence &fence)
+   {
+      if (*fence.language)
+         record(HLIndex::resolve_alias(fence.language));
+
+      m_emitter.fence_open(fence);
+   }
+
+   virtual void code_line(const char *line, size_t offset, const HLSpan *spans, int count)
+   {
+      m_emitter.code_line(line, offset, spans, count);
+   }
+
+   virtual void fence_close(const FFFence &fence) { m_emitter.fence_close(fence); }
+
+private:
+   FFEmitter     &m_emitter;
+   HLList<char*> &m_languages;
+
+   /** @brief Add @p language to the list, if not already there. */
+   void record(const char *language)
+   {
+      for (int i=0; i<m_languages.count; ++i)
+         if (strcmp(m_languages.items[i], language)==0)
+            return;
+
+      size_t len = strlen(language);
+      char *copy = new char[len+1];
+      memcpy(copy, language, len+1);
+      m_languages.append(copy);
+   }
+
+   // Delete effc++ requested operators
+   LanguageRecorder(const LanguageRecorder &)             = delete;
+   LanguageRecorder & operator=(const LanguageRecorder &) = delete;
+};
+
+/**
+ * @brief Constructor.
+ *
+ * @param format  Output format, as for new_markup_emitter().
+ * @param compact Merge neighboring spans, as for new_markup_emitter().
+ * @param load    Function to filter a document.
+ */
+FFWatcher::FFWatcher(const char *format, bool compact, FFLoad_Func load)
+   : m_format(format), m_compact(compact), m_load(load),
+     m_src_dir(nullptr), m_out_dir(nullptr),
+     m_inotify(-1), m_done(),
+     m_documents(), m_watches()
+{
+   m_done[0] = m_done[1] = -1;
+}
+
+FFWatcher::~FFWatcher()
+{
+   for (int i=0; i<m_documents.count; ++i)
+   {
+      Document &doc = m_documents.items[i];
+      for (int j=0; j<doc.languages.count; ++j)
+         delete [] doc.languages.items[j];
+      delete [] doc.languages.items;
+      delete [] doc.name;
+   }
+   delete [] m_documents.items;
+
+   for (int i=0; i<m_watches.count; ++i)
+      delete [] m_watches.items[i].path;
+   delete [] m_watches.items;
+
+   free(m_src_dir);
+   free(m_out_dir);
+
+   if (m_inotify>=0)
+      close(m_inotify);
+   if (m_done[0]>=0)
+   {
+      close(m_done[0]);
+      close(m_done[1]);
+   }
+}
+
+/**
+ * @brief Filter @p src_dir to @p out_dir, then keep it filtered until an error occurs.
+ *
+ * @param src_dir Directory of the documents to filter.
+ * @param out_dir Directory for the filtered documents, created if necessary.
+ * @return Exit status of the program.
+ */
+int FFWatcher::run(const char *src_dir, const char *out_dir)
+{
+   if (mkdir(out_dir, 0777) && errno!=EEXIST)
+   {
+      fprintf(stderr, "Unable to create directory \"%s\": %s.\n", out_dir, strerror(errno));
+      return 1;
+   }
+
+   m_src_dir = realpath(src_dir, nullptr);
+   m_out_dir = realpath(out_dir, nullptr);
+   if (!m_src_dir || !m_out_dir)
+   {
+      fprintf(stderr, "Unable to find directory \"%s\".\n", m_src_dir ? out_dir : src_dir);
+      return 1;
+   }
+
+   // Output written to the source directory would be filtered again:
+   if (strcmp(m_src_dir, m_out_dir)==0)
+   {
+      fprintf(stderr, "The output directory must differ from the source directory.\n");
+      return 1;
+   }
+
+   m_inotify = inotify_init1(IN_CLOEXEC);
+   if (m_inotify<0 || pipe2(m_done, O_CLOEXEC))
+   {
+      fprintf(stderr, "Unable to watch files: %s.\n", strerror(errno));
+      return 1;
+   }
+
+   if (!add_watch(m_src_dir, true))
+      return 1;
+
+   int dir_count = HLIndex::search_dir_count();
+   for (int i=0; i<dir_count; ++i)
+      add_watch(HLPath::dir(i), false);
+
+   filter_all();
+
+   struct pollfd fds[2] = { { m_inotify, POLLIN, 0 }, { m_done[0], POLLIN, 0 } };
+   while (true)
+   {
+      if (poll(fds, 2, -1)<0)
+      {
+         if (errno==EINTR)
+            continue;
+         break;
+      }
+
+      if (fds[0].revents & POLLIN)
+         read_events();
+
+      if (fds[1].revents & POLLIN)
+      {
+         Reload *reload;
+         if (read(m_done[0], &reload, sizeof(reload))==sizeof(reload))
+            finish_reload(reload);
+      }
+   }
+
+   fprintf(stderr, "Stopped watching files: %s.\n", strerror(errno));
+   return 1;
+}
+
+/**
+ * @brief Watch the directory @p path for files written or moved into it.
+ *
+ * @param path      Absolute path of the directory.
+ * @param is_source TRUE for the source directory, FALSE for a search path
+ *                  directory.  A directory may be both.
+ */
+bool FFWatcher::add_watch(const char *path, bool is_source)
+{
+   int wd = inotify_add_watch(m_inotify, path, IN_CLOSE_WRITE | IN_MOVED_TO);
+   if (wd<0)
+   {
+      fprintf(stderr, "Unable to watch \"%s\": %s.\n", path, strerror(errno));
+      return false;
+   }
+
+   // A directory watched twice gets the same descriptor:
+   for (int i=0; i<m_watches.count; ++i)
+   {
+      Watch &watch = m_watches.items[i];
+      if (watch.wd==wd)
+      {
+         watch.is_source |= is_source;
+         watch.is_search |= !is_source;
+         return true;
+      }
+   }
+
+   Watch watch = { wd, dup_str(path, strlen(path)), is_source, !is_source };
+   m_watches.append(watch);
+   return true;
+}
+
+/** @brief Filter every document of the source directory. */
+void FFWatcher::filter_all(void)
+{
+   DIR *dir = opendir(m_src_dir);
+   if (!dir)
+   {
+      fprintf(stderr, "Unable to read directory \"%s\".\n", m_src_dir);
+      return;
+   }
+
+   struct dirent *entry;
+   struct stat st;
+   while ((entry=readdir(dir)))
+   {
+      const char *name = entry->d_name;
+      if (*name!='.' && !is_highlighting_file(name)
+          && fstatat(dirfd(dir), name, &st, 0)==0 && S_ISREG(st.st_mode))
+         filter(get_document(name));
+   }
+
+   closedir(dir);
+}
+
+/**
+ * @brief Filter @p doc to the output directory, noting the languages it uses.
+ *
+ * The output is written to a hidden file that then replaces the output
+ * file, so a reader never sees a partly written document.
+ */
+void FFWatcher::filter(Document &doc)
+{
+   char src[PATH_MAX], out[PATH_MAX], tmp[PATH_MAX];
+   snprintf(src, sizeof(src), "%s/%s", m_src_dir, doc.name);
+   snprintf(out, sizeof(out), "%s/%s", m_out_dir, doc.name);
+   snprintf(tmp, sizeof(tmp), "%s/.%s.tmp", m_out_dir, doc.name);
+
+   struct timespec start, end;
+   clock_gettime(CLOCK_MONOTONIC, &start);
+
+   // The output is left alone if the document cannot be opened:
+   int in_fd = open_document(src);
+   if (in_fd<0)
+      return;
+
+   int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+   if (fd<0)
+   {
+      fprintf(stderr, "Unable to write file \"%s\".\n", tmp);
+      close(in_fd);
+      return;
+   }
+
+   for (int i=0; i<doc.languages.count; ++i)
+      delete [] doc.languages.items[i];
+   doc.languages.count = 0;
+
+   {
+      OutSink sink(fd);
+      FFEmitter *emitter = new_markup_emitter(m_format, m_compact, sink);
+      LanguageRecorder recorder(*emitter, doc.languages);
+      FFScanner scanner(recorder);
+
+      (*m_load)(scanner, sink, in_fd, src);
+      delete emitter;
+   }
+
+   close(fd);
+   if (rename(tmp, out))
+   {
+      fprintf(stderr, "Unable to replace file \"%s\".\n", out);
+      unlink(tmp);
+      return;
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &end);
+   double ms = (end.tv_sec-start.tv_sec)*1e3 + (end.tv_nsec-start.tv_nsec)/1e6;
+   fprintf(stderr, "Filtered %s in %.1f ms.\n", doc.name, ms);
+}
+
+/** @brief Returns the Document for the file @p name, adding it if new. */
+FFWatcher::Document &FFWatcher::get_document(const char *name)
+{
+   for (int i=0; i<m_documents.count; ++i)
+      if (strcmp(m_documents.items[i].name, name)==0)
+         return m_documents.items[i];
+
+   Document doc = { dup_str(name, strlen(name)), { nullptr, 0, 0 } };
+   m_documents.append(doc);
+   return m_documents.items[m_documents.count-1];
+}
+
+/** @brief Act on the file @p name, just written in the directory of @p watch. */
+void FFWatcher::file_changed(const Watch &watch, const char *name)
+{
+   // Skip hidden files, including the output of editors in progress:
+   if (*name=='.')
+      return;
+
+   if (is_highlighting_file(name))
+   {
+      if (watch.is_search)
+         start_reload(watch.path, name);
+   }
+   else if (watch.is_source)
+      filter(get_document(name));
+}
+
+/**
+ * @brief Parse the highlighting file @p name of @p dir in a background thread.
+ *
+ * Documents are filtered with the index in the registry while the new
+ * index is built.  The thread sends the finished Reload to finish_reload()
+ * through the m_done pipe.
+ */
+void FFWatcher::start_reload(const char *dir, const char *name)
+{
+   char path[PATH_MAX];
+   snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+   char *type = dup_str(name, strlen(name)-3);
+
+   // A file hidden by a file of the same name earlier in the search path is not used:
+   const char *found = HLIndex::find_file(type);
+   if (found && strcmp(found, path)!=0)
+   {
+      delete [] type;
+      return;
+   }
+
+   start_build(type, path);
+}
+
+/**
+ * @brief Parse the highlighting file at @p path for @p type in a background
+ *        thread, taking ownership of @p type.
+ */
+void FFWatcher::start_build(char *type, const char *path)
+{
+   Reload *reload = new Reload;
+   reload->type = type;
+   reload->path = dup_str(path, strlen(path));
+   reload->index = nullptr;
+
+   std::thread(build_index, reload, m_done[1]).detach();
+}
+
+/** @brief Body of the background thread of start_reload(). */
+void FFWatcher::build_index(Reload *reload, int done_fd)
+{
+   reload->index = HLIndex::build(reload->type, reload->path);
+
+   // Writes to a pipe of no more than PIPE_BUF characters are atomic:
+   if (write(done_fd, &reload, sizeof(reload))!=sizeof(reload))
+      fprintf(stderr, "Unable to report the reload of \"%s\".\n", reload->path);
+}
+
+/**
+ * @brief Publish the index of a finished @p reload, and filter the
+ *        documents of its language again.
+ *
+ * The types whose highlighting files `!include` the reloaded type still
+ * use the replaced index, so they are parsed again, too, and their own
+ * documents filtered when each finishes.
+ */
+void FFWatcher::finish_reload(Reload *reload)
+{
+   if (reload->index)
+   {
+      const HLIndex *replaced = HLIndex::publish(reload->type, reload->index);
+      if (replaced)
+      {
+         HLList<const char*> dependents = { nullptr, 0, 0 };
+         HLIndex::find_dependents(replaced, dependents);
+
+         for (int i=0; i<dependents.count; ++i)
+         {
+            const char *type = dependents.items[i];
+            const char *path = HLIndex::find_file(type);
+            if (path)
+               start_build(dup_str(type, strlen(type)), path);
+         }
+
+         if (dependents.count)
+            fprintf(stderr, "Parsing %d file%s that include %s again.\n",
+                    dependents.count, dependents.count==1 ? "" : "s", reload->path);
+         delete [] dependents.items;
+      }
+
+      int count = 0;
+      for (int i=0; i<m_documents.count; ++i)
+      {
+         Document &doc = m_documents.items[i];
+         for (int j=0; j<doc.languages.count; ++j)
+         {
+            if (strcmp(doc.languages.items[j], reload->type)==0)
+            {
+               filter(doc);
+               ++count;
+               break;
+            }
+         }
+      }
+
+      // No document is being filtered, so no scan holds a replaced index:
+      HLIndex::reclaim();
+
+      fprintf(stderr, "Reloaded %s, filtering %d document%s again.\n",
+              reload->path, count, count==1 ? "" : "s");
+   }
+   else
+      fprintf(stderr, "Unable to read highlighting file \"%s\".\n", reload->path);
+
+   delete [] reload->type;
+   delete [] reload->path;
+   delete reload;
+}
+
+/** @brief Read the pending inotify events, acting on each file named. */
+void FFWatcher::read_events(void)
+{
+   char buff[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+   ssize_t len = read(m_inotify, buff, sizeof(buff));
+   if (len<=0)
+      return;
+
+   const char *p = buff;
+   while (p < buff+len)
+   {
+      const struct inotify_event *event = reinterpret_cast<const struct inotify_event*>(p);
+      p += sizeof(struct inotify_event) + event->len;
+
+      // Events were lost, so any document may have changed:
+      if (event->mask & IN_Q_OVERFLOW)
+      {
+         filter_all();
+         continue;
+      }
+
+      if (event->len==0)
+         continue;
+
+      for (int i=0; i<m_watches.count; ++i)
+      {
+         if (m_watches.items[i].wd==event->wd)
+         {
+            file_changed(m_watches.items[i], event->name);
+            break;
+         }
+      }
+   }
+}
+
+/** @brief Returns TRUE if the file @p name has the `.hl` extension. */
+bool FFWatcher::is_highlighting_file(const char *name)
+{
+   size_t len = strlen(name);
+   return len>3 && strcmp(name+len-3, ".hl")==0;
+}
+
+/** @brief Returns a new[]-allocated copy of the @p len characters of @p str. */
+char *FFWatcher::dup_str(const char *str, size_t len)
+{
+   char *copy = new char[len+1];
+   memcpy(copy, str, len);
+   copy[len] = '\0';
+   return copy;
+}
@@ -0,0 +1,91 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -DEXCLUDE_TESTS -c -o ffwatch.o ffwatch.cpp"  -*-
+
+/** @file */
+
+#ifndef FFWATCH_HPP
+#define FFWATCH_HPP
+
+#include "markupemitter.hpp"
+#include "hllist.hpp"
+
+/**
+ * @brief Keeps an output directory filtered from a source directory as files change.
+ *
+ * Every file of the source directory is filtered once to a file of the same
+ * name in the output directory.  Then inotify reports each file written to
+ * the source directory, which is filtered again right away.  Highlighting
+ * files stay loaded from one document to the next, so a change costs only
+ * the filtering of the changed document.
+ *
+ * A highlighting file changed in a search path directory is parsed again in
+ * a background thread, and the new HLIndex is published to the registry when
+ * ready.  The highlighting files that `!include` it are then parsed again
+ * in turn, to use the new index.  Only the documents with blocks of the
+ * reloaded languages are filtered again.
+ */
+class FFWatcher
+{
+public:
+   FFWatcher(const char *format, bool compact, FFLoad_Func load);
+   ~FFWatcher();
+
+   int run(const char *src_dir, const char *out_dir);
+
+private:
+   /** @brief A file of the source directory. */
+   struct Document
+   {
+      char          *name;       /**< File name in the source directory. */
+      HLList<char*> languages;   /**< Types of its fenced blocks, aliases resolved. */
+   };
+
+   /** @brief A directory watched with inotify. */
+   struct Watch
+   {
+      int  wd;                   /**< inotify watch descriptor. */
+      char *path;                /**< Path of the directory. */
+      bool is_source;            /**< The source directory, whose files are filtered. */
+      bool is_search;            /**< A search path directory, whose `.hl` files are reloaded. */
+   };
+
+   /** @brief A highlighting file being parsed in the background. */
+   struct Reload
+   {
+      char    *type;             /**< Name of the file without `.hl`. */
+      char    *path;             /**< Path of the file. */
+      HLIndex *index;            /**< The new index, set by the background thread. */
+   };
+
+   const char       *m_format;
+   bool             m_compact;
+   FFLoad_Func      m_load;
+
+   char             *m_src_dir;  /**< Absolute path of the source directory. */
+   char             *m_out_dir;  /**< Absolute path of the output directory. */
+
+   int              m_inotify;   /**< inotify instance, or -1. */
+   int              m_done[2];   /**< Pipe on which finished Reloads are sent. */
+
+   HLList<Document> m_documents;
+   HLList<Watch>    m_watches;
+
+   bool add_watch(const char *path, bool is_source);
+   void filter_all(void);
+   void filter(Document &doc);
+   Document &get_document(const char *name);
+   void file_changed(const Watch &watch, const char *name);
+   void start_reload(const char *dir, const char *name);
+   void start_build(char *type, const char *path);
+   void finish_reload(Reload *reload);
+   void read_events(void);
+
+   static void build_index(Reload *reload, int done_fd);
+   static bool is_highlighting_file(const char *name);
+   static char *dup_str(const char *str, size_t len);
+
+   // Delete effc++ requested operators
+   FFWatcher(const FFWatcher &)             = delete;
+   FFWatcher & operator=(const FFWatcher &) = delete;
+};
+
+#endif
@@ -0,0 +1,434 @@
+// -*- compile-command: "make hl2cpp"  -*-
+
+/**
+ * @file
+ *
+ * @brief Converts highlighting files into compiled-in tables.
+ *
+ * Usage: `hl2cpp -o <output.cpp> <type> [<type> ...]`
+ *
+ * Each @e type is loaded like a fenced code block info string, that is,
+ * from `<type>.hl` along the HLPath search path.  The HLIndex built from the
+ * file is written as `constexpr` HLBuiltin tables, which are linked into
+ * fencedfilter and registered with HLIndex::set_builtins().
+ *
+ * For each table, a matcher function is generated to find tags without
+ * walking the table.  The matchers honor the `!ci` and `!ht` flags of the
+ * highlighting file.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "hlindex.hpp"
+
+/**
+ * @brief Write @p str as a C string literal in highlighting file form.
+ *
+ * Backslashes are doubled so that the string resolves to @p str again
+ * when HLNode saves it.  Quotes and non-printing characters are escaped
+ * for the C compiler.
+ */
+void write_literal(FILE *out, const char *str)
+{
+   if (!str)
+   {
+      fputs("nullptr", out);
+      return;
+   }
+
+   fputc('"', out);
+   while (*str)
+   {
+      unsigned char ch = static_cast<unsigned char>(*str);
+      if (ch=='\\')
+         fputs("\\\\\\\\", out);
+      else if (ch=='"')
+         fputs("\\\"", out);
+      else if (ch=='?')
+         fputs("\\?", out);   // avoid trigraphs
+      else if (isprint(ch))
+         fputc(ch, out);
+      else
+         fprintf(out, "\\%03o", ch);
+
+      ++str;
+   }
+   fputc('"', out);
+}
+
+/**
+ * @brief Returns the position of @p category among the rule lines of @p root.
+ *
+ * Nodes without a tag, left by highlighting file comment lines, are
+ * not counted, as they are not written to the tables.
+ */
+unsigned category_index(const HLNode *root, const HLNode *category)
+{
+   unsigned index = 0;
+   const HLNode *node = root->first_child();
+   while (node && node!=category)
+   {
+      if (node->tag())
+         ++index;
+      node = node->next_sibling();
+   }
+
+   return index;
+}
+
+/** @brief Write a table of tags, named @p prefix followed by @p table. */
+void write_tags(FILE *out,
+                const char *prefix,
+                const char *table,
+                const HLIndex *ndx,
+                int count,
+                const HLNode *(HLIndex::*get)(int) const)
+{
+   if (count==0)
+      return;
+
+   fprintf(out, "constexpr HLBuiltinTag %s_%s[] =\n{\n", prefix, table);
+   for (int i=0; i<count; ++i)
+   {
+      const HLNode *node = (ndx->*get)(i);
+      fputs("   { ", out);
+      write_literal(out, node->tag());
+      fputs(", ", out);
+      write_literal(out, node->value());
+      fprintf(out, ", %u }%s\n",
+              category_index(ndx->root(), node->parent()),
+              i+1<count ? "," : "");
+   }
+   fputs("};\n\n", out);
+}
+
+/**
+ * @brief Write a character constant for @p ch, to compare with an unsigned char.
+ */
+void write_char(FILE *out, unsigned char ch)
+{
+   if (ch=='\\' || ch=='\'')
+      fprintf(out, "'\\%c'", ch);
+   else if (isprint(ch))
+      fprintf(out, "'%c'", ch);
+   else
+      fprintf(out, "%u", ch);
+}
+
+/**
+ * @brief Generates a matcher function for a sorted table of tags.
+ *
+ * The tags are arranged as a tree of `switch` statements, one level per
+ * character position, where a run of positions with only one possible
+ * character becomes a single chain of comparisons.  Where a tag ends, the
+ * function returns the index of the tag, after checking for the end of the
+ * word if the tags are words.  Since the tags are sorted, the tag returned
+ * is the first match in the table, as HLIndex would find by walking it.
+ */
+class MatcherWriter
+{
+public:
+   MatcherWriter(FILE *out, const HLIndex *ndx, bool words)
+      : m_out(out), m_ndx(ndx), m_words(words)
+   {
+   }
+
+   void write(const char *name, int count)
+   {
+      fprintf(m_out, "int %s(const char *s)\n{\n", name);
+      fputs("   const unsigned char *u = reinterpret_cast<const unsigned char*>(s);\n\n", m_out);
+      write_range(0, count, 0, 1);
+      fputs("   return -1;\n}\n\n", m_out);
+   }
+
+private:
+   FILE          *m_out;
+   const HLIndex *m_ndx;
+   bool          m_words;   /**< Word tags, otherwise comment tags. */
+
+   const char *tag(int i) const
+   {
+      return m_words ? m_ndx->word(i)->tag() : m_ndx->comment(i)->tag();
+   }
+
+   unsigned char ch(int i, size_t pos) const
+   {
+      return static_cast<unsigned char>(tag(i)[pos]);
+   }
+
+   void indent(int level) const
+   {
+      for (int i=0; i<level; ++i)
+         fputs("   ", m_out);
+   }
+
+   /** @brief Write the expression for the character at @p pos of the string. */
+   void write_subject(size_t pos) const
+   {
+      if (m_ndx->case_insensitive())
+         fprintf(m_out, "hl_lower(u[%zu])", pos);
+      else
+         fprintf(m_out, "u[%zu]", pos);
+   }
+
+   /**
+    * @brief Write the matching code for tags [@p lo, @p hi), which share
+    *        their first @p pos characters.
+    */
+   void write_range(int lo, int hi, size_t pos, int level) const
+   {
+      // A tag ending here is the first tag of the range.  Skip duplicates.
+      if (tag(lo)[pos]=='\0')
+      {
+         indent(level);
+         if (m_words)
+         {
+            fprintf(m_out, "if (!%s(u[%zu]))\n",
+                    m_ndx->hyphenated_tags() ? "hl_hyphenated_name_char" : "hl_name_char",
+                    pos);
+            indent(level+1);
+         }
+         fprintf(m_out, "return %d;\n", lo);
+
+         // A comment tag always matches once complete:
+         if (!m_words)
+            return;
+
+         while (lo<hi && tag(lo)[pos]=='\0')
+            ++lo;
+         if (lo==hi)
+            return;
+      }
+
+      // Find the characters shared by all the remaining tags.  Since the
+      // tags are sorted, they are those shared by the first and last tags:
+      size_t end = pos;
+      while (ch(lo,end) && ch(lo,end)==ch(hi-1,end))
+         ++end;
+
+      if (end>pos)
+      {
+         indent(level);
+         fputs("if (", m_out);
+         for (size_t i=pos; i<end; ++i)
+         {
+            if (i>pos)
+               fputs(" && ", m_out);
+            write_subject(i);
+            fputs("==", m_out);
+            write_char(m_out, ch(lo,i));
+         }
+         fputs(")\n", m_out);
+         indent(level);
+         fputs("{\n", m_out);
+         write_range(lo, hi, end, level+1);
+         indent(level);
+         fputs("}\n", m_out);
+         return;
+      }
+
+      indent(level);
+      fputs("switch (", m_out);
+      write_subject(pos);
+      fputs(")\n", m_out);
+      indent(level);
+      fputs("{\n", m_out);
+      while (lo<hi)
+      {
+         int group_end = lo+1;
+         while (group_end<hi && ch(group_end,pos)==ch(lo,pos))
+            ++group_end;
+
+         indent(level+1);
+         fputs("case ", m_out);
+         write_char(m_out, ch(lo,pos));
+         fputs(":\n", m_out);
+         write_range(lo, group_end, pos+1, level+2);
+         indent(level+2);
+         fputs("break;\n", m_out);
+
+         lo = group_end;
+      }
+      indent(level);
+      fputs("}\n", m_out);
+   }
+
+   // Delete effc++ requested operators
+   MatcherWriter(const MatcherWriter &)             = delete;
+   MatcherWriter & operator=(const MatcherWriter &) = delete;
+};
+
+/** @brief Write the matcher functions of @p ndx, using @p prefix to name them. */
+void write_matchers(FILE *out, const char *prefix, const HLIndex *ndx)
+{
+   char name[64];
+   if (ndx->word_count())
+   {
+      snprintf(name, sizeof(name), "%s_match_word", prefix);
+      MatcherWriter(out, ndx, true).write(name, ndx->word_count());
+   }
+   if (ndx->comment_count())
+   {
+      snprintf(name, sizeof(name), "%s_match_comment", prefix);
+      MatcherWriter(out, ndx, false).write(name, ndx->comment_count());
+   }
+}
+
+/** @brief Write the tables of @p ndx, using @p prefix to name the tables. */
+void write_tables(FILE *out, const char *prefix, const HLIndex *ndx)
+{
+   fprintf(out, "constexpr HLBuiltinCategory %s_categories[] =\n{\n", prefix);
+   const char *separator = "";
+   for (const HLNode *node = ndx->root()->first_child(); node; node = node->next_sibling())
+   {
+      if (node->tag())
+      {
+         fprintf(out, "%s   { ", separator);
+         write_literal(out, node->tag());
+         fputs(", ", out);
+         write_literal(out, node->value());
+         fputs(" }", out);
+         separator = ",\n";
+      }
+   }
+   fputs("\n};\n\n", out);
+
+   write_tags(out, prefix, "words", ndx, ndx->word_count(), &HLIndex::word);
+   write_tags(out, prefix, "comments", ndx, ndx->comment_count(), &HLIndex::comment);
+   write_tags(out, prefix, "patterns", ndx, ndx->pattern_count(), &HLIndex::pattern);
+}
+
+/** @brief Write the HLBuiltin element for @p ndx, whose tables are named with @p prefix. */
+void write_builtin(FILE *out, const char *prefix, const char *type, const HLIndex *ndx)
+{
+   unsigned categories = category_index(ndx->root(), nullptr);
+
+   fputs("   { ", out);
+   write_literal(out, type);
+   fprintf(out, ", %s, %s,\n",
+           ndx->hyphenated_tags() ? "true" : "false",
+           ndx->case_insensitive() ? "true" : "false");
+   fprintf(out, "     %s_categories, %u,\n", prefix, categories);
+
+   if (ndx->word_count())
+      fprintf(out, "     %s_words, %d,\n", prefix, ndx->word_count());
+   else
+      fputs("     nullptr, 0,\n", out);
+
+   if (ndx->comment_count())
+      fprintf(out, "     %s_comments, %d,\n", prefix, ndx->comment_count());
+   else
+      fputs("     nullptr, 0,\n", out);
+
+   if (ndx->pattern_count())
+      fprintf(out, "     %s_patterns, %d,\n", prefix, ndx->pattern_count());
+   else
+      fputs("     nullptr, 0,\n", out);
+
+   if (ndx->word_count())
+      fprintf(out, "     %s_match_word, ", prefix);
+   else
+      fputs("     nullptr, ", out);
+
+   if (ndx->comment_count())
+      fprintf(out, "%s_match_comment }", prefix);
+   else
+      fputs("nullptr }", out);
+}
+
+/** @brief Character classes used by the generated matchers. */
+const char matcher_helpers[] =
+   "inline unsigned char hl_lower(unsigned char c)\n"
+   "{\n"
+   "   return (c>=65 && c<=90) ? c+32 : c;\n"
+   "}\n\n"
+   "inline bool hl_name_char(unsigned char c)\n"
+   "{\n"
+   "   return (c>=48 && c<=57) || (c>=65 && c<=90) || (c>=97 && c<=122) || c==95;\n"
+   "}\n\n"
+   "inline bool hl_hyphenated_name_char(unsigned char c)\n"
+   "{\n"
+   "   return hl_name_char(c) || c==45;\n"
+   "}\n\n";
+
+int main(int argc, char **argv)
+{
+   if (argc<4 || strcmp(argv[1], "-o")!=0)
+   {
+      printf("Usage: hl2cpp -o <output.cpp> <type> [<type> ...]\n");
+      return 1;
+   }
+
+   const char *outname = argv[2];
+   char **types = argv + 3;
+   int count = argc - 3;
+
+   const HLIndex **indexes = new const HLIndex*[count];
+   for (int i=0; i<count; ++i)
+   {
+      indexes[i] = HLIndex::get_index(types[i]);
+      if (!indexes[i])
+      {
+         fprintf(stderr, "hl2cpp: unable to load %s.hl.\n", types[i]);
+         delete [] indexes;
+         return 1;
+      }
+      if (indexes[i]->base())
+      {
+         fprintf(stderr, "hl2cpp: %s.hl uses !include, which cannot be compiled in.\n", types[i]);
+         delete [] indexes;
+         return 1;
+      }
+      if (indexes[i]->unicode_letters())
+      {
+         fprintf(stderr, "hl2cpp: %s.hl uses !ul, which cannot be compiled in.\n", types[i]);
+         delete [] indexes;
+         return 1;
+      }
+   }
+
+   FILE *out = fopen(outname, "w");
+   if (!out)
+   {
+      fprintf(stderr, "hl2cpp: unable to open \"%s\".\n", outname);
+      delete [] indexes;
+      return 1;
+   }
+
+   fprintf(out, "// Generated by hl2cpp.  Do not edit.\n\n");
+   fprintf(out, "#include \"hlbuiltin.hpp\"\n\n");
+   fprintf(out, "namespace {\n\n");
+   fputs(matcher_helpers, out);
+
+   char prefix[32];
+   for (int i=0; i<count; ++i)
+   {
+      snprintf(prefix, sizeof(prefix), "hl%d", i);
+      fprintf(out, "// %s.hl\n\n", types[i]);
+      write_tables(out, prefix, indexes[i]);
+      write_matchers(out, prefix, indexes[i]);
+   }
+
+   fprintf(out, "}\n\n");
+   fprintf(out, "extern const HLBuiltin hl_builtins[] =\n{\n");
+   for (int i=0; i<count; ++i)
+   {
+      snprintf(prefix, sizeof(prefix), "hl%d", i);
+      write_builtin(out, prefix, types[i], indexes[i]);
+      fputs(i+1<count ? ",\n" : "\n", out);
+   }
+   fprintf(out, "};\n\n");
+   fprintf(out, "extern const unsigned hl_builtin_count = %d;\n", count);
+
+   delete [] indexes;
+
+   if (fclose(out))
+   {
+      fprintf(stderr, "hl2cpp: error writing \"%s\".\n", outname);
+      return 1;
+   }
+
+   return 0;
+}
@@ -0,0 +1,76 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -fsyntax-only hlbuiltin.hpp"  -*-
+
+/** @file */
+
+#ifndef HLBUILTIN_HPP
+#define HLBUILTIN_HPP
+
+/**
+ * @brief A rule line of a compiled-in highlighting file.
+ *
+ * Strings in the compiled-in tables are in highlighting file form, that is,
+ * with backslashes escaped, so that they are resolved like the strings
+ * read from a highlighting file.
+ */
+struct HLBuiltinCategory
+{
+   const char *tag;        /**< Tag of the rule line, eg `keyword`. */
+   const char *value;      /**< Rule of the rule line, eg `span.keyword`. */
+};
+
+/** @brief A tag line of a compiled-in highlighting file. */
+struct HLBuiltinTag
+{
+   const char *tag;        /**< The tag, lower case if the file is case-insensitive. */
+   const char *value;      /**< Value of the tag line, usually nullptr. */
+   unsigned   category;    /**< Index of the rule line of the tag. */
+};
+
+/**
+ * @brief A generated matcher function for a compiled-in highlighting file.
+ *
+ * A matcher returns the index, in the word or comment table, of the tag
+ * that HLIndex::seek_word() or HLIndex::seek_comment() would find at the
+ * start of @p str, or -1 if no tag matches.
+ */
+typedef int (*HLBuiltinMatcher)(const char *str);
+
+/**
+ * @brief The tables of a compiled-in highlighting file.
+ *
+ * The tables are generated by `hl2cpp` from a highlighting file, holding
+ * the contents of the HLIndex that would be built by reading the file.  The
+ * word and comment tables are sorted in HLIndex order.
+ *
+ * `hl2cpp` also generates a matcher function for each table, which replaces
+ * the linear table walk with a tree of `switch` statements on the bytes of
+ * the tags.
+ */
+struct HLBuiltin
+{
+   const char *name;                      /**< Info string of the language. */
+   bool       hyphenated_tags;            /**< The `!ht` flag. */
+   bool       case_insensitive;           /**< The `!ci` flag. */
+
+   const HLBuiltinCategory *categories;   /**< Rule lines, in file order. */
+   unsigned                category_count;
+
+   const HLBuiltinTag      *words;        /**< Word tags, sorted. */
+   unsigned                word_count;
+
+   const HLBuiltinTag      *comments;     /**< Comment tags, sorted. */
+   unsigned                comment_count;
+
+   const HLBuiltinTag      *patterns;     /**< Pattern lines, in file order. */
+   unsigned                pattern_count;
+
+   HLBuiltinMatcher        match_word;    /**< Matcher for @p words, may be nullptr. */
+   HLBuiltinMatcher        match_comment; /**< Matcher for @p comments, may be nullptr. */
+};
+
+/** Compiled-in highlighting files, defined in the generated hlbuiltin.cpp. */
+extern const HLBuiltin hl_builtins[];
+/** Number of elements in hl_builtins. */
+extern const unsigned  hl_builtin_count;
+
+#endif
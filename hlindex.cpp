@@ -1,11 +1,18 @@
-// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -o hlindex hlindex.cpp"  -*-
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -pthread -o hlindex hlindex.cpp -lz"  -*-
 
 /** @file */
 
 #include "hlindex.hpp"
+#include "hlpath.hpp"
+#include "hlbuiltin.hpp"
+#include "utf8.hpp"
 #include <ctype.h>   // for isspace()
 #include <string.h>  // for strlen()
 #include <alloca.h>  // for alloca()
+#include <stdarg.h>  // for va_list
+#include <fcntl.h>   // for open()
+#include <unistd.h>  // for read()
+#include <sys/stat.h>
 
 #include <stdlib.h>  // for qsort()
 
@@ -13,29 +20,69 @@
 /*
  * Beginning of HLParser class implementations.
  */
-char HLParser::s_read_buff[1024];
-const size_t HLParser::s_len_buff = sizeof(HLParser::s_read_buff);
 
-HLParser::HLParser(FILE *f, HLNode *root)
-   : m_file(f), m_cur_level(0), m_cur_tag(nullptr), m_cur_value(nullptr),
-     m_hyphenated_tags(false), m_case_insensitive(false)
+/**
+ * @brief Parse the highlighting file in @p buff into the children of @p root.
+ *
+ * The parser keeps its state in the instance, so threads may each
+ * parse a different file at the same time.
+ *
+ * @param buff Text of the highlighting file, which is modified in place,
+ *             with room for a terminating '\0' at buff[len].
+ * @param len  Length of the text.
+ * @param root Node to which the rule lines are added as children.
+ * @param path File name for error messages.
+ */
+HLParser::HLParser(char *buff, size_t len, HLNode *root, const char *path)
+   : m_path(path), m_line_number(0), m_error_count(0), m_stack(),
+     m_pattern_buff(nullptr), m_pattern_size(0), m_include(nullptr),
+     m_hyphenated_tags(false), m_case_insensitive(false), m_unicode_letters(false)
+{
+   Frame frame = { root, -1 };
+   m_stack.append(frame);
+
+   char *p = buff;
+   char *end = buff + len;
+   while (p < end)
+   {
+      char *eol = static_cast<char*>(memchr(p, '\n', end-p));
+      if (!eol)
+         eol = end;
+
+      *eol = '\0';
+      ++m_line_number;
+      parse_line(p, eol);
+
+      p = eol + 1;
+   }
+}
+
+HLParser::~HLParser()
 {
-   do_node(root, -1);
+   delete [] m_stack.items;
+   delete [] m_pattern_buff;
+   delete [] m_include;
 }
 
-void HLParser::print_line(int level, const char *tag, const char *value)
+/** @brief Print an error message about the current line, prefixed with its location. */
+void HLParser::report(const char *format, ...)
 {
-   printf("at level %02d: \"%20s\"", level, tag);
-   if (value)
-      printf(" = \"%s\"\n", value);
-   else
-      fputc('\n', stdout);
+   ++m_error_count;
+
+   fprintf(stderr, "%s:%d: ", m_path, m_line_number);
+
+   va_list args;
+   va_start(args, format);
+   vfprintf(stderr, format, args);
+   va_end(args);
+
+   fputc('\n', stderr);
 }
 
 /**
- * @brief Called by process_line when encountering possible flag direction.
+ * @brief Called by parse_line when encountering possible flag direction.
  *
- * @param str Pointer to s_read_buff to an unescaped '!' that may be a flag.
+ * @param str Pointer to an unescaped '!' at the start of a line that may be a flag.
  * @return TRUE if flag matched, FALSE otherwise.
  *
  * This function compares the string for !ht, !hyphen (first part of
@@ -62,182 +109,244 @@ bool HLParser::set_flag_from_line(const char *str)
          flag_set = m_hyphenated_tags = true;
       else if (p1=='c' && p2=='i')
          flag_set = m_case_insensitive = true;
+      else if (p1=='u' && p2=='l')
+         flag_set = m_unicode_letters = true;
    }
    else if (strncmp("hyphen", str, 6)==0)
       flag_set = m_hyphenated_tags = true;
    else if (strncmp("case-i", str, 6)==0)
       flag_set = m_case_insensitive = true;
+   else if (strncmp("unicode", str, 7)==0)
+      flag_set = m_unicode_letters = true;
 
    return flag_set;
 }
 
 /**
- * @brief Parse static char buffer s_read_buff for node information.
+ * @brief Called by parse_line to take an `!include <type>` line, if it is one.
  *
- * This function sets the member variables m_cur_level, m_cur_tag, and
- * m_cur_value according to the values found in s_read_buff.
+ * The included type is named like an info string, with an optional `.hl`
+ * extension, and is found along the search path like any other.  A file
+ * may include only one other file.
+ *
+ * @param str Pointer to an unescaped '!' at the start of the line.
+ * @return TRUE if the line is an include line, FALSE otherwise.
  */
-void HLParser::process_line(void)
+bool HLParser::set_include_from_line(const char *str)
 {
-   // pointers for iterating over the buffer:
-   char *p = nullptr;
-   
-   // convert line-ending newline to '\0' rather than
-   // check for it with each iteration:
-   p = &s_read_buff[strlen(s_read_buff)-1];
-   if (*p=='\n')
-      *p = '\0';
-
-   // Set pointer to start processing
-   p = s_read_buff;
-   
-   // values of the current line:
-   m_cur_level = 0;
-   m_cur_tag = m_cur_value = nullptr;
-
-   // flags to indicate progress:
-   bool stop_comment = false;
-   bool found_colon = false;
+   if (strncmp(str, "!include", 8)!=0 || !isspace(str[8]))
+      return false;
 
-   // loop to count spaces as indication of level
+   const char *p = str+8;
    while (*p && isspace(*p))
-   {
-      ++m_cur_level;
       ++p;
-   }
 
-   if (*p)
-      m_cur_tag = p;
+   const char *end = p;
+   while (*end && !isspace(*end) && *end!='#')
+      ++end;
+
+   size_t len = end - p;
+   if (len>3 && strncmp(end-3, ".hl", 3)==0)
+      len -= 3;
 
-   // Continue loop after level found to get line contents:
-   while (*p)
+   if (m_include)
+      report("Ignoring \"!include %.*s\", a highlighting file may include only one other.",
+             static_cast<int>(len), p);
+   else if (len)
    {
-      // If we haven't found the colon yet, allow continued incrementing
-      // until the colon is found.
-      if (!found_colon)
-      {
-         // A backslash indicates that we need to keep the backslash and
-         // the following character, ignoring any action that would otherwise
-         // be taken on its behalf, ie a whitespace, colon, or '#' comment
-         // marker.  "continue" to check the next character.
-         if (*p=='\\')
-         {
-            p += 2;
-            continue;
-         }
+      m_include = new char[len+1];
+      memcpy(m_include, p, len);
+      m_include[len] = '\0';
+   }
 
-         // To be a flag directive, the '!' must be at column 0
-         if (*p=='!' && p==s_read_buff)
-         {
-            // Try to set a flag, skip the rest of the line if flag is set:
-            if (set_flag_from_line(p))
-               return;
-         }
+   return true;
+}
 
-         // The tag is terminated if the character is a whitespace, colon, or #.
-         // Change to '\0' to terminate the tag, the fall-out of conditional to
-         // the ++p to continue looking for colon (if not yet found), the beginning
-         // of a value (if the colon has been found), or the end of the string.
-         
-         if (*p==':')
-         {
-            found_colon = true;
+/**
+ * @brief Called by parse_line to take a pattern line, if it is one.
+ *
+ * A pattern line is a tag line whose tag is `@re`, followed by white space
+ * and a regular expression.  The rest of the line, except for trailing white
+ * space, is the pattern, so a pattern line cannot have a comment.  Since
+ * '#' and '\' are common in patterns, they are not treated specially.
+ *
+ * The pattern is copied to m_pattern_buff with its backslashes doubled, so
+ * that the escape resolution of HLNode::save_str() restores the pattern
+ * as written.
+ *
+ * @param level Indentation of the line.
+ * @param str   Pointer to the tag of the line.
+ * @param end   End of the line.
+ * @return TRUE if the line is a pattern line, FALSE otherwise.
+ */
+bool HLParser::add_pattern_from_line(int level, char *str, char *end)
+{
+   if (strncmp(str, "@re", 3)!=0 || (str[3] && !isspace(str[3])))
+      return false;
 
-            // Terminate m_tag string
-            *p++ = '\0';
-            
-            // Skip to possible beginning of m_value, if any:
-            while (*p && isspace(*p))
-               ++p;
+   char *p = str+3;
+   while (p<end && isspace(*p))
+      ++p;
 
-            // Since we're already where we need to be,
-            // preempt loop-ending ++p:
-            continue;
-         }
-         else if (isspace(*p))
-            *p = '\0';
-         else if (*p=='#')
-         {
-            *p = '\0';
-            stop_comment = true;
-            break; 
-         }
-      }
-      // Save the first character (as left behind by !found_colon && *p==':' above):
-      else if (!m_cur_value)
-         m_cur_value = p;
+   while (end>p && isspace(*(end-1)))
+      --end;
 
-      // increment the character
-      ++p;
+   if (p==end)
+   {
+      report("Ignoring a pattern line without a pattern.");
+      return true;
    }
-   
-   // Deal with comment-initiated early termination:
-   if (stop_comment)
+
+   size_t size = 2*(end-p) + 1;
+   if (size > m_pattern_size)
    {
-      // walk back any unescaped vspaces, stopping for '\0' if already found
-      while (*p && isspace(*--p)  && *(p-1)!='\\')
-         ;
+      delete [] m_pattern_buff;
+      m_pattern_buff = new char[size];
+      m_pattern_size = size;
+   }
 
-      // If not backed against the start of the buffer, simply
-      // terminate whatever string we're working on:
-      if (*p && p > s_read_buff)
-         *(++p) = '\0';
+   char *q = m_pattern_buff;
+   while (p<end)
+   {
+      if (*p=='\\')
+         *q++ = '\\';
+      *q++ = *p++;
    }
+   *q = '\0';
+
+   add_node(level, "@re", m_pattern_buff);
+   return true;
+}
+
+/** @brief Advance @p p past a character, and the character following it if @p p is a backslash. */
+inline char *skip_escaped(char *p, const char *end)
+{
+   return (*p=='\\' && p+1<end) ? p+2 : p+1;
 }
 
-bool HLParser::read_line(void)
+/**
+ * @brief Parse a line of the highlighting file, adding its node, if any, to the tree.
+ *
+ * The indentation of a line is its number of leading white space characters.
+ * Its tag runs to the first unescaped white space, colon, or '#', and its
+ * value, if any, from the colon to a '#' comment or the end of the line.
+ * Unescaped white space around the value is removed.  The tag and value
+ * are terminated in place, their escapes left for HLNode::save_str().
+ *
+ * @param line Start of the line.
+ * @param end  End of the line, where a '\0' has replaced the newline.
+ */
+void HLParser::parse_line(char *line, char *end)
 {
-   char *p = fgets(s_read_buff, s_len_buff, m_file);
-   if (p)
+   // Trim trailing white space, including the '\r' of a CRLF file, unless escaped:
+   while (end>line && isspace(*(end-1)) && !(end-1>line && *(end-2)=='\\'))
+      *--end = '\0';
+
+   char *p = line;
+   while (p<end && isspace(*p))
+      ++p;
+
+   // Skip blank lines and comment lines:
+   if (p==end || *p=='#')
+      return;
+
+   int level = p - line;
+
+   // To be a flag directive, the '!' must be at column 0:
+   if (level==0 && *p=='!' && (set_flag_from_line(p) || set_include_from_line(p)))
+      return;
+
+   if (add_pattern_from_line(level, p, end))
+      return;
+
+   // A backslash must escape a following character:
+   char *q = end;
+   while (q>p && *(q-1)=='\\')
+      --q;
+   if ((end-q) % 2)
    {
-      process_line();
-      return true;
+      report("Ignoring a backslash at the end of the line.");
+      *--end = '\0';
    }
-   else
+
+   char *tag = p;
+   while (p<end && *p!=':' && *p!='#' && !isspace(*p))
+      p = skip_escaped(p, end);
+   char *tag_end = p;
+
+   // Skip to the colon, if any:
+   char *junk = p;
+   while (p<end && *p!=':' && *p!='#')
+      p = skip_escaped(p, end);
+
+   char *junk_end = p;
+   while (junk<junk_end && isspace(*junk))
+      ++junk;
+   while (junk_end>junk && isspace(*(junk_end-1)))
+      --junk_end;
+   if (junk<junk_end)
+      report("Ignoring \"%.*s\" between the tag and the colon.",
+             static_cast<int>(junk_end-junk), junk);
+
+   const char *value = nullptr;
+   if (p<end && *p==':')
    {
-      m_file = nullptr;
-      return false;
+      ++p;
+      while (p<end && isspace(*p))
+         ++p;
+
+      char *value_start = p;
+      while (p<end && *p!='#')
+         p = skip_escaped(p, end);
+
+      while (p>value_start && isspace(*(p-1)) && !(p-1>value_start && *(p-2)=='\\'))
+         --p;
+
+      *p = '\0';
+      if (p>value_start)
+         value = value_start;
    }
+
+   *tag_end = '\0';
+   if (tag_end==tag)
+      report("Ignoring a line without a tag.");
+   else
+      add_node(level, tag, value);
 }
 
-void HLParser::do_node(HLNode *host, int entry_level)
+/**
+ * @brief Add a node for a line of indentation @p level to the tree.
+ *
+ * A line indented more than the previous line is the first child of the
+ * previous line's node.  A line indented as much as an enclosing line is
+ * the next sibling of its node.  A line indented between the levels of
+ * two enclosing lines matches neither, and is taken as a sibling at the
+ * deeper level.
+ */
+void HLParser::add_node(int level, const char *tag, const char *value)
 {
-   // Get next saveable line:
-   while (read_line() && !cur_line_is_node())
-      ;
+   Frame *top = &m_stack.items[m_stack.count-1];
 
-   while (file_ready())
+   const Frame *popped = nullptr;
+   while (top->level > level)
    {
-      if (cur_line_is_node())
-      {
-         int diff = level() - entry_level;
-
-         
-         // If at level() is higher than @p level, the current line
-         // is a child of @p host.  Add a node as a child, and pass the
-         // child as a host to a recursive call to do_node().  do_node()
-         // will return when level() <= @p level, meaning the pending
-         // node is either a sibling or ancestor.
-         if (diff > 0)
-         {
-            do_node(host->direct_add_child(tag(), value()), level());
-
-            // Return to top of loop without a new read_line() in order
-            // to determine where to put the pending node:
-            continue;
-         }
-
-         // If lower level, return to process the pending ancestor node:
-         else if (diff < 0)
-            break;
-         
-         // If at same level, add node as a sibling, then
-         // fall through to read next line:
-         else //  if (diff==0)
-            host = host->direct_add_sibling(tag(), value());
-      }
+      popped = top;
+      --top;
+      --m_stack.count;
+   }
 
-      read_line();
+   if (popped && top->level < level)
+   {
+      report("Indentation of %d matches no enclosing line, taken as %d.", level, popped->level);
+      Frame frame = { popped->node->direct_add_sibling(tag, value), popped->level };
+      m_stack.append(frame);
+   }
+   else if (top->level == level)
+      top->node = top->node->direct_add_sibling(tag, value);
+   else
+   {
+      Frame frame = { top->node->direct_add_child(tag, value), level };
+      m_stack.append(frame);
    }
 }
 
@@ -245,8 +354,41 @@ void HLParser::do_node(HLNode *host, int entry_level)
  * Beginning of HLIndex class functions:
  */
 
-HLIndex HLIndex::s_base(nullptr);
-HLIndex::Word_Eligible_Char_Func HLIndex::s_word_eligible_char_func = HLIndex::hyphenated_name_allow;
+HLRegistry HLIndex::s_registry;
+HLList<HLIndex*> HLIndex::s_retired;
+std::mutex HLIndex::s_mutex;
+std::condition_variable HLIndex::s_loaded;
+const HLBuiltin *HLIndex::s_builtins = nullptr;
+unsigned HLIndex::s_builtin_count = 0;
+
+/**
+ * @brief Aliases known without being requested.
+ *
+ * Each pair is an alias followed by the info string of the highlighting
+ * file it shares.
+ */
+static const char *const default_aliases[][2] =
+{
+   { "sh",      "bash" },
+   { "shell",   "bash" },
+   { "zsh",     "bash" },
+   { "mysql",   "sql"  },
+   { "mariadb", "sql"  },
+   { "sqlite",  "sql"  }
+};
+
+/** @brief Add default_aliases to the registry on first use, with HLIndex::s_mutex held. */
+static void add_default_aliases(HLRegistry &registry)
+{
+   static bool added = false;
+   if (!added)
+   {
+      added = true;
+      for (const auto &pair : default_aliases)
+         if (!registry.seek_alias(pair[0]))
+            registry.add_alias(pair[0], pair[1]);
+   }
+}
 
 /**
  * @brief This is the public way to access HLIndex instances.
@@ -255,446 +397,1531 @@ HLIndex::Word_Eligible_Char_Func HLIndex::s_word_eligible_char_func = HLIndex::h
  * If an existing index is not found, it will try to open and parse a
  * highlighting file with the type name followed by `.hl`.
  *
+ * If @p type is an alias, the index of the aliased type is returned,
+ * loading it if necessary.  The alias and the aliased type share the
+ * index.
+ *
  * If the highlighting file has been found, this function will return the
  * HLIndex of the file.  Otherwise, nullptr will be returned.
  *
  * Internally, the first request for a highlighting file will always
- * create a HLIndex branch, but for unavailable extensions, it will
+ * create a HLIndex, but for unavailable extensions, it will
  * be empty.  This will prevent FencedFilter from repeated attempts to
  * find a missing file.  When HLIndex finds an empty index, it will
  * return nullptr to revert to default doxygen processing.
  *
+ * This function may be called from several threads at once.  An index
+ * already loaded is found without a lock.  Otherwise, the first thread
+ * to request a type loads it, and other threads requesting the same type
+ * wait for that index rather than loading their own.
+ *
  * @param type Typical extension of the file type
  * @return A pointer to an HLIndex if found, nullptr otherwise.
  */
 const HLIndex* HLIndex::get_index(const char *type)
 {
-   const HLIndex *rval = seek_index(type);
-   if (!rval)
+   HLIndex *rval = find_index(type, nullptr);
+   return rval->is_empty() ? nullptr : rval;
+}
+
+/**
+ * @brief Body of get_index(), returning the index of @p type, loading it
+ *        if necessary, even if empty.
+ *
+ * A thread loading a highlighting file that includes @p type gives the
+ * type it is loading as @p loading.  While it waits for, or itself loads,
+ * the index of @p type, its slot in the registry names @p type, so the
+ * loaders waiting on one another form a chain.  A thread about to wait
+ * for a type whose chain leads back to @p loading would wait forever, as
+ * when two threads claim `x` and `y`, and `x.hl` includes `y` while
+ * `y.hl` includes `x`.  It gives up instead, breaking the circle.
+ *
+ * @param type    Info string of the index.
+ * @param loading Type claimed by the calling thread, whose highlighting
+ *                file includes @p type, or nullptr.
+ * @return The index, or nullptr if @p type is being loaded by another
+ *         thread that waits, directly or not, for @p loading.
+ */
+HLIndex *HLIndex::find_index(const char *type, const char *loading)
+{
+   HLIndex *rval = s_registry.seek(type);
+   if (rval)
+      return rval;
+
+   std::unique_lock<std::mutex> lock(s_mutex);
+
+   const char *target = follow_aliases(type);
+   if (loading)
+      s_registry.set_waiting(loading, target);
+
+   while (!(rval=s_registry.seek(target)))
    {
-      // Make an HLNode and attempt to populate it
-      // with the contents of a highlight file:
-      HLNode *root = new HLNode(type);
-      FILE *f = find_and_open_file(type);
-      if (f)
+      // Claim the type, then parse without holding the lock, so
+      // other types may be loaded at the same time:
+      if (s_registry.claim(target))
       {
-         HLParser hlp(f, root);
-         // Regardless of highlight file success, add a new
-         // HLIndex to the chain with the new HLNode:
-         HLIndex *last = get_last();
-         rval = last->m_next = new HLIndex(root,
-                                           hlp.hyphenated_tags(),
-                                           hlp.case_insensitive());
+         const char *path = HLPath::find(target);
+         lock.unlock();
+         rval = load_index(target, path);
+         lock.lock();
+
+         s_registry.add(target, rval);
+         s_loaded.notify_all();
+         break;
       }
+
+      // Another thread is loading the type:
+      if (loading && s_registry.waits_for(target, loading))
+         break;
+
+      s_loaded.wait(lock);
    }
 
-   if (rval && !rval->is_empty())
-      return rval;
-   else
-      return nullptr;
+   if (loading)
+      s_registry.set_waiting(loading, nullptr);
+
+   if (rval && target!=type && !s_registry.seek(type))
+      s_registry.add(type, rval, false);
+
+   return rval;
 }
 
-bool HLIndex::simple_name_allow(int ch)
+/**
+ * @brief Make @p alias an alias for @p type.
+ *
+ * A fenced code block whose info string is @p alias will be highlighted
+ * with the HLIndex of @p type.  Aliases must be set before @p alias
+ * is first requested.
+ */
+void HLIndex::add_alias(const char *alias, const char *type)
 {
-   return (ch>=48 && ch<=57)    // allow numerals,
-      || (ch>=65 && ch<=90)     // allow upper-case letters,
-      || (ch>=97 && ch<=122)    // allow lower-case letters,
-      || ch==95;                // allow underscore
+   std::lock_guard<std::mutex> lock(s_mutex);
+   add_default_aliases(s_registry);
+   s_registry.add_alias(alias, type);
 }
 
-bool HLIndex::hyphenated_name_allow(int ch)
+/**
+ * @brief Returns the type of which @p type is an alias, or @p type if not an alias.
+ *
+ * A (short) chain of aliases is followed to the final type.
+ */
+const char *HLIndex::resolve_alias(const char *type)
 {
-   return (ch>=48 && ch<=57)    // allow numerals,
-      || (ch>=65 && ch<=90)     // allow upper-case letters,
-      || (ch>=97 && ch<=122)    // allow lower-case letters,
-      || ch==95                 // allow underscore
-      || ch==45;                // allow hyphen,
+   std::lock_guard<std::mutex> lock(s_mutex);
+   return follow_aliases(type);
+}
+
+/** @brief Body of resolve_alias(), with s_mutex held. */
+const char *HLIndex::follow_aliases(const char *type)
+{
+   add_default_aliases(s_registry);
+
+   const char *target = type;
+   const char *next;
+   for (int i=0; i<8 && (next=s_registry.seek_alias(target)); ++i)
+      target = next;
+
+   return target;
 }
 
 /**
- * @brief Compares the the comparison results to see if matched
+ * @brief Register the compiled-in highlighting files.
  *
- * @param sub_haystack Pointer to last comparison made in haystack.
- * @param sub_needle Pointer to last comparison made in needle.
- * @param is_tag Compares to end of word in sub_haystack,
- *        otherwise just last character.
- * @return Whether good match made or not.
+ * The compiled-in files are used for info strings that have no highlighting
+ * file in the search path, so a highlighting file on disk overrides a
+ * compiled-in file with the same name.
+ *
+ * @param builtins Array of compiled-in highlighting files, usually
+ *                 hl_builtins from the generated hlbuiltin.cpp.
+ * @param count    Number of elements in @p builtins.
  */
-bool full_str_match_made(const char *sub_haystack,
-                         const char *sub_needle,
-                         bool is_tag)
+void HLIndex::set_builtins(const HLBuiltin *builtins, unsigned count)
 {
-   // If completely matched the needle
-   if (*sub_needle=='\0')
-   {
-      // If haystack also fully consumed,
-      // it matches regardless of is_word value:
-      if (*sub_haystack=='\0')
-         return true;
-
-      if (!is_tag || !HLIndex::allowed_in_name(*sub_haystack))
-         return true;
-   }
-   return false;
+   s_builtins = builtins;
+   s_builtin_count = count;
 }
 
 /**
- * @brief Returns the number of matching characters between @p haystack and @p needle.
+ * @brief Create an HLIndex for @p type, loading its highlighting file if found.
  *
- * This function compares the beginning of @p haystack with the characters in @p needle
- * up to the '\0' terminator of @p needle.
+ * If no highlighting file is found, a compiled-in highlighting file
+ * for @p type is used, if available.
  *
- * @param haystack String where a string is searched.
- * @param needle NULL-terminated string to compare against the start of @p haystack.
- * @param is_tag Comparing strings as a tag, which looks for a terminating non-word char.
- * @return Number of matching characters.
+ * @param type The type string that opens a fenced code area in doxygen.
+ * @param path Path of the highlighting file for @p type, as found by
+ *             HLPath::find(), or nullptr if none was found.
+ * @return A new HLIndex, which will be empty if no highlighting file was found.
  */
-int HLIndex::str_match_sensitive(const char *haystack,
-                                 const char *needle,
-                                 bool is_tag)
+HLIndex *HLIndex::load_index(const char *type, const char *path)
 {
-   // This function shouldn't be called with missing or empty strings.
-   // If this function causes an exception, turn on the following
-   // assertions to determine where the mistake was made:
-   //
-   // assert(haystack && *haystack);
-   // assert(needle && *needle);
-   
-   // Skip everything if the first two characters don't match:
-   if (*haystack==*needle)
+   HLIndex *index = path ? parse_file(type, path, true) : nullptr;
+   if (index)
+      return index;
+
+   for (unsigned i=0; i<s_builtin_count; ++i)
+      if (strcmp(s_builtins[i].name, type)==0)
+         return new HLIndex(s_builtins[i]);
+
+   return new HLIndex(new HLNode(type));
+}
+
+/** @brief Most `!include` files being parsed by one thread at once, see parse_file(). */
+static const int max_include_depth = 8;
+
+/** @brief Types being parsed by this thread, outermost first, to catch circular includes. */
+static thread_local const char *s_parsing[max_include_depth];
+static thread_local int s_parsing_count = 0;
+
+/**
+ * @brief Read the file at @p path into a new buffer, with room for a terminator.
+ *
+ * @param path Path of the file.
+ * @param len  Set to the length of the file.
+ * @return The contents of the file, to be deleted by the caller, or
+ *         nullptr if the file could not be opened.
+ */
+static char *read_file(const char *path, size_t *len)
+{
+   int fd = open(path, O_RDONLY | O_CLOEXEC);
+   if (fd<0)
+      return nullptr;
+
+   struct stat st;
+   size_t size = (fstat(fd, &st)==0 && st.st_size>0) ? st.st_size : 4096;
+   char *buff = new char[size+1];
+   size_t used = 0;
+
+   ssize_t bytes;
+   while ((bytes=read(fd, buff+used, size-used)) > 0)
    {
-      const char *save_needle = needle;
-      while (*needle && *needle==*haystack)
+      used += bytes;
+
+      // Grow the buffer if the file is larger than reported:
+      if (used==size)
       {
-         ++needle;
-         ++haystack;
+         char *bigger = new char[2*size+1];
+         memcpy(bigger, buff, used);
+         delete [] buff;
+         buff = bigger;
+         size *= 2;
       }
-
-      if (full_str_match_made(haystack, needle, is_tag))
-         return needle - save_needle;
-
-      return 0;
    }
 
-   return 0;
-}
+   close(fd);
 
-inline char toLowerCase(char c) { return (c>=65 && c<=90) ? c+32 : c; }
+   *len = used;
+   return buff;
+}
 
 /**
- * @brief Returns the number of matching characters between @p haystack and @p needle.
+ * @brief Create an HLIndex for @p type from the highlighting file at @p path.
  *
- * This function compares the beginning of @p haystack with the characters in @p needle
- * up to the '\0' terminator of @p needle.
+ * The index of an `!include` file is requested with find_index(), so it is
+ * loaded once and shared by the files that include it, and by fenced
+ * blocks of its own type.
  *
- * The comparison is made while converting characters in @p haystack to lower case.
- * In our usage, if case-insensitive comparisons are called for, the @p needle,
- * which is a tag from a highlighting file, will have already been converted to
- * lower case when the hl file was read.
+ * An include is circular if it names a type being parsed by this thread,
+ * or one whose loader in another thread waits for @p type.  Only a
+ * @p claimed type, which another thread may be waiting for, can be part
+ * of a circle through other threads.
  *
- * @param haystack String where a string is searched.
- * @param needle NULL-terminated string to compare against the start of @p haystack.
- * @param is_tag Comparing strings as a tag, which looks for a terminating non-word char.
- * @return Number of matching characters.
+ * @param claimed TRUE if the calling thread claimed @p type in the registry.
+ * @return A new HLIndex, or nullptr if @p path could not be opened.
  */
-int HLIndex::str_match_insensitive(const char *haystack,
-                                   const char *needle,
-                                   bool is_tag)
+HLIndex *HLIndex::parse_file(const char *type, const char *path, bool claimed)
 {
-   // This function shouldn't be called with missing or empty strings.
-   // If this function causes an exception, turn on the following
-   // assertions to determine where the mistake was made:
-   //
-   // assert(haystack && *haystack);
-   // assert(needle && *needle);
-   
-   // Skip everything if the first two characters don't match:
-   if (toLowerCase(*haystack)==*needle)
+   size_t len;
+   char *buff = read_file(path, &len);
+   if (!buff)
+      return nullptr;
+
+   // Make an HLNode and populate it with
+   // the contents of the highlight file:
+   HLNode *root = new HLNode(type);
+   HLParser hlp(buff, len, root, path);
+   delete [] buff;
+
+   const HLIndex *base = nullptr;
+   if (hlp.include())
    {
-      const char *save_needle = needle;
-      
-      while (*needle && *needle==toLowerCase(*haystack))
+      const char *include = resolve_alias(hlp.include());
+
+      bool circular = strcmp(include, type)==0 || s_parsing_count==max_include_depth;
+      for (int i=0; i<s_parsing_count; ++i)
+         if (strcmp(s_parsing[i], include)==0)
+            circular = true;
+
+      if (!circular)
       {
-         ++needle;
-         ++haystack;
+         s_parsing[s_parsing_count++] = type;
+         base = find_index(include, claimed ? type : nullptr);
+         --s_parsing_count;
+
+         if (!base)
+            circular = true;
+         else if (base->is_empty())
+         {
+            fprintf(stderr, "Unable to find %s.hl, included by %s.hl.\n", include, type);
+            base = nullptr;
+         }
       }
 
-      if (full_str_match_made(haystack, needle, is_tag))
-         return needle - save_needle;
+      if (circular)
+         fprintf(stderr, "Ignoring circular \"!include %s\" in %s.hl.\n", include, type);
    }
 
-   return 0;
+   return new HLIndex(root, hlp.hyphenated_tags(), hlp.case_insensitive(),
+                      hlp.unicode_letters(), base);
 }
 
-
 /**
- * @brief Returns, if found, the node whose tag matches @p tag.
+ * @brief Returns the path of the highlighting file for @p type, or nullptr
+ *        if none, as HLPath::find().
+ *
+ * HLPath::find() notes missing types, so it is called with s_mutex held,
+ * as by get_index() in the threads loading indexes.
+ */
+const char *HLIndex::find_file(const char *type)
+{
+   std::lock_guard<std::mutex> lock(s_mutex);
+   return HLPath::find(type);
+}
+
+/**
+ * @brief Returns the number of directories in the search path, as
+ *        HLPath::dir_count(), with s_mutex held.
+ *
+ * The search path is prepared by the first call to HLPath, after which
+ * HLPath::dir() may be called without the lock.
+ */
+int HLIndex::search_dir_count(void)
+{
+   std::lock_guard<std::mutex> lock(s_mutex);
+   return HLPath::dir_count();
+}
+
+/**
+ * @brief Create an HLIndex for @p type from the highlighting file at @p path.
+ *
+ * Unlike get_index(), the index is not registered, so this may be called
+ * from any thread while other threads scan documents.  The new index is
+ * put in use with publish().
+ *
+ * @return A new HLIndex, or nullptr if @p path could not be opened.
+ */
+HLIndex *HLIndex::build(const char *type, const char *path)
+{
+   return parse_file(type, path, false);
+}
+
+/**
+ * @brief Replace the registered index of @p type, and of its aliases, with @p index.
+ *
+ * A scan already holding the replaced index continues to use it, so the
+ * replaced index is only retired, to be deleted by reclaim().  Lookups
+ * that follow see @p index.  An index for a @p type not yet requested is
+ * simply registered.
+ *
+ * @return The replaced index, valid until reclaim(), for find_dependents(),
+ *         or nullptr if none.
+ */
+const HLIndex *HLIndex::publish(const char *type, HLIndex *index)
+{
+   std::lock_guard<std::mutex> lock(s_mutex);
+   HLIndex *old = s_registry.replace(type, index);
+   if (old)
+      s_retired.append(old);
+   return old;
+}
+
+/**
+ * @brief Add to @p types the registered types whose highlighting files
+ *        `!include` the type of @p base, and so use @p base.
+ *
+ * After @p base is replaced by publish(), these types keep using it until
+ * they are built and published again themselves.  The names are the
+ * registry's own, and stay valid.
+ */
+void HLIndex::find_dependents(const HLIndex *base, HLList<const char*> &types)
+{
+   std::lock_guard<std::mutex> lock(s_mutex);
+   s_registry.find_derived(base, types);
+}
+
+/**
+ * @brief Delete the indexes replaced by publish().
+ *
+ * Call only when no scan that began before the publish() calls is still
+ * in progress, such as between documents.
+ */
+void HLIndex::reclaim(void)
+{
+   std::lock_guard<std::mutex> lock(s_mutex);
+   delete_unused(s_retired);
+}
+
+/**
+ * @brief Delete the elements of @p indexes that are no other index's base,
+ *        removing them from @p indexes.
+ *
+ * Deleting an index may leave its base unused, so the list is scanned
+ * again until nothing more is deleted.  An index still included by a
+ * registered index is kept for a later call.
+ */
+void HLIndex::delete_unused(HLList<HLIndex*> &indexes)
+{
+   bool deleted = true;
+   while (deleted)
+   {
+      deleted = false;
+      int kept = 0;
+      for (int i=0; i<indexes.count; ++i)
+      {
+         HLIndex *index = indexes.items[i];
+         if (index->m_derived.load())
+            indexes.items[kept++] = index;
+         else
+         {
+            delete index;
+            deleted = true;
+         }
+      }
+      indexes.count = kept;
+   }
+}
+
+bool HLIndex::simple_name_allow(int ch)
+{
+   return (ch>=48 && ch<=57)    // allow numerals,
+      || (ch>=65 && ch<=90)     // allow upper-case letters,
+      || (ch>=97 && ch<=122)    // allow lower-case letters,
+      || ch==95;                // allow underscore
+}
+
+bool HLIndex::hyphenated_name_allow(int ch)
+{
+   return (ch>=48 && ch<=57)    // allow numerals,
+      || (ch>=65 && ch<=90)     // allow upper-case letters,
+      || (ch>=97 && ch<=122)    // allow lower-case letters,
+      || ch==95                 // allow underscore
+      || ch==45;                // allow hyphen,
+}
+
+/**
+ * @brief simple_name_allow() that also allows the bytes of non-ASCII
+ *        characters, for name_char_length() to decode.
+ */
+bool HLIndex::unicode_name_allow(int ch)
+{
+   return simple_name_allow(ch) || (ch & ~0x7f);
+}
+
+/** @brief hyphenated_name_allow() that also allows the bytes of non-ASCII characters. */
+bool HLIndex::unicode_hyphenated_name_allow(int ch)
+{
+   return hyphenated_name_allow(ch) || (ch & ~0x7f);
+}
+
+/**
+ * @brief Blocks of non-ASCII punctuation, symbols and spaces, sorted, each
+ *        pair the first and last code point of a block.
+ *
+ * Unicode letter classes are approximated by the code points outside of
+ * these blocks, which are taken as letters.  The approximation includes
+ * the digits and combining marks of other scripts, both of which are
+ * allowed in names by the languages that allow non-ASCII letters.
+ */
+static const long non_letter_blocks[][2] =
+{
+   { 0x0080, 0x00A9 }, { 0x00AB, 0x00B4 }, { 0x00B6, 0x00B9 }, { 0x00BB, 0x00BF },
+   { 0x00D7, 0x00D7 }, { 0x00F7, 0x00F7 },
+   { 0x037E, 0x037E }, { 0x0387, 0x0387 },              // Greek
+   { 0x055A, 0x055F }, { 0x0589, 0x058A },              // Armenian
+   { 0x05BE, 0x05BE }, { 0x05C0, 0x05C0 }, { 0x05C3, 0x05C3 },
+   { 0x05C6, 0x05C6 }, { 0x05F3, 0x05F4 },              // Hebrew
+   { 0x0600, 0x060F }, { 0x061B, 0x061F }, { 0x066A, 0x066D },
+   { 0x06D4, 0x06D4 },                                  // Arabic
+   { 0x0964, 0x0965 }, { 0x0970, 0x0970 },              // Devanagari
+   { 0x0E3F, 0x0E3F }, { 0x0E4F, 0x0E4F }, { 0x0E5A, 0x0E5B },  // Thai
+   { 0x1680, 0x1680 }, { 0x180E, 0x180E },
+   { 0x2000, 0x206F },                                  // General Punctuation
+   { 0x20A0, 0x20CF },                                  // Currency Symbols
+   { 0x2190, 0x2BFF },                                  // Arrows to Miscellaneous Symbols
+   { 0x2E00, 0x2E7F },                                  // Supplemental Punctuation
+   { 0x3000, 0x3004 }, { 0x3008, 0x3020 }, { 0x3030, 0x3030 },
+   { 0x303D, 0x303F },                                  // CJK Symbols and Punctuation
+   { 0xD800, 0xDFFF },                                  // Surrogates
+   { 0xFD3E, 0xFD3F },
+   { 0xFE10, 0xFE1F }, { 0xFE30, 0xFE6F },              // Vertical, Small Forms
+   { 0xFEFF, 0xFEFF },                                  // Byte Order Mark
+   { 0xFF01, 0xFF0F }, { 0xFF1A, 0xFF20 }, { 0xFF3B, 0xFF3E },
+   { 0xFF40, 0xFF40 }, { 0xFF5B, 0xFF65 },              // Fullwidth punctuation
+   { 0xFFF0, 0xFFFF },                                  // Specials
+   { 0x1F000, 0x1FAFF }                                 // Pictographs and emoji
+};
+
+static const int non_letter_block_count = sizeof(non_letter_blocks) / sizeof(non_letter_blocks[0]);
+
+/**
+ * @brief Returns the number of bytes of the UTF-8 letter at @p str, or 0
+ *        if @p str starts an invalid sequence or a non-letter.
+ *
+ * @param str A non-ASCII character in a '\0'-terminated string.
+ */
+int HLIndex::unicode_letter_length(const char *str)
+{
+   int length;
+   long cp = utf8_decode(str, &length);
+   if (cp<0)
+      return 0;
+
+   int low = 0;
+   int high = non_letter_block_count;
+   while (low < high)
+   {
+      int mid = (low+high) / 2;
+      if (cp > non_letter_blocks[mid][1])
+         low = mid + 1;
+      else
+         high = mid;
+   }
+
+   bool non_letter = low<non_letter_block_count && cp>=non_letter_blocks[low][0];
+   return non_letter ? 0 : length;
+}
+
+/**
+ * @brief Compares the the comparison results to see if matched
+ *
+ * @param sub_haystack Pointer to last comparison made in haystack.
+ * @param sub_needle Pointer to last comparison made in needle.
+ * @param is_tag Compares to end of word in sub_haystack,
+ *        otherwise just last character.
+ * @param name_allow Word character test for the end of a word.
+ * @return Whether good match made or not.
+ */
+bool full_str_match_made(const char *sub_haystack,
+                         const char *sub_needle,
+                         bool is_tag,
+                         HLIndex::Word_Eligible_Char_Func name_allow)
+{
+   // If completely matched the needle
+   if (*sub_needle=='\0')
+   {
+      // If haystack also fully consumed,
+      // it matches regardless of is_word value:
+      if (*sub_haystack=='\0')
+         return true;
+
+      if (!is_tag || !HLIndex::name_char_length(sub_haystack, name_allow))
+         return true;
+   }
+   return false;
+}
+
+/**
+ * @brief Returns the number of matching characters between @p haystack and @p needle.
+ *
+ * This function compares the beginning of @p haystack with the characters in @p needle
+ * up to the '\0' terminator of @p needle.
+ *
+ * @param haystack String where a string is searched.
+ * @param needle NULL-terminated string to compare against the start of @p haystack.
+ * @param is_tag Comparing strings as a tag, which looks for a terminating non-word char.
+ * @param name_allow Word character test for the end of a tag.
+ * @return Number of matching characters.
+ */
+int HLIndex::str_match_sensitive(const char *haystack,
+                                 const char *needle,
+                                 bool is_tag,
+                                 Word_Eligible_Char_Func name_allow)
+{
+   // This function shouldn't be called with missing or empty strings.
+   // If this function causes an exception, turn on the following
+   // assertions to determine where the mistake was made:
+   //
+   // assert(haystack && *haystack);
+   // assert(needle && *needle);
+   
+   // Skip everything if the first two characters don't match:
+   if (*haystack==*needle)
+   {
+      const char *save_needle = needle;
+      while (*needle && *needle==*haystack)
+      {
+         ++needle;
+         ++haystack;
+      }
+
+      if (full_str_match_made(haystack, needle, is_tag, name_allow))
+         return needle - save_needle;
+
+      return 0;
+   }
+
+   return 0;
+}
+
+inline char toLowerCase(char c) { return (c>=65 && c<=90) ? c+32 : c; }
+
+/**
+ * @brief Returns the number of matching characters between @p haystack and @p needle.
+ *
+ * This function compares the beginning of @p haystack with the characters in @p needle
+ * up to the '\0' terminator of @p needle.
+ *
+ * The comparison is made while converting characters in @p haystack to lower case.
+ * In our usage, if case-insensitive comparisons are called for, the @p needle,
+ * which is a tag from a highlighting file, will have already been converted to
+ * lower case when the hl file was read.
+ *
+ * @param haystack String where a string is searched.
+ * @param needle NULL-terminated string to compare against the start of @p haystack.
+ * @param is_tag Comparing strings as a tag, which looks for a terminating non-word char.
+ * @param name_allow Word character test for the end of a tag.
+ * @return Number of matching characters.
+ */
+int HLIndex::str_match_insensitive(const char *haystack,
+                                   const char *needle,
+                                   bool is_tag,
+                                   Word_Eligible_Char_Func name_allow)
+{
+   // This function shouldn't be called with missing or empty strings.
+   // If this function causes an exception, turn on the following
+   // assertions to determine where the mistake was made:
+   //
+   // assert(haystack && *haystack);
+   // assert(needle && *needle);
+   
+   // Skip everything if the first two characters don't match:
+   if (toLowerCase(*haystack)==*needle)
+   {
+      const char *save_needle = needle;
+      
+      while (*needle && *needle==toLowerCase(*haystack))
+      {
+         ++needle;
+         ++haystack;
+      }
+
+      if (full_str_match_made(haystack, needle, is_tag, name_allow))
+         return needle - save_needle;
+   }
+
+   return 0;
+}
+
+
+/**
+ * @brief Returns, if found, the node whose tag matches @p tag.
  *
  * @param tag NULL-terminated string of a word for which to search.
  * @return The matching HLNode* if found, NULL otherwise.
  *
- * @todo OPTIMIZE: since the tag list is sorted alphabetically, this function should,
- * at the very least, stop searching once the @p tag is greater alphabetically that
- * the currently selected HLNode*.  For long lists, it might make sense to search from
- * the middle and proceeding away from the middle and terminating the search
- * according to the direction of the search.
+ * @todo OPTIMIZE: since the tag list is sorted alphabetically, this function should,
+ * at the very least, stop searching once the @p tag is greater alphabetically that
+ * the currently selected HLNode*.  For long lists, it might make sense to search from
+ * the middle and proceeding away from the middle and terminating the search
+ * according to the direction of the search.
+ */
+const HLNode* HLIndex::seek(const char *tag) const
+{
+   HLNode **n = m_entries;
+   while (n<m_last_entry)
+   {
+      if ((*n)->is_equal(tag))
+         return const_cast<const HLNode*>(*n);
+      ++n;
+   }
+
+   return m_base ? m_base->seek(tag) : nullptr;
+}
+
+/**
+ * @brief Returns the first in sorted order of @p own, found in this index,
+ *        and @p inherited, found in m_base, either of which may be nullptr.
+ *
+ * The walk of one array holding the tags of both files would find the same
+ * tag.  The tag of the included file wins a tie, as it comes first.
+ */
+inline const HLNode *first_sorted(const HLNode *own, const HLNode *inherited)
+{
+   if (inherited && (!own || strcmp(inherited->tag(), own->tag())<=0))
+      return inherited;
+   return own;
+}
+
+/**
+ * @brief Returns, if found, the node whose word tag matches the beginning of @p str.
+ *
+ * The first matching tag in the sorted m_entries array, which is the
+ * shortest matching tag, is returned.  Compiled-in highlighting files
+ * supply a generated matcher that finds the same tag without walking
+ * the array.  Otherwise m_word_filter turns most words that are not
+ * tags away before the walk.
+ *
+ * The words of an included file are found with the word characters of
+ * the including index, @p name_allow, which was scanning the document.
+ *
+ * @param str String starting with a word-eligible character.
+ * @param name_allow Word character test of the scanning index.
+ * @return The matching HLNode* if found, NULL otherwise.
+ */
+const HLNode* HLIndex::seek_word(const char *str, Word_Eligible_Char_Func name_allow) const
+{
+   const HLNode *found = nullptr;
+
+   if (m_word_matcher)
+   {
+      int i = (*m_word_matcher)(str);
+      if (i>=0)
+         found = m_entries[i];
+   }
+   else if (m_word_filter && word_filter_rejects(str, name_allow))
+      found = nullptr;
+   else
+   {
+      HLNode **n = m_entries;
+      int len;
+
+      while (n < m_last_entry)
+      {
+         const char *c = (*n)->tag();
+
+         if ((len=str_match(str, c, true, name_allow)))
+         {
+            found = *n;
+            break;
+         }
+         else
+            ++n;
+      }
+   }
+
+   return m_base ? first_sorted(found, m_base->seek_word(str, name_allow)) : found;
+}
+
+/**
+ * @brief Returns, if found, the node whose comment tag matches the beginning of @p str.
+ *
+ * @param str String that may be the start of a comment.
+ * @param name_allow Word character test of the scanning index.
+ * @return The matching HLNode* if found, NULL otherwise.
+ */
+const HLNode *HLIndex::seek_comment(const char *str, Word_Eligible_Char_Func name_allow) const
+{
+   const HLNode *found = nullptr;
+
+   if (m_comment_matcher)
+   {
+      int i = (*m_comment_matcher)(str);
+      if (i>=0)
+         found = m_comments[i];
+   }
+   else
+   {
+      HLNode **n = m_comments;
+      int len;
+      while (n < m_last_comment)
+      {
+         const char *c = (*n)->tag();
+         if ((len=str_match(str, c, false, name_allow)))
+         {
+            found = *n;
+            break;
+         }
+         else
+            ++n;
+      }
+   }
+
+   return m_base ? first_sorted(found, m_base->seek_comment(str, name_allow)) : found;
+}
+
+/**
+ * @brief Returns, if found, the pattern line whose pattern matches the beginning of @p str.
+ *
+ * All patterns are matched at once by the combined DFA.  Of the patterns
+ * that match, the one matching the most text is returned, and of those,
+ * the one earliest in the highlighting file, the patterns of an included
+ * file coming first.
+ *
+ * @param str    String that may start with a match.
+ * @param length Set to the length of the match, if found.
+ * @param name_allow Word character test of the scanning index.
+ * @return The matching HLNode* if found, NULL otherwise.
+ */
+const HLNode *HLIndex::seek_pattern(const char *str, int *length,
+                                    Word_Eligible_Char_Func name_allow) const
+{
+   const HLNode *found = nullptr;
+   if (m_pattern_count)
+   {
+      int i = m_regex.match(str, length, name_allow);
+      if (i>=0)
+         found = m_patterns[i];
+   }
+
+   if (m_base)
+   {
+      int base_length;
+      const HLNode *inherited = m_base->seek_pattern(str, &base_length, name_allow);
+      if (inherited && (!found || base_length>=*length))
+      {
+         *length = base_length;
+         found = inherited;
+      }
+   }
+
+   return found;
+}
+
+void HLIndex::print(FILE *f) const
+{
+   fputc('\n', stdout);
+
+   if (m_base)
+      printf("Including %s.\n", m_base->m_root->tag());
+   
+   if (m_hyphenated_tags)
+      printf("Processing with hyphenated tags.\n");
+
+   if (m_case_insensitive)
+      printf("Processing case-insensitive tags.\n");
+
+   if (m_unicode_letters)
+      printf("Processing with Unicode letters in tags.\n");
+   
+   HLNode **n;
+   if (m_entries)
+   {
+      printf("\nListing tags:\n");
+      n = m_entries;
+      while (n<m_last_entry)
+      {
+         printf("\"%s\"\n", (*n)->tag());
+         ++n;
+      }
+   }
+   if (m_comments)
+   {
+      printf("\nListing comments:\n");
+      n = m_comments;
+      while (n<m_last_comment)
+      {
+         printf("\"%s\"\n", (*n)->tag());
+         ++n;
+      }
+   }
+   if (m_patterns)
+   {
+      printf("\nListing patterns:\n");
+      for (int i=0; i<m_pattern_count; ++i)
+         printf("\"%s\"\n", m_patterns[i]->value());
+   }
+}
+
+
+
+/**
+ * @brief Constructor of an HLIndex from a parsed highlighting file.
+ *
+ * An index with a @p base, the index of its `!include` file, shares the
+ * base's nodes and arrays rather than copying them, and inherits its flags.
+ */
+HLIndex::HLIndex(HLNode *root, bool hyphenated_tags, bool case_insensitive,
+                 bool unicode_letters, const HLIndex *base)
+   : m_root(root),
+     m_base(base), m_base_category_count(base ? base->category_count() : 0), m_derived(0),
+     m_entries(nullptr), m_last_entry(nullptr),
+     m_comments(nullptr), m_last_comment(nullptr),
+     m_categories(nullptr), m_category_count(0),
+     m_patterns(nullptr), m_pattern_count(0), m_regex(),
+     m_hyphenated_tags(hyphenated_tags || (base && base->m_hyphenated_tags)),
+     m_case_insensitive(case_insensitive || (base && base->m_case_insensitive)),
+     m_unicode_letters(unicode_letters || (base && base->m_unicode_letters)),
+     m_str_match_func(m_case_insensitive?str_match_insensitive:str_match_sensitive),
+     m_name_allow(get_name_char_checker(m_hyphenated_tags, m_unicode_letters)),
+     m_word_matcher(nullptr), m_comment_matcher(nullptr),
+     m_word_filter(nullptr), m_word_filter_mask(0)
+{
+   if (base)
+      ++base->m_derived;
+   
+   if (root)
+   {
+      index_categories();
+      source_scan();
+   }
+}
+
+/**
+ * @brief Constructor of an HLIndex from a compiled-in highlighting file.
+ *
+ * The HLNode tree is built from the tables without parsing, and the
+ * entries arrays are filled in the order of the (already sorted) tables.
+ */
+HLIndex::HLIndex(const HLBuiltin &builtin)
+   : m_root(new HLNode(builtin.name)),
+     m_base(nullptr), m_base_category_count(0), m_derived(0),
+     m_entries(nullptr), m_last_entry(nullptr),
+     m_comments(nullptr), m_last_comment(nullptr),
+     m_categories(nullptr), m_category_count(0),
+     m_patterns(nullptr), m_pattern_count(0), m_regex(),
+     m_hyphenated_tags(builtin.hyphenated_tags),
+     m_case_insensitive(builtin.case_insensitive),
+     m_unicode_letters(false),
+     m_str_match_func(builtin.case_insensitive?str_match_insensitive:str_match_sensitive),
+     m_name_allow(get_name_char_checker(m_hyphenated_tags, false)),
+     m_word_matcher(builtin.match_word), m_comment_matcher(builtin.match_comment),
+     m_word_filter(nullptr), m_word_filter_mask(0)
+{
+   unsigned count = builtin.category_count;
+   HLNode **categories = static_cast<HLNode**>(alloca(count*sizeof(HLNode*)));
+   HLNode **last_tags = static_cast<HLNode**>(alloca(count*sizeof(HLNode*)));
+
+   HLNode *category = nullptr;
+   for (unsigned i=0; i<count; ++i)
+   {
+      const HLBuiltinCategory &bc = builtin.categories[i];
+      if (category)
+         category = category->direct_add_sibling(bc.tag, bc.value);
+      else
+         category = m_root->direct_add_child(bc.tag, bc.value);
+
+      categories[i] = category;
+      last_tags[i] = nullptr;
+   }
+
+   index_categories();
+
+   // Lambda function to add a tag to its category:
+   auto fadd = [categories, last_tags](const HLBuiltinTag &bt)
+      {
+         HLNode *&last = last_tags[bt.category];
+         if (last)
+            last = last->direct_add_sibling(bt.tag, bt.value);
+         else
+            last = categories[bt.category]->direct_add_child(bt.tag, bt.value);
+
+         return last;
+      };
+
+   if (builtin.word_count)
+   {
+      m_entries = new HLNode*[builtin.word_count];
+      m_last_entry = m_entries + builtin.word_count;
+      for (unsigned i=0; i<builtin.word_count; ++i)
+         m_entries[i] = fadd(builtin.words[i]);
+   }
+
+   if (builtin.comment_count)
+   {
+      m_comments = new HLNode*[builtin.comment_count];
+      m_last_comment = m_comments + builtin.comment_count;
+      for (unsigned i=0; i<builtin.comment_count; ++i)
+         m_comments[i] = fadd(builtin.comments[i]);
+   }
+
+   if (builtin.pattern_count)
+   {
+      HLNode **patterns = static_cast<HLNode**>(alloca(builtin.pattern_count*sizeof(HLNode*)));
+      for (unsigned i=0; i<builtin.pattern_count; ++i)
+         patterns[i] = fadd(builtin.patterns[i]);
+
+      compile_patterns(patterns, builtin.pattern_count);
+   }
+}
+
+HLIndex::~HLIndex()
+{
+   if (m_base)
+      --m_base->m_derived;
+   
+   delete m_root;
+   delete [] m_entries;
+   delete [] m_comments;
+   delete [] m_patterns;
+   delete [] m_categories;
+   delete [] m_word_filter;
+}
+
+/*
+ * Beginning of HLRegistry class functions:
+ */
+
+HLRegistry::~HLRegistry()
+{
+   Table *table = m_table;
+   if (table)
+   {
+      // Delete the indexes after any that include them:
+      HLList<HLIndex*> owned = HLList<HLIndex*>();
+      for (unsigned i=0; i<table->size; ++i)
+      {
+         Slot &slot = table->slots[i];
+         if (slot.name && slot.owner && slot.index)
+            owned.append(slot.index);
+      }
+      HLIndex::delete_unused(owned);
+      delete [] owned.items;
+
+      for (unsigned i=0; i<table->size; ++i)
+      {
+         Slot &slot = table->slots[i];
+         if (slot.name)
+         {
+            delete [] slot.name;
+            delete [] slot.target;
+         }
+      }
+   }
+
+   // Earlier tables share the names of the current table:
+   while (table)
+   {
+      Table *previous = table->previous;
+      delete [] table->slots;
+      delete table;
+      table = previous;
+   }
+}
+
+/** @brief Returns the index registered for @p name, or nullptr if none. */
+HLIndex *HLRegistry::seek(const char *name) const
+{
+   Slot *slot = find_slot(name, hash_str(name));
+   return slot ? __atomic_load_n(&slot->index, __ATOMIC_ACQUIRE) : nullptr;
+}
+
+/**
+ * @brief Register @p index under @p name.
+ *
+ * @param name  Info string for the index.
+ * @param index The index to register.
+ * @param owner TRUE if the registry should delete @p index upon destruction.
+ *              Aliases share an index owned by the aliased name.
  */
-const HLNode* HLIndex::seek(const char *tag) const
+void HLRegistry::add(const char *name, HLIndex *index, bool owner)
 {
-   HLNode **n = m_entries;
-   while (n<m_last_entry)
+   Slot *slot = get_slot(name);
+   slot->owner = owner;
+   slot->pending = false;
+   __atomic_store_n(&slot->index, index, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Replace the index registered under @p name with @p index.
+ *
+ * Aliases sharing the old index are changed, too.  Each slot is updated
+ * with a single atomic store, so a concurrent seek() returns either the
+ * old or the new index, never a partial one.
+ *
+ * @return The replaced index, now owned by the caller, or nullptr if
+ *         @p name had no index, in which case @p index is added.
+ */
+HLIndex *HLRegistry::replace(const char *name, HLIndex *index)
+{
+   Slot *slot = find_slot(name, hash_str(name));
+   HLIndex *old = slot ? slot->index : nullptr;
+   if (!old)
    {
-      if ((*n)->is_equal(tag))
-         return const_cast<const HLNode*>(*n);
-      ++n;
+      add(name, index);
+      return nullptr;
    }
 
-   return nullptr;
+   for (unsigned i=0; i<m_table->size; ++i)
+   {
+      Slot &other = m_table->slots[i];
+      if (other.name && other.index==old)
+         __atomic_store_n(&other.index, index, __ATOMIC_RELEASE);
+   }
+
+   return old;
+}
+
+/**
+ * @brief Mark @p name as being loaded by the calling thread.
+ *
+ * @return TRUE if the caller should load the index of @p name and add()
+ *         it, FALSE if @p name is already claimed or registered.
+ */
+bool HLRegistry::claim(const char *name)
+{
+   Slot *slot = get_slot(name);
+   if (slot->pending || slot->index)
+      return false;
+
+   slot->pending = true;
+   return true;
 }
 
-const HLNode* HLIndex::seek_word(const char *str) const
+/**
+ * @brief Record that the thread loading @p name waits for, or is itself
+ *        loading, the index of @p target, or nothing if nullptr.
+ *
+ * @p target must stay valid until replaced, see HLIndex::find_index().
+ */
+void HLRegistry::set_waiting(const char *name, const char *target)
 {
-   HLNode **n = m_entries;
-   int len;
-   
-   while (n < m_last_entry)
+   get_slot(name)->waiting = target;
+}
+
+/**
+ * @brief Returns TRUE if the loader of @p name waits for @p target, directly
+ *        or through a chain of loaders each waiting for the next.
+ */
+bool HLRegistry::waits_for(const char *name, const char *target) const
+{
+   // A chain cannot be longer than the number of slots:
+   const Slot *slot = find_slot(name, hash_str(name));
+   for (unsigned i=0; slot && slot->pending && slot->waiting && i<m_count; ++i)
    {
-      const char *c = (*n)->tag();
+      if (strcmp(slot->waiting, target)==0)
+         return true;
+      slot = find_slot(slot->waiting, hash_str(slot->waiting));
+   }
 
-      if (strncmp(str, "background-attachment", 21)==0)
-         if ((*n)->is_equal("background"))
-            len = 1;
-      
-      if ((len=str_match(str, c, true)))
-         return const_cast<const HLNode*>(*n);
-      else
-         ++n;
+   return false;
+}
+
+/** @brief Make @p alias an alias for @p target, replacing any previous target. */
+void HLRegistry::add_alias(const char *alias, const char *target)
+{
+   Slot *slot = get_slot(alias);
+
+   size_t len = strlen(target);
+   char *copy = new char[len+1];
+   memcpy(copy, target, len+1);
+
+   char *old = slot->target;
+   __atomic_store_n(&slot->target, copy, __ATOMIC_RELEASE);
+   delete [] old;
+}
+
+/** @brief Returns the name for which @p alias is an alias, or nullptr if not an alias. */
+const char *HLRegistry::seek_alias(const char *alias) const
+{
+   Slot *slot = find_slot(alias, hash_str(alias));
+   return slot ? __atomic_load_n(&slot->target, __ATOMIC_ACQUIRE) : nullptr;
+}
+
+/** @brief Add to @p names the names of the indexes owned by the table whose base is @p base. */
+void HLRegistry::find_derived(const HLIndex *base, HLList<const char*> &names) const
+{
+   if (!m_table)
+      return;
+
+   for (unsigned i=0; i<m_table->size; ++i)
+   {
+      const Slot &slot = m_table->slots[i];
+      if (slot.name && slot.owner && slot.index && slot.index->base()==base)
+         names.append(slot.name);
    }
+}
 
-   return nullptr;
+/** @brief FNV-1a hash of a string. */
+unsigned HLRegistry::hash_str(const char *str)
+{
+   unsigned hash = 2166136261u;
+   while (*str)
+   {
+      hash ^= static_cast<unsigned char>(*str++);
+      hash *= 16777619u;
+   }
+   return hash;
 }
 
 /**
- * @brief Returns, if found, the node whose comment tag matches the beginning of @p str.
+ * @brief Returns the slot holding @p name, or nullptr if not found.
  *
- * @param str String that may be the start of a comment.
- * @return The matching HLNode* if found, NULL otherwise.
+ * A slot whose name is published is complete, see get_slot().
  */
-const HLNode *HLIndex::seek_comment(const char *str) const
+HLRegistry::Slot *HLRegistry::find_slot(const char *name, unsigned hash) const
 {
-   HLNode **n = m_comments;
-   int len;
-   while (n < m_last_comment)
+   const Table *table = __atomic_load_n(&m_table, __ATOMIC_ACQUIRE);
+   if (table)
    {
-      const char *c = (*n)->tag();
-      if ((len=str_match(str, c, false)))
-         return const_cast<const HLNode*>(*n);
-      else
-         ++n;
+      unsigned mask = table->size - 1;
+      const char *slot_name;
+      for (unsigned i = hash & mask;
+           (slot_name=__atomic_load_n(&table->slots[i].name, __ATOMIC_ACQUIRE));
+           i = (i+1) & mask)
+      {
+         if (table->slots[i].hash==hash && strcmp(slot_name, name)==0)
+            return &table->slots[i];
+      }
    }
 
    return nullptr;
 }
 
-void HLIndex::print(FILE *f) const
+/** @brief Returns the slot holding @p name, claiming an empty slot if not found. */
+HLRegistry::Slot *HLRegistry::get_slot(const char *name)
 {
-   fputc('\n', stdout);
-   
-   if (m_hyphenated_tags)
-      printf("Processing with hyphenated tags.\n");
+   unsigned hash = hash_str(name);
+   Slot *slot = find_slot(name, hash);
+   if (!slot)
+   {
+      if (!m_table || (m_count+1)*2 > m_table->size)
+         grow();
 
-   if (m_case_insensitive)
-      printf("Processing case-insensitive tags.\n");
-   
-   HLNode **n;
-   if (m_entries)
+      unsigned mask = m_table->size - 1;
+      unsigned i = hash & mask;
+      while (m_table->slots[i].name)
+         i = (i+1) & mask;
+
+      slot = &m_table->slots[i];
+      slot->hash = hash;
+
+      size_t len = strlen(name);
+      char *copy = new char[len+1];
+      memcpy(copy, name, len+1);
+
+      // Publish the name last, when the slot is ready to be found:
+      __atomic_store_n(&slot->name, copy, __ATOMIC_RELEASE);
+      ++m_count;
+   }
+
+   return slot;
+}
+
+/**
+ * @brief Replace the table with one of twice the slots, moving the entries
+ *        to their new slots.
+ *
+ * The replaced table is kept, unchanged, for lookups still probing it.
+ */
+void HLRegistry::grow(void)
+{
+   Table *table = new Table;
+   table->size = m_table ? m_table->size*2 : 16;
+   table->slots = new Slot[table->size];
+   table->previous = m_table;
+   memset(table->slots, 0, table->size*sizeof(Slot));
+
+   if (m_table)
    {
-      printf("\nListing tags:\n");
-      n = m_entries;
-      while (n<m_last_entry)
+      unsigned mask = table->size - 1;
+      for (unsigned j=0; j<m_table->size; ++j)
       {
-         printf("\"%s\"\n", (*n)->tag());
-         ++n;
+         const Slot &old = m_table->slots[j];
+         if (old.name)
+         {
+            unsigned i = old.hash & mask;
+            while (table->slots[i].name)
+               i = (i+1) & mask;
+
+            table->slots[i] = old;
+         }
       }
    }
-   if (m_comments)
+
+   __atomic_store_n(&m_table, table, __ATOMIC_RELEASE);
+}
+
+int hlnode_sorter(const void *lh, const void *rh)
+{
+   const HLNode *lhn = *static_cast<const HLNode**>(const_cast<void*>(lh));
+   const HLNode *rhn = *static_cast<const HLNode**>(const_cast<void*>(rh));
+   return strcmp(lhn->tag(), rhn->tag());
+}
+
+/**
+ * @brief Scans the HLNode root pointer for recognized tags.
+ */
+void HLIndex::source_scan(void)
+{
+   int count_words = 0;
+   int count_comments = 0;
+   int count_patterns = 0;
+   auto fcount = [&count_words, &count_comments, &count_patterns, this](HLNode *node)
    {
-      printf("\nListing comments:\n");
-      n = m_comments;
-      while (n<m_last_comment)
+      const char *tag = node->tag();
+      if (is_pattern_tag(tag))
+         ++count_patterns;
+      else if (name_char_length(tag))
+         ++count_words;
+      else if (!isspace(*tag))
+         ++count_comments;
+   };
+
+   walk_tags(fcount);
+
+   if (count_patterns)
+   {
+      HLNode **patterns = new HLNode*[count_patterns];
+      HLNode **arr_patterns = patterns;
+      auto fpattern = [&arr_patterns](HLNode *node)
+         {
+            if (is_pattern_tag(node->tag()))
+               *arr_patterns++ = node;
+         };
+
+      walk_tags(fpattern);
+      compile_patterns(patterns, count_patterns);
+      delete [] patterns;
+   }
+
+   if (count_words + count_comments)
+   {
+      // Prepare the entries (words) list:
+      HLNode **arr_words = nullptr;
+      if (count_words)
       {
-         printf("\"%s\"\n", (*n)->tag());
-         ++n;
+         arr_words = new HLNode*[count_words];
+         memset(arr_words,0,count_words*sizeof(HLNode*));
+         m_entries = arr_words;
+         m_last_entry = m_entries + count_words;
+      }
+
+      // Conditionally prepare the comments list:
+      HLNode **arr_comments = nullptr;
+      if (count_comments)
+      {
+         arr_comments = new HLNode*[count_comments];
+         memset(arr_comments,0,count_comments*sizeof(HLNode*));
+         m_comments = arr_comments;
+         m_last_comment = m_comments + count_comments;
+      }
+
+      // Lambda function to save words and comments to respective arrays:
+      auto fsave = [&arr_words, &arr_comments, this](HLNode *node)
+         {
+            if (m_case_insensitive)
+               node->tag_to_lower_case();
+            
+            const char *tag = node->tag();
+            if (is_pattern_tag(tag))
+               return;
+            else if (name_char_length(tag))
+            {
+               *arr_words = node;
+               ++arr_words;
+            }
+            else if (!isspace(*tag))
+            {
+               *arr_comments = node;
+               ++arr_comments;
+            }
+         };
+
+      walk_tags(fsave);
+
+      // Sort lists that exist:
+      if (count_words)
+      {
+         qsort(m_entries, count_words, sizeof(HLNode*), hlnode_sorter);
+         build_word_filter();
       }
+      if (count_comments)
+         qsort(m_comments, count_comments, sizeof(HLNode*), hlnode_sorter);
    }
 }
 
 
 
-HLIndex::HLIndex(HLNode *root, bool hyphenated_tags, bool case_insensitive)
-   : m_next(nullptr), m_root(root),
-     m_entries(nullptr), m_last_entry(nullptr),
-     m_comments(nullptr), m_last_comment(nullptr),
-     m_hyphenated_tags(hyphenated_tags),
-     m_case_insensitive(case_insensitive),
-     m_str_match_func(case_insensitive?str_match_insensitive:str_match_sensitive)
-     
+
+
+
+/**
+ * @brief Returns a hash of the word at @p str, which ends at the first
+ *        character not allowed in a name.
+ *
+ * @param str  String starting with a word-eligible character.
+ * @param fold Hash the ASCII letters in lower case, as compared by
+ *             str_match_insensitive().
+ * @param name_allow Word character test for the end of the word.
+ */
+uint64_t HLIndex::hash_word(const char *str, bool fold, Word_Eligible_Char_Func name_allow)
 {
-   set_hyphenated_names_allowed(hyphenated_tags);
-   
-   if (root)
-      source_scan();
+   // FNV-1a over the bytes of the word:
+   uint64_t hash = 14695981039346656037ULL;
+   int len;
+   while ((len=name_char_length(str, name_allow)))
+   {
+      for (int i=0; i<len; ++i, ++str)
+         hash = (hash ^ static_cast<unsigned char>(fold ? toLowerCase(*str) : *str))
+            * 1099511628211ULL;
+   }
+
+   // Mix the high bits into the low ones, from which the probes are taken:
+   hash ^= hash >> 33;
+   hash *= 0xff51afd7ed558ccdULL;
+   hash ^= hash >> 33;
+   return hash;
 }
 
-/** Destructor also sets allowed_in_name to non-hyphenated version. */
-HLIndex::~HLIndex()
+/** @brief Fill m_word_filter with the leading word of each tag of m_entries. */
+void HLIndex::build_word_filter(void)
 {
-   s_word_eligible_char_func = simple_name_allow;
-   
-   delete m_next;
-   delete m_root;
-   delete [] m_entries;
+   size_t bits = 64;
+   while (bits < size_t(word_count()) * WORD_FILTER_BITS_PER_TAG && bits < (1u << 21))
+      bits <<= 1;
+
+   m_word_filter = new uint64_t[bits/64];
+   memset(m_word_filter, 0, bits/8);
+   m_word_filter_mask = bits - 1;
+
+   for (HLNode **n = m_entries; n < m_last_entry; ++n)
+   {
+      uint64_t hash = hash_word((*n)->tag(), false, m_name_allow);
+      for (int i=0; i<WORD_FILTER_PROBES; ++i, hash >>= 21)
+      {
+         uint32_t bit = hash & m_word_filter_mask;
+         m_word_filter[bit/64] |= uint64_t(1) << (bit%64);
+      }
+   }
 }
 
 /**
- * @brief Looks for and opens an appropriate highlight file.
+ * @brief Returns true if no tag of m_entries can match the word at @p str.
  *
- * @param type The type string that opens a fenced code area in doxygen.
- * @return An open file pointer or NULL if an appropriate file was not found.
+ * A scan with other word boundaries than the filter was built with, as
+ * when this index is the base() of an index with hyphenated tags, sees
+ * other words, so the filter is passed over.
  *
- * For now, this function simply searches the current directory for a
- * file whose name matches @p type, followed by `.hl`.  A possible future
- * enhancement might be to look in an `.conf` file for alternate search
- * paths.
+ * @param str        String starting with a word-eligible character.
+ * @param name_allow Word character test of the scanning index.
  */
-FILE *HLIndex::find_and_open_file(const char *type)
+bool HLIndex::word_filter_rejects(const char *str, Word_Eligible_Char_Func name_allow) const
 {
-   // Use stack memory to create file name with .hl extension:
-   size_t len = strlen(type);
-   
-   // Buffer with 4 extra chars, '.hl' + '\0':
-   char *filepath = static_cast<char*>(alloca(len+4));
-   char *p = filepath;
-   memcpy(p, type, len);
-   p += len;
-   memcpy(p, ".hl", 3);
-   p += 3;
-   *p = '\0';
-
-   return fopen(filepath, "r");
-}
-
+   if (name_allow != m_name_allow)
+      return false;
 
-/** @brief Walks HLIndex linked list to find one that supports @p type. */
-const HLIndex *HLIndex::seek_index(const char *type)
-{
-   const HLIndex *cindex = &s_base;
-   while (cindex)
+   uint64_t hash = hash_word(str, m_case_insensitive, m_name_allow);
+   for (int i=0; i<WORD_FILTER_PROBES; ++i, hash >>= 21)
    {
-      if (cindex->is_equal(type))
-         return cindex;
-
-      cindex = cindex->m_next;
+      uint32_t bit = hash & m_word_filter_mask;
+      if (!(m_word_filter[bit/64] & (uint64_t(1) << (bit%64))))
+         return true;
    }
 
-   return nullptr;
+   return false;
 }
 
-/** @brief Get last of HLIndex linked list as host for new HLIndex. */
-HLIndex *HLIndex::get_last(void)
+/** @brief Returns the number of bits set in the Bloom filter, for reports. */
+unsigned HLIndex::word_filter_bits_set(void) const
 {
-   HLIndex *rval = &s_base;
-   while (rval->m_next)
-      rval = rval->m_next;
+   unsigned set = 0;
+   for (unsigned i=0; i<word_filter_bits()/64; ++i)
+      set += __builtin_popcountll(m_word_filter[i]);
+   return set;
+}
 
-   return rval;
+/**
+ * @brief List the rule lines of m_root for category() and category_of().
+ *
+ * Nodes without a tag, left by highlighting file comment lines, are skipped.
+ */
+void HLIndex::index_categories(void)
+{
+   for (const HLNode *node = m_root->first_child(); node; node = node->next_sibling())
+      if (node->tag())
+         ++m_category_count;
+
+   if (m_category_count)
+   {
+      m_categories = new HLNode*[m_category_count];
+      HLNode **arr = m_categories;
+      for (HLNode *node = m_root->first_child(); node; node = node->next_sibling())
+         if (node->tag())
+            *arr++ = node;
+   }
 }
 
-int hlnode_sorter(const void *lh, const void *rh)
+/**
+ * @brief Returns the category number of the rule line of @p tag.
+ *
+ * @param tag A tag node of this index, as returned by seek_word(),
+ *            seek_comment(), or seek_pattern().
+ * @return Index of the parent of @p tag for category(), or -1 if
+ *         @p tag is not in this index or its base().
+ */
+int HLIndex::category_of(const HLNode *tag) const
 {
-   const HLNode *lhn = *static_cast<const HLNode**>(const_cast<void*>(lh));
-   const HLNode *rhn = *static_cast<const HLNode**>(const_cast<void*>(rh));
-   return strcmp(lhn->tag(), rhn->tag());
+   const HLNode *parent = tag->parent();
+   for (int i=0; i<m_category_count; ++i)
+      if (m_categories[i]==parent)
+         return m_base_category_count + i;
+
+   return m_base ? m_base->category_of(tag) : -1;
 }
 
 /**
- * @brief Scans the HLNode root pointer for recognized tags.
+ * @brief Combine the patterns of pattern lines into the m_regex DFA.
+ *
+ * Patterns that fail to compile are reported and ignored.  If the patterns
+ * together need too many DFA states, they are combined again one at a
+ * time, and each that leaves too many with the patterns before it is
+ * reported and ignored, so the others are kept.
+ *
+ * @param patterns Pattern line nodes, in file order.
+ * @param count    Number of elements in @p patterns.
  */
-void HLIndex::source_scan(void)
+void HLIndex::compile_patterns(HLNode **patterns, int count)
 {
-   int count_words = 0;
-   int count_comments = 0;
-   auto fcount = [&count_words, &count_comments, this](HLNode *node)
+   m_patterns = new HLNode*[count];
+
+   for (int i=0; i<count; ++i)
    {
-      const char *tag = node->tag();
-      if (allowed_in_name(*tag))
-         ++count_words;
-      else if (!isspace(*tag))
-         ++count_comments;
-   };
+      const char *pattern = patterns[i]->value();
+      if (!pattern)
+         continue;
 
-   walk_tags(fcount);
+      if (m_regex.add(pattern, m_case_insensitive))
+         m_patterns[m_pattern_count++] = patterns[i];
+      else
+         fprintf(stderr, "Ignoring pattern \"%s\" for %s: %s.\n",
+                 pattern, m_root->tag(), m_regex.error());
+   }
 
-   if (count_words + count_comments)
+   if (m_pattern_count && !m_regex.compile())
    {
-      // Prepare the entries (words) list:
-      HLNode **arr_words = nullptr;
-      if (count_words)
-      {
-         arr_words = new HLNode*[count_words];
-         memset(arr_words,0,count_words*sizeof(HLNode*));
-         m_entries = arr_words;
-         m_last_entry = m_entries + count_words;
-      }
+      while (m_regex.pattern_count())
+         m_regex.remove_last();
 
-      // Conditionally prepare the comments list:
-      HLNode **arr_comments = nullptr;
-      if (count_comments)
+      bool compiled = false;
+      int kept = 0;
+      for (int i=0; i<m_pattern_count; ++i)
       {
-         arr_comments = new HLNode*[count_comments];
-         memset(arr_comments,0,count_comments*sizeof(HLNode*));
-         m_comments = arr_comments;
-         m_last_comment = m_comments + count_comments;
-      }
-
-      // Lambda function to save words and comments to respective arrays:
-      auto fsave = [&arr_words, &arr_comments, this](HLNode *node)
+         const char *pattern = m_patterns[i]->value();
+         m_regex.add(pattern, m_case_insensitive);
+         if ((compiled = m_regex.compile()))
+            m_patterns[kept++] = m_patterns[i];
+         else
          {
-            if (m_case_insensitive)
-               node->tag_to_lower_case();
-            
-            const char *tag = node->tag();
-            if (allowed_in_name(*tag))
-            {
-               *arr_words = node;
-               ++arr_words;
-            }
-            else if (!isspace(*tag))
-            {
-               *arr_comments = node;
-               ++arr_comments;
-            }
-         };
+            fprintf(stderr, "Ignoring pattern \"%s\" for %s: %s.\n",
+                    pattern, m_root->tag(), m_regex.error());
+            m_regex.remove_last();
+         }
+      }
 
-      walk_tags(fsave);
+      m_pattern_count = kept;
+      if (kept && !compiled)
+         m_regex.compile();
+   }
 
-      // Sort lists that exist:
-      if (count_words)
-         qsort(m_entries, count_words, sizeof(HLNode*), hlnode_sorter);
-      if (count_comments)
-         qsort(m_comments, count_comments, sizeof(HLNode*), hlnode_sorter);
+   if (!m_pattern_count)
+   {
+      delete [] m_patterns;
+      m_patterns = nullptr;
    }
 }
 
 
 
-
-
-
 #ifndef EXCLUDE_TESTS
 #define EXCLUDE_TESTS
 
 #include "hlnode.cpp"
+#include "hlpath.cpp"
+#include "hlregex.cpp"
+
+#include <limits.h>   // for PATH_MAX
+#include <signal.h>   // for alarm()
+#include <time.h>     // for clock()
+#include <thread>
 
 /**
  * @brief Test opening highlighting file.
@@ -724,13 +1951,9 @@ int comp_words(const char *haystack,
    int matched = 0;
 
    auto strmatch = HLIndex::get_str_match_func(case_sensitive);
-   
-   auto saved_checker = HLIndex::get_name_char_checker();
-   HLIndex::set_hyphenated_names_allowed(allow_hyphens);
+   auto checker = HLIndex::get_name_char_checker(allow_hyphens, false);
 
-   matched = (*strmatch)(haystack, needle, true);
-   
-   HLIndex::set_name_char_checker(saved_checker);
+   matched = (*strmatch)(haystack, needle, true, checker);
 
    return matched;
 }
@@ -781,28 +2004,613 @@ void test_str_match_comment(void)
           needle, hay, count);
 }
 
+/**
+ * @brief Write a highlighting file for @p type in @p dir that includes
+ *        @p include, with enough tags to be slow to parse.
+ */
+void write_including_file(const char *dir, const char *type, const char *include)
+{
+   char path[PATH_MAX];
+   snprintf(path, sizeof(path), "%s/%s.hl", dir, type);
+
+   FILE *file = fopen(path, "w");
+   if (!file)
+      return;
+
+   fprintf(file, "!include %s\n\nkeyword : span.keyword\n", include);
+   for (int i=0; i<20000; ++i)
+      fprintf(file, "   %s%d\n", type, i);
+   fclose(file);
+}
+
+/** @brief Abort a test that deadlocked. */
+void report_deadlock(int signum)
+{
+   static const char msg[] = "test_cross_thread_includes deadlocked.\n";
+   ssize_t written = write(STDERR_FILENO, msg, sizeof(msg)-1);
+   _exit(written>0 ? 2 : 3);
+}
+
+/**
+ * @brief Load mutually including files `xN.hl` and `yN.hl` in two threads
+ *        at once, returning TRUE if every pair loaded.
+ *
+ * Each thread claims its type, then waits for the type claimed by the
+ * other, which should find the circle rather than wait forever.  The
+ * files are slow to parse, so both types are claimed before either
+ * include is reached.
+ */
+bool test_cross_thread_includes(void)
+{
+   printf("\nBeginning test_cross_thread_includes:\n");
+
+   char dir[] = "/tmp/hlindex-XXXXXX";
+   if (!mkdtemp(dir))
+   {
+      printf("Unable to make a directory for the test.\n");
+      return false;
+   }
+
+   const int rounds = 8;
+   char types[rounds][2][16];
+   for (int i=0; i<rounds; ++i)
+   {
+      snprintf(types[i][0], sizeof(types[i][0]), "x%d", i);
+      snprintf(types[i][1], sizeof(types[i][1]), "y%d", i);
+      write_including_file(dir, types[i][0], types[i][1]);
+      write_including_file(dir, types[i][1], types[i][0]);
+   }
+
+   HLPath::add_search_dirs(dir);
+
+   signal(SIGALRM, report_deadlock);
+   alarm(30);
+
+   int loaded = 0;
+   for (int i=0; i<rounds; ++i)
+   {
+      const HLIndex *ndx[2] = { nullptr, nullptr };
+      std::thread other([&]() { ndx[1] = HLIndex::get_index(types[i][1]); });
+      ndx[0] = HLIndex::get_index(types[i][0]);
+      other.join();
+
+      // One of the two ignores its include, the other includes it:
+      if (ndx[0] && ndx[1] && (ndx[0]->base()==ndx[1]) != (ndx[1]->base()==ndx[0]))
+         ++loaded;
+   }
+
+   alarm(0);
+   printf("%d of %d pairs loaded, one file of each including the other.\n", loaded, rounds);
+
+   for (int i=0; i<rounds; ++i)
+      for (int j=0; j<2; ++j)
+      {
+         char path[PATH_MAX];
+         snprintf(path, sizeof(path), "%s/%s.hl", dir, types[i][j]);
+         unlink(path);
+      }
+   rmdir(dir);
+
+   return loaded==rounds;
+}
+
+/** @brief Word character test for test_nested_repeats(). */
+bool is_word_char(int ch)
+{
+   return isalnum(ch) || ch=='_';
+}
+
+/**
+ * @brief Check that nested bounded repetitions are rejected before they
+ *        are expanded, and that bounded repetitions of a workable size
+ *        still match, returning TRUE if all is well.
+ */
+bool test_nested_repeats(void)
+{
+   printf("\nBeginning test_nested_repeats:\n");
+
+   static const char *const too_large[] =
+   {
+      "((a{255}){255}){255}",
+      "(((a{255}){255}){255}){255}",
+      "((a|b|c|d){255}){255}",
+      "x(y{200}){200}"
+   };
+
+   bool passed = true;
+   HLRegex regex;
+   for (const char *pattern : too_large)
+   {
+      clock_t start = clock();
+      bool added = regex.add(pattern);
+      double seconds = static_cast<double>(clock()-start) / CLOCKS_PER_SEC;
+
+      bool ok = !added && seconds < 0.1;
+      printf("%s \"%s\" in %.3f seconds: %s.\n", ok ? "Rejected" : "FAILED to reject",
+             pattern, seconds, added ? "added" : regex.error());
+      passed = passed && ok;
+   }
+
+   static const char *const workable[] = { "#[0-9a-f]{3,6}", "(ab){100}", "(z{10}){10,}" };
+   for (const char *pattern : workable)
+      if (!regex.add(pattern))
+      {
+         printf("FAILED to add \"%s\": %s.\n", pattern, regex.error());
+         passed = false;
+      }
+
+   if (passed && regex.compile())
+   {
+      char text[256];
+      int length = 0;
+      strcpy(text, "#1f2e");
+      bool ok = regex.match(text, &length, is_word_char)==0 && length==5;
+
+      memset(text, 0, sizeof(text));
+      for (int i=0; i<200; ++i)
+         text[i] = "ab"[i&1];
+      ok = ok && regex.match(text, &length, is_word_char)==1 && length==200;
+
+      memset(text, 0, sizeof(text));
+      memset(text, 'z', 120);
+      ok = ok && regex.match(text, &length, is_word_char)==2 && length==120;
+
+      printf("%s workable repetitions.\n", ok ? "Matched" : "FAILED to match");
+      passed = ok;
+   }
+   else if (passed)
+   {
+      printf("FAILED to compile: %s.\n", regex.error());
+      passed = false;
+   }
+
+   return passed;
+}
+
+/**
+ * @brief Build an index from a case-insensitive file with a tag longer
+ *        than the stack, returning TRUE if a word of the tag is found.
+ *
+ * Its tag is converted to lower case, and its value escape-resolved, in
+ * a heap buffer, as a line may be of any length.
+ */
+bool test_long_lines(void)
+{
+   printf("\nBeginning test_long_lines:\n");
+
+   char dir[] = "/tmp/hlindex-XXXXXX";
+   if (!mkdtemp(dir))
+   {
+      printf("Unable to make a directory for the test.\n");
+      return false;
+   }
+
+   const size_t len = 16 << 20;
+   char *tag = new char[len+1];
+   memset(tag, 'a', len);
+   tag[len] = '\0';
+
+   char path[PATH_MAX];
+   snprintf(path, sizeof(path), "%s/longlines.hl", dir);
+   FILE *file = fopen(path, "w");
+   if (file)
+   {
+      fputs("!ci\n\nkeyword : span.keyword\n   A", file);
+      fputs(tag+1, file);
+      fputs("\n", file);
+      fclose(file);
+   }
+
+   HLIndex *ndx = HLIndex::build("longlines", path);
+   if (ndx)
+      HLIndex::publish("longlines", ndx);
+   bool found = ndx && ndx->seek_word(tag)!=nullptr;
+   printf("The %lu-character tag was %sfound.\n", static_cast<unsigned long>(len), found ? "" : "not ");
+
+   delete [] tag;
+   unlink(path);
+   rmdir(dir);
+
+   return found;
+}
+
+/**
+ * @brief Write the highlighting file @p name in @p dir with the @p text,
+ *        returning its path in @p path.
+ */
+void write_test_file(const char *dir, const char *name, const char *text, char *path, size_t size)
+{
+   snprintf(path, size, "%s/%s", dir, name);
+   FILE *file = fopen(path, "w");
+   if (file)
+   {
+      fputs(text, file);
+      fclose(file);
+   }
+}
+
+/**
+ * @brief Scan with an index with hyphenated tags while an index without is
+ *        built and deleted, returning TRUE if the scan keeps its own words.
+ */
+bool test_word_chars_per_index(void)
+{
+   printf("\nBeginning test_word_chars_per_index:\n");
+
+   char dir[] = "/tmp/hlindex-XXXXXX";
+   if (!mkdtemp(dir))
+   {
+      printf("Unable to make a directory for the test.\n");
+      return false;
+   }
+
+   char hyphens[PATH_MAX];
+   char plain[PATH_MAX];
+   write_test_file(dir, "hyphens.hl", "!ht\n\nkeyword : span.keyword\n   foo\n   foo-bar\n",
+                   hyphens, sizeof(hyphens));
+   write_test_file(dir, "plain.hl", "keyword : span.keyword\n   foo\n",
+                   plain, sizeof(plain));
+
+   HLIndex *ndx = HLIndex::build("hyphens", hyphens);
+   if (ndx)
+      HLIndex::publish("hyphens", ndx);
+
+   // Build another index, and delete it by replacing it:
+   HLIndex::publish("plain", HLIndex::build("plain", plain));
+   HLIndex::publish("plain", HLIndex::build("plain", plain));
+   HLIndex::reclaim();
+
+   const HLNode *found = ndx ? ndx->seek_word("foo-bar baz") : nullptr;
+   bool ok = found && strcmp(found->tag(), "foo-bar")==0 && ndx->allowed_in_name('-');
+   printf("\"foo-bar\" was %sfound as one word.\n", ok ? "" : "not ");
+
+   unlink(hyphens);
+   unlink(plain);
+   rmdir(dir);
+
+   return ok;
+}
+
+/**
+ * @brief Build indexes with a pattern too complex for the DFA, returning
+ *        TRUE if only that pattern is left out, and a file of that pattern
+ *        alone is not taken for a missing file.
+ */
+bool test_complex_pattern(void)
+{
+   printf("\nBeginning test_complex_pattern:\n");
+
+   char dir[] = "/tmp/hlindex-XXXXXX";
+   if (!mkdtemp(dir))
+   {
+      printf("Unable to make a directory for the test.\n");
+      return false;
+   }
+
+   char mixed[PATH_MAX];
+   char alone[PATH_MAX];
+   write_test_file(dir, "mixed.hl",
+                   "number : span.number\n"
+                   "   @re [0-9]+\n"
+                   "   @re (a|b)*a(a|b){12}\n"
+                   "   @re 0x[0-9a-f]+\n",
+                   mixed, sizeof(mixed));
+   write_test_file(dir, "alone.hl",
+                   "number : span.number\n"
+                   "   @re (a|b)*a(a|b){12}\n",
+                   alone, sizeof(alone));
+
+   HLIndex *ndx = HLIndex::build("mixed", mixed);
+   if (ndx)
+      HLIndex::publish("mixed", ndx);
+   int length = 0;
+   bool ok = ndx && ndx->pattern_count()==2 && ndx->seek_pattern("0x1f ", &length) && length==4;
+   printf("The other patterns were %skept.\n", ok ? "" : "not ");
+
+   HLIndex *empty = HLIndex::build("alone", alone);
+   if (empty)
+      HLIndex::publish("alone", empty);
+   bool found = empty && !empty->is_empty();
+   printf("The file of the pattern alone was %sfound.\n", found ? "" : "not ");
+
+   unlink(mixed);
+   unlink(alone);
+   rmdir(dir);
+
+   return ok && found;
+}
+
+/** @brief Run the tests that check their results, returning the number failed. */
+int run_checked_tests(void)
+{
+   int failed = 0;
+   if (!test_cross_thread_includes())
+      ++failed;
+   if (!test_nested_repeats())
+      ++failed;
+   if (!test_long_lines())
+      ++failed;
+   if (!test_word_chars_per_index())
+      ++failed;
+   if (!test_complex_pattern())
+      ++failed;
+
+   printf("\n%d checked tests failed.\n", failed);
+   return failed;
+}
+
+/** @brief Name of the category of @p tag, for analyzer messages. */
+const char *category_name(const HLIndex *ndx, const HLNode *tag)
+{
+   int cat = ndx->category_of(tag);
+   return cat<0 ? "?" : ndx->category(cat)->tag();
+}
+
+/** @brief Add the nodes under and including @p node to the counts. */
+void count_nodes(const HLNode *node, int &nodes, size_t &string_bytes)
+{
+   for (; node; node=node->next_sibling())
+   {
+      ++nodes;
+      if (node->tag())
+         string_bytes += strlen(node->tag()) + 1;
+      if (node->value())
+         string_bytes += strlen(node->value()) + 1;
+
+      count_nodes(node->first_child(), nodes, string_bytes);
+   }
+}
+
+/**
+ * @brief Returns the index of the first word tag (@p words TRUE) or comment
+ *        tag of @p ndx equal to the @p len characters of @p str, or -1.
+ *
+ * The tags are sorted, so this is a binary search for the first of equals.
+ */
+int find_tag(const HLIndex *ndx, bool words, const char *str, size_t len)
+{
+   int low = 0;
+   int high = words ? ndx->word_count() : ndx->comment_count();
+   while (low < high)
+   {
+      int mid = (low+high) / 2;
+      const char *tag = words ? ndx->word(mid)->tag() : ndx->comment(mid)->tag();
+      int cmp = strncmp(tag, str, len);
+      if (cmp==0 && tag[len])
+         cmp = 1;
+
+      if (cmp < 0)
+         low = mid+1;
+      else
+         high = mid;
+   }
+
+   int count = words ? ndx->word_count() : ndx->comment_count();
+   if (low<count)
+   {
+      const char *tag = words ? ndx->word(low)->tag() : ndx->comment(low)->tag();
+      if (strncmp(tag, str, len)==0 && !tag[len])
+         return low;
+   }
+
+   return -1;
+}
+
+/**
+ * @brief Returns the index of the tag that seek_word() (@p words TRUE) or
+ *        seek_comment() finds for text that is just @p str.
+ *
+ * The walk stops at the first tag in sorted order that matches, which is
+ * the shortest tag that is a prefix of @p str, if followed by a character
+ * that is not a word character of the index for a word tag.  Only the
+ * prefixes as long as some tag, listed in @p lengths, are looked up.
+ *
+ * @param lengths Lengths of the tags, ascending, each once.
+ */
+int first_match(const HLIndex *ndx, bool words, const char *str, const HLList<size_t> &lengths)
+{
+   HLIndex::Word_Eligible_Char_Func name_allow = ndx->name_char_checker();
+   size_t len = strlen(str);
+   for (int i=0; i<lengths.count && lengths.items[i]<=len; ++i)
+   {
+      size_t prefix = lengths.items[i];
+      if (words && prefix<len && HLIndex::name_char_length(str+prefix, name_allow))
+         continue;
+
+      int found = find_tag(ndx, words, str, prefix);
+      if (found>=0)
+         return found;
+   }
+
+   return -1;
+}
+
+/** @brief Add @p len to the ascending list @p lengths, unless already there. */
+void add_length(HLList<size_t> &lengths, size_t len)
+{
+   int i = lengths.count;
+   while (i>0 && lengths.items[i-1]>len)
+      --i;
+   if (i>0 && lengths.items[i-1]==len)
+      return;
+
+   lengths.append(len);
+   memmove(lengths.items+i+1, lengths.items+i, (lengths.count-1-i)*sizeof(size_t));
+   lengths.items[i] = len;
+}
+
+/**
+ * @brief Report the lookup cost, duplicates and shadowed tags of the word
+ *        tags (@p words TRUE) or comment tags of @p ndx.
+ *
+ * A lookup walks the sorted tags until one matches, so a tag preceded by
+ * a tag that also matches its text, like `foo` before `foo-bar` without
+ * hyphenated tags, is never found.  The cost reported is of the lookup the
+ * index runs: the matcher compiled in by hl2cpp, or the walk, which for
+ * word tags the Bloom filter spares most words that are not tags.
+ */
+void analyze_tags(const HLIndex *ndx, bool words)
+{
+   int count = words ? ndx->word_count() : ndx->comment_count();
+   const char *kind = words ? "word" : "comment";
+   if (!count)
+      return;
+
+   auto tag_at = [ndx, words](int i) { return words ? ndx->word(i) : ndx->comment(i); };
+
+   HLList<size_t> lengths = { nullptr, 0, 0 };
+   for (int i=0; i<count; ++i)
+      add_length(lengths, strlen(tag_at(i)->tag()));
+
+   long probes = 0;
+   long same_first = 0;
+   long chars = 0;
+   int duplicates = 0;
+   int shadowed = 0;
+
+   int run_start = 0;
+   for (int i=0; i<count; ++i)
+   {
+      const HLNode *node = tag_at(i);
+      const char *tag = node->tag();
+      chars += strlen(tag) + 1;
+
+      // Entries a miss starting with the same character compares further,
+      // the run of tags starting with it, counted at the end of each run:
+      if (i+1==count || *tag_at(i+1)->tag()!=*tag)
+      {
+         long run = i+1 - run_start;
+         same_first += run * run;
+         run_start = i+1;
+      }
+
+      int found = first_match(ndx, words, tag, lengths);
+      probes += found + 1;
+
+      if (found==i)
+         continue;
+
+      const HLNode *winner = tag_at(found);
+      if (strcmp(winner->tag(), tag)==0)
+      {
+         ++duplicates;
+         printf("   Duplicate %s tag \"%s\" in %s, already in %s.\n",
+                kind, tag, category_name(ndx, node), category_name(ndx, winner));
+      }
+      else
+      {
+         ++shadowed;
+         printf("   %s tag \"%s\" in %s never matches, \"%s\" in %s%s matches first.\n",
+                words ? "Word" : "Comment", tag, category_name(ndx, node),
+                winner->tag(), category_name(ndx, winner),
+                ndx->category_of(winner)==ndx->category_of(node) ? " (same category)" : "");
+      }
+   }
+
+   delete [] lengths.items;
+
+   printf("   %d %s tags: %d duplicates, %d shadowed.\n", count, kind, duplicates, shadowed);
+
+   if (words ? ndx->has_word_matcher() : ndx->has_comment_matcher())
+   {
+      printf("   Compiled in by hl2cpp: %.1f character tests per hit, and a miss\n"
+             "   ends at the first character no tag has in its place.\n",
+             static_cast<double>(chars)/count);
+      return;
+   }
+
+   if (words && ndx->has_word_filter())
+   {
+      double fill = static_cast<double>(ndx->word_filter_bits_set()) / ndx->word_filter_bits();
+      double passed = 1.0;
+      for (int i=0; i<HLIndex::word_filter_probes(); ++i)
+         passed *= fill;
+      printf("   Bloom filter: %u bits, %.1f%% set, passes %.2f%% of words that\n"
+             "   are not tags on to the walk.\n",
+             ndx->word_filter_bits(), 100.0*fill, 100.0*passed);
+   }
+
+   printf("   Sorted walk: %.1f entries per hit, %d per miss, %.1f compared past\n"
+          "   the first character on a miss starting like a tag.\n",
+          static_cast<double>(probes)/count, count, static_cast<double>(same_first)/count);
+}
+
+/**
+ * @brief Report on the vocabulary of @p ndx, to keep highlighting files lean and fast.
+ *
+ * Reports the memory footprint, the cost of lookups, duplicate tags, and
+ * tags that can never match.
+ */
+void analyze_index(const char *type, const HLIndex *ndx)
+{
+   int nodes = 0;
+   size_t string_bytes = 0;
+   count_nodes(ndx->root(), nodes, string_bytes);
+
+   size_t word_bytes = ndx->word_count() * sizeof(HLNode*);
+   size_t comment_bytes = ndx->comment_count() * sizeof(HLNode*);
+   const HLIndex *base = ndx->base();
+   int categories = ndx->category_count() - (base ? base->category_count() : 0);
+   size_t category_bytes = categories * sizeof(HLNode*);
+
+   printf("\nAnalysis of type %s:\n", type);
+   if (base)
+      printf("   Includes %s, shared with its type; counts are of this file's own tags.\n",
+             base->root()->tag());
+   printf("   %d nodes of %u bytes, %lu bytes of strings if not shared.\n",
+          nodes, static_cast<unsigned>(sizeof(HLNode)), static_cast<unsigned long>(string_bytes));
+   printf("   m_entries %lu bytes, m_comments %lu bytes, m_categories %lu bytes.\n",
+          static_cast<unsigned long>(word_bytes), static_cast<unsigned long>(comment_bytes),
+          static_cast<unsigned long>(category_bytes));
+   printf("   Total %lu bytes, without the pattern DFA.\n",
+          static_cast<unsigned long>(nodes*sizeof(HLNode) + string_bytes
+                                     + word_bytes + comment_bytes + category_bytes));
+
+   analyze_tags(ndx, true);
+   analyze_tags(ndx, false);
+
+   if (ndx->pattern_count())
+      printf("   %d pattern lines, matched together by one DFA.\n", ndx->pattern_count());
+}
+
 
 int main(int argc, char **argv)
 {
-   if (argc==1)
+   if (argc==2 && strcmp(argv[1], "--test")==0)
+      return run_checked_tests() ? 1 : 0;
+
+   bool analyze = argc>1 && strcmp(argv[1], "--analyze")==0;
+   int first = analyze ? 2 : 1;
+
+   if (argc==first)
    {
       test_str_match_word();
       test_str_match_comment();
       
-      printf("\nUsage: hlindex filetype [,filetype, ...]\n");
+      printf("\nUsage: hlindex [--analyze] filetype [,filetype, ...]\n"
+             "       hlindex --test\n");
       return 1;
    }
    else
    {
-      for (int i=1; i<argc; ++i)
+      for (int i=first; i<argc; ++i)
       {
          const char *tag = argv[i];
          const HLIndex* ndx = HLIndex::get_index(tag);
-         if (ndx)
-            ndx->print(stdout);
-         else
+         if (!ndx)
             printf("We failed to read type %s.\n", tag);
-            
+         else if (analyze)
+            analyze_index(tag, ndx);
+         else
+            ndx->print(stdout);
+      }
+
+      if (analyze)
+      {
+         size_t strings, bytes;
+         HLStringPool::stats(&strings, &bytes);
+         printf("\nString pool, shared by the types: %lu strings, %lu bytes.\n",
+                static_cast<unsigned long>(strings), static_cast<unsigned long>(bytes));
       }
 
 
@@ -1,35 +1,66 @@
-// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -o hlindex hlindex.cpp"  -*-
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -pthread -o hlindex hlindex.cpp -lz"  -*-
 
 #ifndef HLINDEX_HPP
 #define HLINDEX_HPP
 
 #include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include "hlnode.hpp"
+#include "hlregex.hpp"
+#include "hllist.hpp"
+
+struct HLBuiltin;
 
 
 
 
 /**
- * @brief Load and access highlight files.
+ * @brief Parses the text of a highlighting file into a tree of HLNodes.
+ *
+ * The text is parsed in one pass, a line at a time, terminating the tags
+ * and values of the lines in place, so lines may be of any length.  Each
+ * rule and tag line is added to the tree through a stack of the last
+ * node at each level of indentation, rather than by recursion.
+ *
+ * Errors are reported to stderr with the file name and line number, and
+ * the parse continues with the next line.
  */
 class HLParser
 {
 public:
-   HLParser(FILE *f, HLNode *root);
-   ~HLParser() { }
+   HLParser(char *buff, size_t len, HLNode *root, const char *path);
+   ~HLParser();
 
    inline bool hyphenated_tags(void) const  { return m_hyphenated_tags; }
    inline bool case_insensitive(void) const { return m_case_insensitive; }
+   inline bool unicode_letters(void) const  { return m_unicode_letters; }
+
+   /** @brief Type named by an `!include` line, or nullptr if none. */
+   inline const char *include(void) const   { return m_include; }
+
+   /** @brief Number of errors reported while parsing. */
+   inline int error_count(void) const       { return m_error_count; }
 
 private:
-   static char s_read_buff[];
-   static const size_t s_len_buff;
-   
-   FILE *m_file;
+   /** @brief The most recent node at a level of indentation. */
+   struct Frame
+   {
+      HLNode *node;
+      int    level;   /**< Leading white space characters of the node's line. */
+   };
+
+   const char    *m_path;         /**< File name for error messages. */
+   int           m_line_number;   /**< Number of the line being parsed, from 1. */
+   int           m_error_count;
 
-   int  m_cur_level;  /**< Number of leading white space characters of the most recently-read line. */
-   char *m_cur_tag;   /**< Tag name of most recently-read line. */
-   char *m_cur_value; /**< Value of the most recently-read line. */
+   HLList<Frame> m_stack;         /**< Frames of increasing level, the root's first. */
+
+   char          *m_pattern_buff; /**< Escaped copy of the pattern of a pattern line. */
+   size_t        m_pattern_size;
+   char          *m_include;      /**< Type of the `!include` line, if any. */
 
    bool m_hyphenated_tags;  /**< HL-file flag to match words with hyphens.
                              *   Normally, a hyphen is interpreted as a subtraction
@@ -49,64 +80,217 @@ private:
                              *   all tags to lower-case), and while scanning the
                              *   fenced code.
                              */
+   bool m_unicode_letters;  /**< HL-file flag to take non-ASCII letters, in UTF-8,
+                             *   as word characters, so a word in a language that
+                             *   allows them in names is not split at its first
+                             *   non-ASCII letter.
+                             */
 
    // Parsing functions:
 private:
-   inline int level(void) const         { return m_cur_level; }
-   inline const char *tag(void) const   { return m_cur_tag; }
-   inline const char *value(void) const { return m_cur_value; }
+   void report(const char *format, ...) __attribute__((format(printf, 2, 3)));
 
-   /** @brief Indicates that more file data is available. */
-   bool file_ready(void) const { return m_file!=nullptr; }
+   bool set_flag_from_line(const char *str);
+   bool set_include_from_line(const char *str);
+   bool add_pattern_from_line(int level, char *str, char *end);
+   void parse_line(char *line, char *end);
+   void add_node(int level, const char *tag, const char *value);
 
-   bool cur_line_is_node(void) const { return m_cur_tag!=nullptr; }
+   // Delete effc++ requested operators
+   HLParser(const HLParser &)             = delete;
+   HLParser & operator=(const HLParser &) = delete;
+};
 
-   void print_line(int level, const char *name, const char *value);
-   
-   bool set_flag_from_line(const char *str);
-   void process_line(void);
-   bool read_line(void);
 
-   void do_node(HLNode *host, int level);
+class HLIndex;
 
-   
+/**
+ * @brief Hash table of the loaded HLIndex objects, keyed by info string.
+ *
+ * The table uses open addressing with linear probing, and is kept at most
+ * half full.  Each slot holds the full info string, so names of any length
+ * are distinct.
+ *
+ * An alias is an info string that names another info string, for example
+ * `sh` for `bash`.  Both names get a slot, but the slots share a single
+ * HLIndex, which is owned (and deleted) by the slot of the target name.
+ *
+ * Lookups take no lock, so they may run in any number of threads while
+ * one thread at a time, as serialized by the caller, changes the table.
+ * A new slot is filled before its name is published, and its index is
+ * published with an atomic store.  When full, the table is replaced by a
+ * larger copy rather than rehashed in place, and the replaced table is
+ * kept until destruction for lookups that may still be probing it.
+ */
+class HLRegistry
+{
+public:
+   HLRegistry(void) : m_table(nullptr), m_count(0) { }
+   ~HLRegistry();
 
-   // Delete errc++ requested operators
-   HLParser(const HLParser &)             = delete;
-   HLParser & operator=(const HLParser &) = delete;
+   HLIndex *seek(const char *name) const;
+   void add(const char *name, HLIndex *index, bool owner=true);
+   HLIndex *replace(const char *name, HLIndex *index);
+
+   bool claim(const char *name);
+   void set_waiting(const char *name, const char *target);
+   bool waits_for(const char *name, const char *target) const;
+
+   void add_alias(const char *alias, const char *target);
+   const char *seek_alias(const char *alias) const;
+
+   void find_derived(const HLIndex *base, HLList<const char*> &names) const;
+
+private:
+   /** @brief A table entry, empty if @p name is nullptr. */
+   struct Slot
+   {
+      char     *name;    /**< Info string for the entry. */
+      char     *target;  /**< Target name if an alias, nullptr otherwise. */
+      HLIndex  *index;   /**< Index for @p name, if loaded. */
+      unsigned hash;     /**< Hash of @p name, to speed probing and rehashing. */
+      bool     owner;    /**< This slot deletes @p index. */
+      bool     pending;  /**< A thread is loading @p index, see claim(). */
+      const char *waiting; /**< Type the loader of @p index waits for, see set_waiting(). */
+   };
+
+   /** @brief The slots, replaced as a whole when grown. */
+   struct Table
+   {
+      Slot     *slots;
+      unsigned size;      /**< Number of slots, always a power of two. */
+      Table    *previous; /**< Smaller table replaced by this one. */
+   };
+
+   Table    *m_table;    /**< Current table, published atomically. */
+   unsigned m_count;     /**< Number of occupied slots. */
+
+   static unsigned hash_str(const char *str);
+   Slot *find_slot(const char *name, unsigned hash) const;
+   Slot *get_slot(const char *name);
+   void grow(void);
+
+   // Delete effc++ requested operators
+   HLRegistry(const HLRegistry &)             = delete;
+   HLRegistry & operator=(const HLRegistry &) = delete;
 };
 
 
 /**
  * @brief Builds an index from the entries of a highlight file.
  *
- * The class is implemented as a singly-linked list.  Requests for processing
- * specific file types will search the linked indexes for a match, returning
- * the match if found, otherwise returning nullptr.
+ * Indexes are kept in an HLRegistry.  Requests for processing specific file
+ * types will look up the registry for a match, loading the highlighting file
+ * on the first request for the type.
  */
 class HLIndex
 {
+   friend class HLRegistry;
+
 public:
+   /** Word character test, which decides where a word starts and ends. */
+   typedef bool (*Word_Eligible_Char_Func)(int ch);
+
    static const HLIndex* get_index(const char *type);
+   static void add_alias(const char *alias, const char *type);
+   static const char *resolve_alias(const char *type);
+   static void set_builtins(const HLBuiltin *builtins, unsigned count);
+
+   static const char *find_file(const char *type);
+   static int search_dir_count(void);
+   static HLIndex *build(const char *type, const char *path);
+   static const HLIndex *publish(const char *type, HLIndex *index);
+   static void find_dependents(const HLIndex *base, HLList<const char*> &types);
+   static void reclaim(void);
 
 //   inline int count(void) const            { return m_count; }
-   inline int is_empty(void) const         { return m_entries==nullptr && m_comments==nullptr; } 
+
+   /**
+    * @brief Returns true if no highlighting file was found for the index,
+    *        which then has no lines.
+    *
+    * An index whose file was found is not empty even if none of its lines
+    * could be used, as when each of its patterns was rejected.
+    */
+   inline int is_empty(void) const
+   { return m_root->first_child()==nullptr && m_base==nullptr; }
    void print(FILE *f) const;
 
+   inline bool hyphenated_tags(void) const   { return m_hyphenated_tags; }
+   inline bool case_insensitive(void) const  { return m_case_insensitive; }
+   inline bool unicode_letters(void) const   { return m_unicode_letters; }
+
+   /** @brief Word character test of the index, set by its `!ht` and `!ul` flags. */
+   inline Word_Eligible_Char_Func name_char_checker(void) const { return m_name_allow; }
+   inline const HLNode *root(void) const     { return m_root; }
+
+   /** @brief Index of the file named by the `!include` line, or nullptr if none. */
+   inline const HLIndex *base(void) const    { return m_base; }
+
+   /**
+    * @brief Number of rule lines, which number the categories of tags.
+    *
+    * The categories of base() come first, followed by those of this file.
+    */
+   inline int category_count(void) const      { return m_base_category_count + m_category_count; }
+   inline const HLNode *category(int i) const
+   {
+      return i<m_base_category_count ? m_base->category(i) : m_categories[i-m_base_category_count];
+   }
+   int category_of(const HLNode *tag) const;
+
+   /** @brief Number of word tags of this file, without base(), sorted for seek_word(). */
+   inline int word_count(void) const         { return m_last_entry - m_entries; }
+   inline const HLNode *word(int i) const    { return m_entries[i]; }
+   /** @brief Number of comment tags of this file, without base(), sorted for seek_comment(). */
+   inline int comment_count(void) const      { return m_last_comment - m_comments; }
+   inline const HLNode *comment(int i) const { return m_comments[i]; }
+
+   /** @brief Returns true if seek_word() runs a matcher compiled in by hl2cpp. */
+   inline bool has_word_matcher(void) const    { return m_word_matcher!=nullptr; }
+   /** @brief Returns true if seek_comment() runs a matcher compiled in by hl2cpp. */
+   inline bool has_comment_matcher(void) const { return m_comment_matcher!=nullptr; }
+   /** @brief Returns true if seek_word() tests words with a Bloom filter before walking. */
+   inline bool has_word_filter(void) const     { return m_word_filter!=nullptr; }
+   /** @brief Number of bits of the Bloom filter, or 0 if none. */
+   inline unsigned word_filter_bits(void) const { return m_word_filter ? m_word_filter_mask+1 : 0; }
+   unsigned word_filter_bits_set(void) const;
+   /** @brief Number of bits of the Bloom filter tested for each word. */
+   static inline int word_filter_probes(void)  { return WORD_FILTER_PROBES; }
+   /** @brief Number of pattern lines of this file, without base(), in file order for seek_pattern(). */
+   inline int pattern_count(void) const      { return m_pattern_count; }
+   inline const HLNode *pattern(int i) const { return m_patterns[i]; }
+
+   /** @brief Tag of a pattern line, which has the pattern as its value. */
+   static inline bool is_pattern_tag(const char *tag) { return strcmp(tag, "@re")==0; }
+
+   /** @brief Returns true if some pattern could match text starting with @p ch. */
+   inline bool may_start_pattern(int ch) const
+   {
+      return (m_pattern_count && m_regex.may_start(ch)) || (m_base && m_base->may_start_pattern(ch));
+   }
+
    const HLNode *seek(const char *tag) const;
-   const HLNode *seek_word(const char *str) const;
-   const HLNode *seek_comment(const char *str) const;
+   inline const HLNode *seek_word(const char *str) const    { return seek_word(str, m_name_allow); }
+   inline const HLNode *seek_comment(const char *str) const { return seek_comment(str, m_name_allow); }
+   inline const HLNode *seek_pattern(const char *str, int *length) const
+   { return seek_pattern(str, length, m_name_allow); }
 
    static int str_match_sensitive(const char *haystack,
                                   const char *needle,
-                                  bool is_tag);
+                                  bool is_tag,
+                                  Word_Eligible_Char_Func name_allow=simple_name_allow);
    
    static int str_match_insensitive(const char *haystack,
                                     const char *needle,
-                                    bool is_tag);
+                                    bool is_tag,
+                                    Word_Eligible_Char_Func name_allow=simple_name_allow);
 
    static bool simple_name_allow(int ch);
    static bool hyphenated_name_allow(int ch);
+   static bool unicode_name_allow(int ch);
+   static bool unicode_hyphenated_name_allow(int ch);
+   static int unicode_letter_length(const char *str);
 
    /**
     * @brief Returns true if character allowed in a name.
@@ -120,13 +304,38 @@ public:
     * ranges plus one character than it would be to detect white-space + punctuation +
     * mathematical and logical operators.
     *
+    * The characters allowed are those of name_char_checker(), which follows
+    * the flags of this index, so each index scans with its own words.
+    *
     * @param ch Character to consider
     * @returns TRUE if @p ch is an '_' (underscore) or in one of the ranges A-Z, a-z,
     *          or 0-9; FALSE otherwise.
     */
-   static inline bool allowed_in_name(int ch)
+   inline bool allowed_in_name(int ch) const
+   {
+      return (*m_name_allow)(ch);
+   }
+
+   /**
+    * @brief Returns the number of bytes of the name character at @p str,
+    *        or 0 if @p str does not start a name character.
+    *
+    * Unlike allowed_in_name(), which can only report that a non-ASCII byte
+    * may be part of a letter when Unicode letters are allowed, this decodes
+    * the UTF-8 character to decide.
+    */
+   inline int name_char_length(const char *str) const
+   {
+      return name_char_length(str, m_name_allow);
+   }
+
+   /** @brief name_char_length() with the word character test @p name_allow. */
+   static inline int name_char_length(const char *str, Word_Eligible_Char_Func name_allow)
    {
-      return (*s_word_eligible_char_func)(ch);
+      unsigned char ch = *str;
+      if (!(*name_allow)(ch))
+         return 0;
+      return ch<0x80 ? 1 : unicode_letter_length(str);
    }
 
    
@@ -134,60 +343,57 @@ public:
 private:
    HLIndex(HLNode *root,
            bool hyphenated_tags=false,
-           bool case_insensitive=false);
+           bool case_insensitive=false,
+           bool unicode_letters=false,
+           const HLIndex *base=nullptr);
+   HLIndex(const HLBuiltin &builtin);
    ~HLIndex();
 
-   static FILE *find_and_open_file(const char *type);
-   
-   inline bool is_equal(const char *tag) const { return m_root && m_root->is_equal(tag); }
-   static const HLIndex* seek_index(const char *type);
-   static HLIndex *get_last(void);
+   static HLIndex *find_index(const char *type, const char *loading);
+   static HLIndex *load_index(const char *type, const char *path);
+   static const char *follow_aliases(const char *type);
+   static HLIndex *parse_file(const char *type, const char *path, bool claimed);
+   static void delete_unused(HLList<HLIndex*> &indexes);
 
 public:   
    /** Enables switching between case-sensitive and case-insensitive comparisons. */
-   typedef int (*Str_Match_Func)(const char*, const char*, bool is_tag);
+   typedef int (*Str_Match_Func)(const char*, const char*, bool is_tag, Word_Eligible_Char_Func);
 
    static Str_Match_Func get_str_match_func(bool case_sensitive=true)
    {
       return case_sensitive ? str_match_sensitive : str_match_insensitive;
    }
 
-   /** Enabled switching between allowing and not allowing hyphens in names. */
-   typedef bool (*Word_Eligible_Char_Func)(int ch);
-
-   static Word_Eligible_Char_Func get_name_char_checker(void)
+   static Word_Eligible_Char_Func get_name_char_checker(bool allow_hyphens, bool allow_unicode)
    {
-      return s_word_eligible_char_func;
-   }
-   static bool hyphenated_names_allowed(void)
-   {
-      return s_word_eligible_char_func == hyphenated_name_allow;
-   }
-   static void set_hyphenated_names_allowed(bool allow_hyphens = true)
-   {
-      s_word_eligible_char_func = allow_hyphens ? hyphenated_name_allow : simple_name_allow;
-   }
-   static void set_name_char_checker(Word_Eligible_Char_Func f)
-   {
-      s_word_eligible_char_func = f;
+      if (allow_unicode)
+         return allow_hyphens ? unicode_hyphenated_name_allow : unicode_name_allow;
+      else
+         return allow_hyphens ? hyphenated_name_allow : simple_name_allow;
    }
 
 private:
    
-   static HLIndex s_base;   /**< Base object from which searches will start
-                             *   and the destructor will call upon termination
-                             *   of the application.
-                             */
+   static HLRegistry s_registry;  /**< Loaded indexes, whose destructor will
+                                   *   delete the indexes upon termination
+                                   *   of the application.
+                                   */
 
-   /** Function pointer to hyphens-allowed, -not-allowed char comparison function. */
-   static Word_Eligible_Char_Func s_word_eligible_char_func;
-   
-   HLIndex        *m_next;  /**< Pointer to next index.  Not constant because
-                             *   its @p m_index may be changed when a new index
-                             *   is added.
-                             */
+   static HLList<HLIndex*> s_retired;  /**< Indexes replaced by publish(), see reclaim(). */
+
+   static std::mutex              s_mutex;   /**< Serializes changes to s_registry. */
+   static std::condition_variable s_loaded;  /**< Signaled when an index is registered. */
+
+   static const HLBuiltin *s_builtins;     /**< Compiled-in highlighting files. */
+   static unsigned        s_builtin_count; /**< Number of s_builtins elements. */
    
    HLNode   *m_root;        /**< The root HLNode of this file type.  */
+
+   const HLIndex *m_base;   /**< Registered index of the `!include` file, or nullptr. */
+   int      m_base_category_count;  /**< Categories of m_base, numbered before ours. */
+   mutable std::atomic<int> m_derived;  /**< Indexes with this index as m_base,
+                                         *   which must be deleted first.
+                                         */
    
    HLNode** m_entries;      /**< Array of pointers to nodes of m_root. */
    HLNode** m_last_entry;   /**< Used to test out-of-bounds when incrementing. */
@@ -195,14 +401,21 @@ private:
    HLNode** m_comments;
    HLNode** m_last_comment; /**< Used to test out-of-counts when incrementing. */
 
+   HLNode** m_categories;   /**< Rule lines with a tag, in file order. */
+   int      m_category_count;
+
+   HLNode** m_patterns;     /**< Pattern lines, indexed by m_regex pattern number. */
+   int      m_pattern_count;
+   HLRegex  m_regex;        /**< The patterns, combined into a single DFA. */
+
    /**
     * @defgroup HLIndex_Processing_Flags
     *
     * These member variables are flags to contradict the default
     * processing mode.
     *
-    * By default, hyphens are not allowed in tags, and string comparisons are
-    * case-sensitive.
+    * By default, hyphens are not allowed in tags, string comparisons are
+    * case-sensitive, and only ASCII letters are word characters.
     *
     * These flags can be set to change default behavior with !-prefixed lines in
     * the highlighting file.
@@ -210,17 +423,54 @@ private:
     */
    bool m_hyphenated_tags;
    bool m_case_insensitive;
+   bool m_unicode_letters;
    /** @} */
 
    Str_Match_Func m_str_match_func;  /**< Function pointer for either case-sensitive
                                       *   or case-insensitive versions of a string
                                       *   comparison function.
                                       */
-   inline int str_match(const char *haystack, const char *needle, bool is_tag) const
-   { return (*m_str_match_func)(haystack,needle,is_tag); }
+
+   Word_Eligible_Char_Func m_name_allow;  /**< Word character test for the flags. */
+
+   /** Generated function returning the index of the tag matching a string, or -1. */
+   typedef int (*Tag_Match_Func)(const char *str);
+
+   Tag_Match_Func m_word_matcher;     /**< Replaces the m_entries walk if not nullptr. */
+   Tag_Match_Func m_comment_matcher;  /**< Replaces the m_comments walk if not nullptr. */
+
+   /**
+    * @brief Bloom filter of the leading words of the m_entries tags, or nullptr.
+    *
+    * Most words of a document are not tags.  seek_word() hashes the word at
+    * its string once and tests WORD_FILTER_PROBES bits, skipping the walk of
+    * m_entries when any is clear.  A tag with a space or another non-name
+    * character can only match where the word is the part before it, so that
+    * leading word is what the filter holds.
+    */
+   uint64_t *m_word_filter;
+   uint32_t m_word_filter_mask;   /**< Number of bits of m_word_filter, less one. */
+
+   enum
+   {
+      WORD_FILTER_BITS_PER_TAG = 16,  /**< About 0.2% false positives at 3 probes. */
+      WORD_FILTER_PROBES = 3
+   };
+   inline int str_match(const char *haystack, const char *needle, bool is_tag,
+                        Word_Eligible_Char_Func name_allow) const
+   { return (*m_str_match_func)(haystack,needle,is_tag,name_allow); }
+
+   const HLNode *seek_word(const char *str, Word_Eligible_Char_Func name_allow) const;
+   const HLNode *seek_comment(const char *str, Word_Eligible_Char_Func name_allow) const;
+   const HLNode *seek_pattern(const char *str, int *length, Word_Eligible_Char_Func name_allow) const;
 
    int source_count(void);
    void source_scan(void);
+   void build_word_filter(void);
+   bool word_filter_rejects(const char *str, Word_Eligible_Char_Func name_allow) const;
+   static uint64_t hash_word(const char *str, bool fold, Word_Eligible_Char_Func name_allow);
+   void compile_patterns(HLNode **patterns, int count);
+   void index_categories(void);
    
    template <class Func>
    void walk_tags(Func f)
@@ -0,0 +1,37 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -fsyntax-only hllist.hpp"  -*-
+
+/** @file */
+
+#ifndef HLLIST_HPP
+#define HLLIST_HPP
+
+/**
+ * @brief Minimal growable array of POD elements.
+ *
+ * The members are public so that an HLList can be zero-initialized as a
+ * member or aggregate.  The owner of an HLList deletes the `items` array
+ * (and anything the elements point to) when done.
+ */
+template <class T>
+struct HLList
+{
+   T   *items;
+   int count;
+   int size;
+
+   void append(const T &item)
+   {
+      if (count==size)
+      {
+         size = size ? size*2 : 16;
+         T *bigger = new T[size];
+         for (int i=0; i<count; ++i)
+            bigger[i] = items[i];
+         delete [] items;
+         items = bigger;
+      }
+      items[count++] = item;
+   }
+};
+
+#endif
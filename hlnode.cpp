@@ -6,6 +6,119 @@
 #include <string.h>
 #include "hlnode.hpp"
 
+HLStringPool HLStringPool::s_pool;
+
+/** @brief FNV-1a hash of the @p len characters of @p str. */
+unsigned HLStringPool::hash_str(const char *str, size_t len)
+{
+   unsigned hash = 2166136261u;
+   for (size_t i=0; i<len; ++i)
+   {
+      hash ^= static_cast<unsigned char>(str[i]);
+      hash *= 16777619u;
+   }
+   return hash;
+}
+
+/**
+ * @brief Returns the pooled copy of the @p len characters of @p str.
+ *
+ * The copy is terminated, and must be released with release().
+ */
+const char *HLStringPool::intern(const char *str, size_t len)
+{
+   unsigned hash = hash_str(str, len);
+
+   std::lock_guard<std::mutex> lock(s_pool.m_mutex);
+
+   if (s_pool.m_bucket_count)
+   {
+      Entry *entry = s_pool.m_buckets[hash & (s_pool.m_bucket_count-1)];
+      for (; entry; entry=entry->next)
+      {
+         if (entry->hash==hash && entry->len==len && memcmp(chars(entry), str, len)==0)
+         {
+            ++entry->refs;
+            return chars(entry);
+         }
+      }
+   }
+
+   if (s_pool.m_count >= s_pool.m_bucket_count)
+      s_pool.grow();
+
+   // The characters follow the header in the same block:
+   Entry *entry = reinterpret_cast<Entry*>(new char[sizeof(Entry) + len + 1]);
+   entry->hash = hash;
+   entry->refs = 1;
+   entry->len = len;
+   memcpy(chars(entry), str, len);
+   chars(entry)[len] = '\0';
+
+   Entry *&bucket = s_pool.m_buckets[hash & (s_pool.m_bucket_count-1)];
+   entry->next = bucket;
+   bucket = entry;
+
+   ++s_pool.m_count;
+   s_pool.m_bytes += len + 1;
+   return chars(entry);
+}
+
+/** @brief Release a reference to @p str from intern(), freeing it with the last. */
+void HLStringPool::release(const char *str)
+{
+   if (!str)
+      return;
+
+   Entry *entry = reinterpret_cast<Entry*>(const_cast<char*>(str)) - 1;
+
+   std::lock_guard<std::mutex> lock(s_pool.m_mutex);
+   if (--entry->refs)
+      return;
+
+   Entry **link = &s_pool.m_buckets[entry->hash & (s_pool.m_bucket_count-1)];
+   while (*link!=entry)
+      link = &(*link)->next;
+   *link = entry->next;
+
+   --s_pool.m_count;
+   s_pool.m_bytes -= entry->len + 1;
+   delete [] reinterpret_cast<char*>(entry);
+}
+
+/** @brief Report the number of distinct pooled strings, and their characters. */
+void HLStringPool::stats(size_t *strings, size_t *bytes)
+{
+   std::lock_guard<std::mutex> lock(s_pool.m_mutex);
+   *strings = s_pool.m_count;
+   *bytes = s_pool.m_bytes;
+}
+
+/** @brief Double the buckets, keeping a load factor of at most one. */
+void HLStringPool::grow(void)
+{
+   unsigned count = m_bucket_count ? m_bucket_count*2 : 256;
+   Entry **buckets = new Entry*[count];
+   memset(buckets, 0, count*sizeof(Entry*));
+
+   for (unsigned i=0; i<m_bucket_count; ++i)
+   {
+      Entry *entry = m_buckets[i];
+      while (entry)
+      {
+         Entry *next = entry->next;
+         Entry *&bucket = buckets[entry->hash & (count-1)];
+         entry->next = bucket;
+         bucket = entry;
+         entry = next;
+      }
+   }
+
+   delete [] m_buckets;
+   m_buckets = buckets;
+   m_bucket_count = count;
+}
+
 HLNode::HLNode(const char *tag, const char *value, HLNode *parent)
    : m_parent(parent), m_child(nullptr), m_sibling(nullptr),
      m_tag(save_str(tag)), m_value(save_str(value))
@@ -14,13 +127,26 @@ HLNode::HLNode(const char *tag, const char *value, HLNode *parent)
 
 HLNode::~HLNode()
 {
-   // delete down, then right:
-   delete m_child;
-   delete m_sibling;
+   // delete down, then right, a list at a time rather than recursing
+   // once per sibling, so a long list of tags cannot exhaust the stack:
+   delete_list(m_child);
+   delete_list(m_sibling);
+
+   // release strings
+   HLStringPool::release(m_tag);
+   HLStringPool::release(m_value);
+}
 
-   // delete strings
-   delete [] m_tag;
-   delete [] m_value;
+/** @brief Delete @p node and the siblings following it, one after another. */
+void HLNode::delete_list(HLNode *node)
+{
+   while (node)
+   {
+      HLNode *next = node->m_sibling;
+      node->m_sibling = nullptr;
+      delete node;
+      node = next;
+   }
 }
 
 /**
@@ -40,6 +166,41 @@ HLNode *HLNode::last_sibling(void)
    return node;
 }
 
+/**
+ * @brief A heap buffer reused by the string conversions of one thread.
+ *
+ * A tag or value may be as long as its line, which is not limited, so
+ * its converted copy is not made on the stack.
+ */
+class HLScratchBuffer
+{
+public:
+   HLScratchBuffer(void) : m_buff(nullptr), m_size(0) { }
+   ~HLScratchBuffer()                      { delete [] m_buff; }
+
+   /** @brief Returns the buffer, grown to hold at least @p size characters. */
+   char *get(size_t size)
+   {
+      if (size > m_size)
+      {
+         delete [] m_buff;
+         m_size = size > 2*m_size ? size : 2*m_size;
+         m_buff = new char[m_size];
+      }
+      return m_buff;
+   }
+
+private:
+   char   *m_buff;
+   size_t m_size;
+
+   // Delete effc++ requested operators
+   HLScratchBuffer(const HLScratchBuffer &)             = delete;
+   HLScratchBuffer & operator=(const HLScratchBuffer &) = delete;
+};
+
+static thread_local HLScratchBuffer s_scratch;
+
 /**
  * @brief Convert the tag to a lower-case string.
  *
@@ -48,18 +209,33 @@ HLNode *HLNode::last_sibling(void)
  * could have converted the tag strings to lower case when originally saving them,
  * we don't want to disturb the rule lines, where the tag or the class names may be
  * mixed case words.
+ *
+ * The tag may be shared with other nodes, so a lower-case tag is interned
+ * in its place rather than converted in place.
  */
 void HLNode::tag_to_lower_case(void)
 {
    if (m_tag)
    {
-      char *p = m_tag;
-      while (*p)
+      size_t len = strlen(m_tag);
+      char *lower = s_scratch.get(len+1);
+      bool changed = false;
+      for (size_t i=0; i<=len; ++i)
       {
-         if (*p>=65 && *p<=90)
-            *p += 32;
+         char ch = m_tag[i];
+         if (ch>=65 && ch<=90)
+         {
+            ch += 32;
+            changed = true;
+         }
+         lower[i] = ch;
+      }
 
-         ++p;
+      if (changed)
+      {
+         const char *tag = HLStringPool::intern(lower, len);
+         HLStringPool::release(m_tag);
+         m_tag = tag;
       }
    }
 }
@@ -107,19 +283,18 @@ HLNode *HLNode::seek_sibling(const char *tag)
 /**
  * @brief Returns a escape-resolved copy of a string.
  *
- * Creates a new string (using `new` operator) containing the escape-resolved
- * characters in the parameter @p str.  The string must be `delete`d to prevent
- * a memory leak.
+ * The escape-resolved characters of @p str are interned in HLStringPool,
+ * so nodes with the same string share one copy.
  *
  * @param str String to be converted and copied.
- * @return Converted string.  The returned string must be `delete`d to
- *         prevent a memory leak
+ * @return Converted string, or nullptr if empty.  The returned string must
+ *         be released with HLStringPool::release().
  *
  * @sa walk_str
  */
-char *HLNode::save_str(const char *str)
+const char *HLNode::save_str(const char *str)
 {
-   char *rval = nullptr;
+   const char *rval = nullptr;
    
    if (str)
    {
@@ -135,15 +310,15 @@ char *HLNode::save_str(const char *str)
       walk_str(str, fcount);
 //@ [walk_str_count_characters]
 
-      // If any characters, allocate memory for the string
-      // and fill it with the escaped-resolved characters.
+      // If any characters, fill a buffer with the escape-resolved
+      // characters, and intern them.
       if (len>0)
       {
 //@ [walk_str_copy_characters]
          // Size buffer using `len` counted in previous call to walk_str
-         rval = new char[len+1];
+         char *buff = s_scratch.get(len+1);
          // Copy of pointer to walk the buffer:
-         char *p = rval;
+         char *p = buff;
          // lambda function to serve as callback:
          auto fcopy = [&p](int ch)
             {
@@ -155,6 +330,8 @@ char *HLNode::save_str(const char *str)
          // terminate string:
          *p = '\0';
 //@ [walk_str_copy_characters]
+
+         rval = HLStringPool::intern(buff, len);
       }
    }
    return rval;
@@ -223,11 +400,11 @@ HLTree::~HLTree()
 /** Call the save_str() function with the string in `str` and display the result. */
 void save_a_string(const char *str)
 {
-   char *result = HLNode::save_str(str);
+   const char *result = HLNode::save_str(str);
    if (result)
    {
       printf("\"%s\" -> \"%s\"\n", str, result);
-      delete [] result;
+      HLStringPool::release(result);
    }
    else
       printf("\"%s\" was not translatable.\n", str);
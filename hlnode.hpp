@@ -6,6 +6,7 @@
 #define HLNODE_HPP
 
 #include <string.h>
+#include <mutex>
 
 /**
  * @brief Walks through a string, one escape-resolved char at a time.
@@ -59,6 +60,56 @@ void walk_str(const char *str, F f)
 }
 
 
+/**
+ * @brief Process-wide pool of the strings of HLNodes, holding each distinct string once.
+ *
+ * Tags repeated across highlighting files, and rules like `span.keyword`
+ * found in nearly every file, are stored once however many indexes are
+ * loaded.  Each string counts its references, and is freed with its last
+ * reference, so reloading highlighting files does not grow the pool.
+ *
+ * The pool is constant-initialized and never destroyed, so HLNodes deleted
+ * by static destructors at exit may still release their strings.
+ */
+class HLStringPool
+{
+public:
+   static const char *intern(const char *str, size_t len);
+   static void release(const char *str);
+
+   static void stats(size_t *strings, size_t *bytes);
+
+private:
+   /** @brief Header of a pooled string, whose characters follow it. */
+   struct Entry
+   {
+      Entry    *next;     /**< Next entry of the same bucket. */
+      unsigned hash;
+      unsigned refs;
+      size_t   len;
+   };
+
+   std::mutex m_mutex;
+   Entry      **m_buckets;
+   unsigned   m_bucket_count;   /**< Power of two, or 0 before the first string. */
+   unsigned   m_count;
+   size_t     m_bytes;          /**< Characters of the pooled strings, with terminators. */
+
+   static HLStringPool s_pool;
+
+   constexpr HLStringPool(void)
+      : m_mutex(), m_buckets(nullptr), m_bucket_count(0), m_count(0), m_bytes(0) { }
+
+   void grow(void);
+
+   static inline char *chars(Entry *entry)  { return reinterpret_cast<char*>(entry+1); }
+   static unsigned hash_str(const char *str, size_t len);
+
+   // Delete effc++ requested operators
+   HLStringPool(const HLStringPool &)             = delete;
+   HLStringPool & operator=(const HLStringPool &) = delete;
+};
+
 /**
  * @brief Class to hold one line of the Highlight file, with pointers to relatives.
  *
@@ -110,15 +161,16 @@ public:
    inline       HLNode *seek_child(const char *tag)         { return m_child ? m_child->seek_sibling(tag) : nullptr; }
    inline const HLNode *seek_child(const char *tag) const   { return const_cast<const HLNode*>(seek_child(tag)); }
 
-   static char * save_str(const char *str);
+   static const char *save_str(const char *str);
 
 private:
    HLNode *m_parent;
    HLNode *m_child;
    HLNode *m_sibling;
-   char   *m_tag;    /**< This private variable is @e not const for flexibility. */
-   char   *m_value;  /**< This private variable is @e not const for flexibility. */
+   const char *m_tag;    /**< Interned in HLStringPool, shared with other nodes. */
+   const char *m_value;  /**< Interned in HLStringPool, shared with other nodes. */
 
+   static void delete_list(HLNode *node);
    static void print_indent(FILE *f, int level);
    void priv_print(FILE *fout, int level=0) const;
 
@@ -0,0 +1,394 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -DEXCLUDE_TESTS -c -o hlpath.o hlpath.cpp"  -*-
+
+/** @file */
+
+#include "hlpath.hpp"
+
+#include <stdlib.h>     // for getenv(), realpath(), qsort(), bsearch()
+#include <string.h>
+#include <limits.h>     // for PATH_MAX
+#include <unistd.h>     // for getpid()
+#include <dirent.h>     // for opendir(), readdir()
+#include <sys/stat.h>   // for stat(), mkdir()
+#include <zlib.h>       // for gzopen()
+
+/** Identifies the cache file format, the first line of the file. */
+static const char cache_header[] = "fencedfilter-hlpath 1";
+
+HLPath HLPath::s_path;
+
+HLPath::HLPath(void)
+   : m_cl_dirs(), m_dirs(), m_entries(),
+     m_prepared(false), m_dirty(false), m_compress_cache(false)
+{
+}
+
+/** Destructor saves the cache file if it has become stale. */
+HLPath::~HLPath()
+{
+   if (m_dirty)
+      save_cache();
+
+   for (int i=0; i<m_cl_dirs.count; ++i)
+      delete [] m_cl_dirs.items[i];
+   for (int i=0; i<m_dirs.count; ++i)
+      delete [] m_dirs.items[i].path;
+   for (int i=0; i<m_entries.count; ++i)
+   {
+      delete [] m_entries.items[i].name;
+      delete [] m_entries.items[i].path;
+   }
+
+   delete [] m_cl_dirs.items;
+   delete [] m_dirs.items;
+   delete [] m_entries.items;
+}
+
+/**
+ * @brief Add a colon-separated list of directories to the search path.
+ *
+ * The directories are searched after the current directory and before
+ * the directories in `FENCEDFILTER_HL_PATH`.  Directories must be added
+ * before the first call to find().
+ */
+void HLPath::add_search_dirs(const char *dirs)
+{
+   size_t len = strlen(dirs);
+   s_path.m_cl_dirs.append(dup_str(dirs, len));
+}
+
+/**
+ * @brief Returns the path to the highlighting file for @p type.
+ *
+ * @param type The info string of a fenced code block.
+ * @return Path to `<type>.hl` in the first search path directory holding
+ *         such a file, or nullptr if none do.
+ */
+const char *HLPath::find(const char *type)
+{
+   HLPath &hp = s_path;
+   if (!hp.m_prepared)
+      hp.prepare();
+
+   Entry key = { const_cast<char*>(type), nullptr, -1 };
+   const Entry *found = static_cast<const Entry*>(bsearch(&key,
+                                                          hp.m_entries.items,
+                                                          hp.m_entries.count,
+                                                          sizeof(Entry),
+                                                          entry_sorter));
+   if (found)
+   {
+      // Back up to the earliest directory holding the name:
+      while (found > hp.m_entries.items && strcmp((found-1)->name, type)==0)
+         --found;
+
+      return found->path;
+   }
+
+   return nullptr;
+}
+
+/** @brief Returns the number of directories in the search path. */
+int HLPath::dir_count(void)
+{
+   HLPath &hp = s_path;
+   if (!hp.m_prepared)
+      hp.prepare();
+
+   return hp.m_dirs.count;
+}
+
+/** @brief Returns the absolute path of search path directory @p i, in search order. */
+const char *HLPath::dir(int i)
+{
+   return s_path.m_dirs.items[i].path;
+}
+
+/**
+ * @brief Build the search path and its index of highlighting files.
+ *
+ * Directories whose listings are in the cache file with an unchanged
+ * modification time are not listed again.
+ */
+void HLPath::prepare(void)
+{
+   m_prepared = true;
+
+   add_dir(".", 1);
+   for (int i=0; i<m_cl_dirs.count; ++i)
+      add_dir_list(m_cl_dirs.items[i]);
+   add_dir_list(getenv("FENCEDFILTER_HL_PATH"));
+
+   bool *reused = new bool[m_dirs.count+1];
+   memset(reused, 0, m_dirs.count+1);
+
+   char buff[PATH_MAX];
+   const char *cache_path = cache_file(buff, sizeof(buff));
+   if (!cache_path || !load_cache(cache_path, reused))
+      m_dirty = true;
+
+   for (int i=0; i<m_dirs.count; ++i)
+   {
+      if (!reused[i])
+      {
+         list_dir(i);
+         m_dirty = true;
+      }
+   }
+
+   delete [] reused;
+
+   // The cache is only written if enabled:
+   if (!cache_path)
+      m_dirty = false;
+
+   qsort(m_entries.items, m_entries.count, sizeof(Entry), entry_sorter);
+}
+
+/** @brief Add a directory to the search path if it exists and is new. */
+void HLPath::add_dir(const char *dir, size_t len)
+{
+   if (len==0 || len>=PATH_MAX)
+      return;
+
+   char name[PATH_MAX];
+   memcpy(name, dir, len);
+   name[len] = '\0';
+
+   char resolved[PATH_MAX];
+   struct stat st;
+   if (!realpath(name, resolved) || stat(resolved, &st) || !S_ISDIR(st.st_mode))
+      return;
+
+   for (int i=0; i<m_dirs.count; ++i)
+      if (strcmp(m_dirs.items[i].path, resolved)==0)
+         return;
+
+   Dir d = { dup_str(resolved, strlen(resolved)), st.st_mtim.tv_sec, st.st_mtim.tv_nsec };
+   m_dirs.append(d);
+}
+
+/** @brief Add each directory of a colon-separated list to the search path. */
+void HLPath::add_dir_list(const char *dirs)
+{
+   if (!dirs)
+      return;
+
+   const char *p = dirs;
+   while (true)
+   {
+      const char *colon = strchr(p, ':');
+      if (!colon)
+      {
+         add_dir(p, strlen(p));
+         break;
+      }
+
+      add_dir(p, colon-p);
+      p = colon+1;
+   }
+}
+
+/**
+ * @brief Read the cache file, taking listings of unchanged directories.
+ *
+ * @param cache_path Path to the cache file.
+ * @param dir_reused Array, indexed like m_dirs, set true for each directory
+ *                   whose cached listing is still valid.
+ * @return TRUE if the cache is valid for the whole search path, FALSE if
+ *         the cache is missing or any directory must be listed again.
+ */
+bool HLPath::load_cache(const char *cache_path, bool *dir_reused)
+{
+   // zlib reads a cache file that is not gzipped unchanged:
+   gzFile f = gzopen(cache_path, "rb");
+   if (!f)
+      return false;
+
+   char line[PATH_MAX+64];
+   size_t len;
+
+   int dirs_read = 0;
+   int dir = -1;         // Index in m_dirs of the current D record.
+   bool valid = false;
+
+   if (gzgets(f, line, sizeof(line))
+       && strncmp(line, cache_header, sizeof(cache_header)-1)==0)
+   {
+      valid = true;
+      while (gzgets(f, line, sizeof(line)) && (len=strlen(line))>2)
+      {
+         if (line[len-1]=='\n')
+            line[--len] = '\0';
+
+         const char *arg = line+2;
+         switch(*line)
+         {
+            case 'D':
+            {
+               long long sec;
+               long nsec;
+               int used;
+               dir = -1;
+               if (sscanf(arg, "%lld %ld %n", &sec, &nsec, &used)==2)
+               {
+                  const char *path = arg+used;
+                  // Only a directory in the same position of the search path is reused:
+                  if (dirs_read < m_dirs.count)
+                  {
+                     const Dir &d = m_dirs.items[dirs_read];
+                     if (strcmp(d.path, path)==0 && d.mtime==sec && d.mtime_ns==nsec)
+                        dir_reused[dir=dirs_read] = true;
+                  }
+               }
+
+               if (dir<0)
+                  valid = false;
+
+               ++dirs_read;
+               break;
+            }
+            case 'F':
+               if (dir>=0)
+                  add_entry(arg, strlen(arg), dir);
+               break;
+         }
+      }
+   }
+
+   gzclose(f);
+
+   return valid && dirs_read==m_dirs.count;
+}
+
+/**
+ * @brief Write the directory listings to the cache file.
+ *
+ * The cache is written to a temporary file, then renamed, so that
+ * concurrent runs never read a partial cache.
+ */
+void HLPath::save_cache(void) const
+{
+   char cache_path[PATH_MAX];
+   if (!cache_file(cache_path, sizeof(cache_path)))
+      return;
+
+   // Make the cache directory and any missing parents:
+   for (char *p = strchr(cache_path+1, '/'); p; p = strchr(p+1, '/'))
+   {
+      *p = '\0';
+      mkdir(cache_path, 0755);
+      *p = '/';
+   }
+
+   char temp_path[PATH_MAX+32];
+   snprintf(temp_path, sizeof(temp_path), "%s.%d", cache_path, static_cast<int>(getpid()));
+
+   // Mode "T" writes without compression:
+   gzFile f = gzopen(temp_path, m_compress_cache ? "wb" : "wbT");
+   if (!f)
+      return;
+
+   gzprintf(f, "%s\n", cache_header);
+   for (int i=0; i<m_dirs.count; ++i)
+   {
+      const Dir &d = m_dirs.items[i];
+      gzprintf(f, "D %lld %ld %s\n", static_cast<long long>(d.mtime), d.mtime_ns, d.path);
+      for (int j=0; j<m_entries.count; ++j)
+         if (m_entries.items[j].dir==i)
+            gzprintf(f, "F %s\n", m_entries.items[j].name);
+   }
+
+   if (gzclose(f)==Z_OK)
+      rename(temp_path, cache_path);
+   else
+      remove(temp_path);
+}
+
+/** @brief Read directory @p dir of the search path for highlighting files. */
+void HLPath::list_dir(int dir)
+{
+   DIR *d = opendir(m_dirs.items[dir].path);
+   if (!d)
+      return;
+
+   struct dirent *de;
+   while ((de=readdir(d)))
+   {
+      size_t len = strlen(de->d_name);
+      if (len>3 && strcmp(de->d_name+len-3, ".hl")==0)
+         add_entry(de->d_name, len-3, dir);
+   }
+
+   closedir(d);
+}
+
+/** @brief Add highlighting file @p name (without extension) in directory @p dir. */
+void HLPath::add_entry(const char *name, size_t len, int dir)
+{
+   const char *dirpath = m_dirs.items[dir].path;
+   size_t dirlen = strlen(dirpath);
+
+   // Room for the directory, '/', the name, ".hl" and '\0':
+   char *path = new char[dirlen+len+5];
+   char *p = path;
+   memcpy(p, dirpath, dirlen);
+   p += dirlen;
+   *p++ = '/';
+   memcpy(p, name, len);
+   p += len;
+   memcpy(p, ".hl", 4);
+
+   Entry e = { dup_str(name, len), path, dir };
+   m_entries.append(e);
+}
+
+/**
+ * @brief Write the path of the cache file to @p buff.
+ *
+ * @return @p buff, or nullptr if caching is disabled or no
+ *         cache location is available.
+ */
+const char *HLPath::cache_file(char *buff, size_t len)
+{
+   const char *name = getenv("FENCEDFILTER_CACHE");
+   if (name)
+   {
+      if (!*name || strlen(name)>=len)
+         return nullptr;
+
+      strcpy(buff, name);
+      return buff;
+   }
+
+   int count;
+   if ((name=getenv("XDG_CACHE_HOME")) && *name)
+      count = snprintf(buff, len, "%s/fencedfilter/hlpath.cache", name);
+   else if ((name=getenv("HOME")) && *name)
+      count = snprintf(buff, len, "%s/.cache/fencedfilter/hlpath.cache", name);
+   else
+      return nullptr;
+
+   return (count>0 && static_cast<size_t>(count)<len) ? buff : nullptr;
+}
+
+/** @brief Returns a `new`ed, '\0'-terminated copy of @p len chars of @p str. */
+char *HLPath::dup_str(const char *str, size_t len)
+{
+   char *rval = new char[len+1];
+   memcpy(rval, str, len);
+   rval[len] = '\0';
+   return rval;
+}
+
+/** @brief Sort entries by name, then by search order of their directories. */
+int HLPath::entry_sorter(const void *lh, const void *rh)
+{
+   const Entry *lhe = static_cast<const Entry*>(lh);
+   const Entry *rhe = static_cast<const Entry*>(rh);
+   int rval = strcmp(lhe->name, rhe->name);
+   if (rval==0 && lhe->dir>=0 && rhe->dir>=0)
+      rval = lhe->dir - rhe->dir;
+
+   return rval;
+}
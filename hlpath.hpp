@@ -0,0 +1,98 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -DEXCLUDE_TESTS -c -o hlpath.o hlpath.cpp"  -*-
+
+/** @file */
+
+#ifndef HLPATH_HPP
+#define HLPATH_HPP
+
+#include <stdio.h>
+#include <time.h>
+#include "hllist.hpp"
+
+/**
+ * @brief Locates highlighting files along a search path.
+ *
+ * The search path is the current directory, followed by the directories
+ * named with the `--hl-path` command line option, followed by the
+ * directories in the `FENCEDFILTER_HL_PATH` environment variable.  Like
+ * `PATH`, the option and the environment variable are colon-separated
+ * directory lists.  A highlighting file in an earlier directory hides a
+ * file of the same name in a later directory.
+ *
+ * The first request for a highlighting file lists every directory in the
+ * search path once, building an index of `.hl` file names to paths.  No
+ * further requests touch the file system.
+ *
+ * The directory listings are saved to a cache file and reused by later
+ * runs as long as the modification times of the directories are
+ * unchanged.  A name missing from the listings is known not to be found
+ * without touching the file system, so misses are not cached.  Set
+ * `FENCEDFILTER_CACHE` to the cache file path, or to an empty string to
+ * disable the cache.  The default cache file is
+ * `$XDG_CACHE_HOME/fencedfilter/hlpath.cache`, or
+ * `$HOME/.cache/fencedfilter/hlpath.cache` if `XDG_CACHE_HOME` is not set.
+ * The cache file may be gzipped, see set_compressed_cache().
+ */
+class HLPath
+{
+public:
+   static void add_search_dirs(const char *dirs);
+   static const char *find(const char *type);
+   static int dir_count(void);
+   static const char *dir(int i);
+
+   /** @brief Write the cache file gzipped, which is read either way. */
+   static inline void set_compressed_cache(bool compress) { s_path.m_compress_cache = compress; }
+
+   ~HLPath();
+
+private:
+   HLPath(void);
+
+   /** @brief A directory of the search path. */
+   struct Dir
+   {
+      char   *path;     /**< Absolute path of the directory. */
+      time_t mtime;     /**< Modification time when listed. */
+      long   mtime_ns;  /**< Nanosecond part of the modification time. */
+   };
+
+   /** @brief A highlighting file found in a search path directory. */
+   struct Entry
+   {
+      char *name;       /**< File name without the `.hl` extension. */
+      char *path;       /**< Path to the file. */
+      int  dir;         /**< Index of the directory in the search path. */
+   };
+
+   static HLPath s_path;     /**< The single instance, which saves the cache
+                              *   when destroyed upon termination of the
+                              *   application.
+                              */
+
+   HLList<char*> m_cl_dirs;  /**< Directories added with add_search_dirs(). */
+   HLList<Dir>   m_dirs;     /**< Search path, in search order. */
+   HLList<Entry> m_entries;  /**< Highlighting files, sorted by name. */
+
+   bool m_prepared;          /**< Search path has been listed or loaded. */
+   bool m_dirty;             /**< Cache file needs to be rewritten. */
+   bool m_compress_cache;    /**< Write the cache file with gzip. */
+
+   void prepare(void);
+   void add_dir(const char *dir, size_t len);
+   void add_dir_list(const char *dirs);
+   bool load_cache(const char *cache_path, bool *dir_reused);
+   void save_cache(void) const;
+   void list_dir(int dir);
+   void add_entry(const char *name, size_t len, int dir);
+
+   static const char *cache_file(char *buff, size_t len);
+   static char *dup_str(const char *str, size_t len);
+   static int entry_sorter(const void *lh, const void *rh);
+
+   // Delete effc++ requested operators
+   HLPath(const HLPath &)             = delete;
+   HLPath & operator=(const HLPath &) = delete;
+};
+
+#endif
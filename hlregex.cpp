@@ -0,0 +1,785 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -DEXCLUDE_TESTS -c -o hlregex.o hlregex.cpp"  -*-
+
+/** @file */
+
+#include "hlregex.hpp"
+
+#include <string.h>
+#include <stdlib.h>   // for qsort()
+
+HLRegex::HLRegex(void)
+   : m_states(), m_sets(), m_starts(), m_marks(),
+     m_p(nullptr), m_ci(false), m_error(nullptr),
+     m_trans(nullptr), m_accept(nullptr), m_dfa_count(0), m_first()
+{
+}
+
+HLRegex::~HLRegex()
+{
+   delete [] m_states.items;
+   delete [] m_sets.items;
+   delete [] m_starts.items;
+   delete [] m_marks.items;
+   delete [] m_trans;
+   delete [] m_accept;
+}
+
+/**
+ * @brief Parse @p pattern and add it to the set.
+ *
+ * Patterns are numbered in the order they are added, starting with 0.
+ * A pattern that fails to parse is not added, and does not take a number.
+ *
+ * @param pattern          The regular expression.
+ * @param case_insensitive Match letters of either case.
+ * @return TRUE if the pattern was added, FALSE if it is malformed, with
+ *         the reason available from error().
+ */
+bool HLRegex::add(const char *pattern, bool case_insensitive)
+{
+   int saved_states = m_states.count;
+   int saved_sets = m_sets.count;
+
+   m_p = pattern;
+   m_ci = case_insensitive;
+   m_error = nullptr;
+
+   Frag f;
+   bool ok = parse_alt(f);
+   if (ok && *m_p)
+      ok = fail("unmatched ')'");
+   if (ok && m_states.count > MAX_NFA_STATES)
+      ok = fail("pattern too large");
+
+   if (!ok)
+   {
+      m_states.count = saved_states;
+      m_sets.count = saved_sets;
+      return false;
+   }
+
+   int match = new_state(N_MATCH);
+   m_states.items[match].id = m_starts.count;
+   patch(f.outs, match);
+   m_starts.append(f.start);
+
+   Mark mark = { saved_states, saved_sets };
+   m_marks.append(mark);
+
+   return true;
+}
+
+/**
+ * @brief Remove the pattern added last, as when it makes the patterns too
+ *        complex to compile().
+ *
+ * compile() must be called again before match().
+ */
+void HLRegex::remove_last(void)
+{
+   if (!m_starts.count)
+      return;
+
+   const Mark &mark = m_marks.items[--m_marks.count];
+   m_states.count = mark.states;
+   m_sets.count = mark.sets;
+   --m_starts.count;
+}
+
+/** @brief Add an NFA state, returning its index. */
+int HLRegex::new_state(int op, int out, int out1, int set)
+{
+   NFA_State s = { op, out, out1, set, -1 };
+   m_states.append(s);
+   return m_states.count - 1;
+}
+
+/** @brief Save a byte set, returning its index. */
+int HLRegex::new_set(const Byte_Set &set)
+{
+   m_sets.append(set);
+   return m_sets.count - 1;
+}
+
+/** @brief Returns the `out` or `out1` member referred to by exit list link @p ref. */
+int &HLRegex::exit_ref(int ref)
+{
+   NFA_State &s = m_states.items[ref>>1];
+   return (ref&1) ? s.out1 : s.out;
+}
+
+/** @brief Connect every exit in the list @p outs to state @p target. */
+void HLRegex::patch(int outs, int target)
+{
+   while (outs!=-1)
+   {
+      int &ref = exit_ref(outs);
+      outs = ref;
+      ref = target;
+   }
+}
+
+/** @brief Returns an exit list of the exits of @p outs1 followed by those of @p outs2. */
+int HLRegex::join(int outs1, int outs2)
+{
+   if (outs1==-1)
+      return outs2;
+
+   int ref = outs1;
+   while (exit_ref(ref)!=-1)
+      ref = exit_ref(ref);
+   exit_ref(ref) = outs2;
+
+   return outs1;
+}
+
+/** @brief Returns a fragment matching one character of @p set. */
+HLRegex::Frag HLRegex::set_frag(const Byte_Set &set)
+{
+   int s = new_state(N_SET, -1, -1, new_set(set));
+   Frag f = { s, s<<1 };
+   return f;
+}
+
+/** @brief Returns a fragment matching @p lh followed by @p rh. */
+HLRegex::Frag HLRegex::concat(const Frag &lh, const Frag &rh)
+{
+   patch(lh.outs, rh.start);
+   Frag f = { lh.start, rh.outs };
+   return f;
+}
+
+/** @brief Parse alternatives separated by `|`. */
+bool HLRegex::parse_alt(Frag &f)
+{
+   if (!parse_concat(f))
+      return false;
+
+   while (*m_p=='|')
+   {
+      ++m_p;
+      Frag rh;
+      if (!parse_concat(rh))
+         return false;
+
+      int s = new_state(N_SPLIT, f.start, rh.start);
+      f.start = s;
+      f.outs = join(f.outs, rh.outs);
+   }
+
+   return true;
+}
+
+/** @brief Parse a sequence of repeated atoms, up to `|`, `)`, or the end. */
+bool HLRegex::parse_concat(Frag &f)
+{
+   bool empty = true;
+   while (*m_p && *m_p!='|' && *m_p!=')')
+   {
+      Frag next;
+      if (!parse_repeat(next))
+         return false;
+
+      f = empty ? next : concat(f, next);
+      empty = false;
+   }
+
+   if (empty)
+   {
+      int s = new_state(N_EPS);
+      f.start = s;
+      f.outs = s<<1;
+   }
+
+   return true;
+}
+
+/** @brief Parse a decimal repetition count. */
+bool HLRegex::parse_count(int &count)
+{
+   if (*m_p<'0' || *m_p>'9')
+      return fail("bad repetition count");
+
+   count = 0;
+   while (*m_p>='0' && *m_p<='9')
+   {
+      count = count*10 + (*m_p++ - '0');
+      if (count > MAX_REPEAT)
+         return fail("repetition count too large");
+   }
+
+   return true;
+}
+
+/**
+ * @brief Parse an atom followed by any number of repetition operators.
+ *
+ * A bounded repetition like `{2,4}` needs several copies of the atom's
+ * NFA, which are made by parsing the atom again.  The size of the copies
+ * is checked against MAX_NFA_STATES before they are made, as nested
+ * repetitions would otherwise grow exponentially.
+ */
+bool HLRegex::parse_repeat(Frag &f)
+{
+   const char *atom = m_p;
+   int atom_states = m_states.count;
+   if (!parse_atom(f))
+      return false;
+   const char *atom_end = m_p;
+
+   while (true)
+   {
+      int s;
+      switch (*m_p)
+      {
+         case '*':
+            s = new_state(N_SPLIT, f.start);
+            patch(f.outs, s);
+            f.start = s;
+            f.outs = (s<<1)|1;
+            break;
+
+         case '+':
+            s = new_state(N_SPLIT, f.start);
+            patch(f.outs, s);
+            f.outs = (s<<1)|1;
+            break;
+
+         case '?':
+            s = new_state(N_SPLIT, f.start);
+            f.start = s;
+            f.outs = join(f.outs, (s<<1)|1);
+            break;
+
+         case '{':
+         {
+            // A brace that does not start a count is a literal:
+            if (m_p[1]<'0' || m_p[1]>'9')
+               return true;
+
+            // Copies are made from the atom alone, so nothing may come between:
+            if (m_p!=atom_end)
+               return fail("bad repetition");
+
+            int min, max;
+            ++m_p;
+            if (!parse_count(min))
+               return false;
+
+            max = min;
+            if (*m_p==',')
+            {
+               ++m_p;
+               max = -1;
+               if (*m_p!='}' && !parse_count(max))
+                  return false;
+            }
+
+            if (*m_p!='}')
+               return fail("missing '}'");
+            if (max>=0 && max<min)
+               return fail("bad repetition range");
+
+            const char *resume = m_p + 1;
+
+            // Each copy after the first takes the atom's states and a split:
+            atom_states = m_states.count - atom_states;
+            int copies = (max<0 ? min+1 : max) - 1;
+            if (copies > (MAX_NFA_STATES - m_states.count) / (atom_states+1))
+               return fail("pattern too large");
+
+            // Lambda function returning a fresh copy of the atom:
+            bool used = false;
+            auto fcopy = [this, &f, &used, atom, atom_end](Frag &copy)
+               {
+                  if (!used)
+                  {
+                     used = true;
+                     copy = f;
+                     return true;
+                  }
+
+                  m_p = atom;
+                  bool ok = parse_atom(copy);
+                  if (ok && m_p!=atom_end)
+                     ok = fail("bad repetition");
+                  return ok;
+               };
+
+            Frag result = { -1, -1 };
+            Frag copy;
+            for (int i=0; i<min; ++i)
+            {
+               if (!fcopy(copy))
+                  return false;
+               result = result.start<0 ? copy : concat(result, copy);
+            }
+
+            if (max<0)
+            {
+               // x{m,} is x repeated m times, then x*:
+               if (!fcopy(copy))
+                  return false;
+               s = new_state(N_SPLIT, copy.start);
+               patch(copy.outs, s);
+               copy.start = s;
+               copy.outs = (s<<1)|1;
+               result = result.start<0 ? copy : concat(result, copy);
+            }
+            else
+            {
+               // x{m,n} is x repeated m times, then n-m times x?:
+               for (int i=min; i<max; ++i)
+               {
+                  if (!fcopy(copy))
+                     return false;
+                  s = new_state(N_SPLIT, copy.start);
+                  copy.start = s;
+                  copy.outs = join(copy.outs, (s<<1)|1);
+                  result = result.start<0 ? copy : concat(result, copy);
+               }
+            }
+
+            if (result.start<0)
+            {
+               s = new_state(N_EPS);
+               result.start = s;
+               result.outs = s<<1;
+            }
+
+            f = result;
+            m_p = resume - 1;
+            break;
+         }
+
+         default:
+            return true;
+      }
+
+      ++m_p;
+   }
+}
+
+/** @brief Parse a single character, bracket expression, escape, or group. */
+bool HLRegex::parse_atom(Frag &f)
+{
+   Byte_Set set = Byte_Set();
+
+   switch (*m_p)
+   {
+      case '(':
+         ++m_p;
+         if (!parse_alt(f))
+            return false;
+         if (*m_p!=')')
+            return fail("missing ')'");
+         ++m_p;
+         return true;
+
+      case '*':
+      case '+':
+      case '?':
+         return fail("nothing to repeat");
+
+      case '[':
+         ++m_p;
+         if (!parse_bracket(set))
+            return false;
+         break;
+
+      case '.':
+         ++m_p;
+         for (int ch=1; ch<256; ++ch)
+            if (ch!='\n')
+               set.add(ch);
+         break;
+
+      case '\\':
+         ++m_p;
+         if (!parse_escape(set))
+            return false;
+         fold_case(set);
+         break;
+
+      default:
+         set.add(static_cast<unsigned char>(*m_p++));
+         fold_case(set);
+         break;
+   }
+
+   f = set_frag(set);
+   return true;
+}
+
+/**
+ * @brief Parse the character after a backslash, adding its characters to @p set.
+ *
+ * `\d`, `\w`, and `\s` are digits, word characters, and white space, and
+ * their upper case versions are their complements.  `\n`, `\r`, and `\t`
+ * are the control characters.  Any other character is taken literally.
+ */
+bool HLRegex::parse_escape(Byte_Set &set)
+{
+   char ch = *m_p++;
+   Byte_Set cls = Byte_Set();
+
+   switch (ch)
+   {
+      case '\0':
+         --m_p;
+         return fail("trailing backslash");
+      case 'n':
+         set.add('\n');
+         return true;
+      case 'r':
+         set.add('\r');
+         return true;
+      case 't':
+         set.add('\t');
+         return true;
+      case 'd':
+      case 'D':
+         for (int c='0'; c<='9'; ++c)
+            cls.add(c);
+         break;
+      case 'w':
+      case 'W':
+         for (int c=1; c<256; ++c)
+            if ((c>='0' && c<='9') || (c>='A' && c<='Z') || (c>='a' && c<='z') || c=='_')
+               cls.add(c);
+         break;
+      case 's':
+      case 'S':
+         for (const char *c=" \t\r\n\f\v"; *c; ++c)
+            cls.add(*c);
+         break;
+      default:
+         set.add(static_cast<unsigned char>(ch));
+         return true;
+   }
+
+   bool complement = ch>='A' && ch<='Z';
+   for (int c=1; c<256; ++c)
+      if (cls.has(c)!=complement)
+         set.add(c);
+
+   return true;
+}
+
+/** @brief Parse a bracket expression, after the opening `[`. */
+bool HLRegex::parse_bracket(Byte_Set &set)
+{
+   bool negate = false;
+   if (*m_p=='^')
+   {
+      negate = true;
+      ++m_p;
+   }
+
+   // A ']' at the start is a literal:
+   bool first = true;
+   while (*m_p && (*m_p!=']' || first))
+   {
+      first = false;
+
+      int lo;
+      if (*m_p=='\\')
+      {
+         ++m_p;
+         // Escapes that name a class cannot start a range:
+         if (strchr("dDwWsS", *m_p))
+         {
+            if (!parse_escape(set))
+               return false;
+            continue;
+         }
+
+         Byte_Set one = Byte_Set();
+         if (!parse_escape(one))
+            return false;
+         lo = static_cast<unsigned char>(m_p[-1]);
+         for (int c=1; c<256; ++c)
+            if (one.has(c))
+               lo = c;
+      }
+      else
+         lo = static_cast<unsigned char>(*m_p++);
+
+      int hi = lo;
+      if (*m_p=='-' && m_p[1] && m_p[1]!=']')
+      {
+         ++m_p;
+         if (*m_p=='\\')
+         {
+            ++m_p;
+            Byte_Set one = Byte_Set();
+            if (!parse_escape(one))
+               return false;
+            for (int c=1; c<256; ++c)
+               if (one.has(c))
+                  hi = c;
+         }
+         else
+            hi = static_cast<unsigned char>(*m_p++);
+
+         if (hi<lo)
+            return fail("bad range in bracket expression");
+      }
+
+      for (int c=lo; c<=hi; ++c)
+         set.add(c);
+   }
+
+   if (*m_p!=']')
+      return fail("missing ']'");
+   ++m_p;
+
+   fold_case(set);
+
+   if (negate)
+   {
+      for (int i=0; i<32; ++i)
+         set.bits[i] = ~set.bits[i];
+      // The terminating '\0' and line endings never match:
+      set.bits[0] &= ~1;
+      set.bits['\n'>>3] &= ~(1<<('\n'&7));
+   }
+
+   return true;
+}
+
+/** @brief Add the other case of every letter in @p set, if case-insensitive. */
+void HLRegex::fold_case(Byte_Set &set) const
+{
+   if (m_ci)
+   {
+      for (int c='a'; c<='z'; ++c)
+      {
+         if (set.has(c) || set.has(c-32))
+         {
+            set.add(c);
+            set.add(c-32);
+         }
+      }
+   }
+}
+
+/**
+ * @brief Add the states reachable from @p state without consuming input to @p set.
+ *
+ * Only N_SET and N_MATCH states are added, since the others do nothing
+ * once followed.
+ *
+ * @param state The state to follow.
+ * @param set   The set of states being built.
+ * @param marks Array, indexed by state, of the last @p mark in which each
+ *              state was visited.
+ * @param mark  Identifies the set being built.
+ * @param stack Work space for twice as many states as the NFA holds.
+ */
+void HLRegex::closure(int state, HLList<int> &set,
+                      unsigned *marks, unsigned mark, int *stack) const
+{
+   int top = 0;
+   stack[top++] = state;
+
+   while (top)
+   {
+      int s = stack[--top];
+      if (s<0 || marks[s]==mark)
+         continue;
+      marks[s] = mark;
+
+      const NFA_State &ns = m_states.items[s];
+      switch (ns.op)
+      {
+         case N_SPLIT:
+            stack[top++] = ns.out1;
+            // fall through
+         case N_EPS:
+            stack[top++] = ns.out;
+            break;
+         default:
+            set.append(s);
+            break;
+      }
+   }
+}
+
+/** @brief Sort integers ascending for qsort(). */
+static int int_sorter(const void *lh, const void *rh)
+{
+   return *static_cast<const int*>(lh) - *static_cast<const int*>(rh);
+}
+
+/**
+ * @brief Combine the patterns into a single DFA.
+ *
+ * Each DFA state stands for the set of NFA states the patterns could be
+ * in after reading the same text.  DFA states are created as they are
+ * reached from the start state, and identified by hashing their sorted
+ * NFA state sets.
+ *
+ * @return TRUE if the DFA was built, FALSE if the patterns would need
+ *         too many states, with the reason available from error().
+ */
+bool HLRegex::compile(void)
+{
+   delete [] m_trans;
+   delete [] m_accept;
+   m_trans = m_accept = nullptr;
+   m_dfa_count = 0;
+   memset(m_first, 0, sizeof(m_first));
+
+   if (!m_starts.count)
+      return true;
+
+   // NFA state sets of the DFA states, concatenated, and where each starts:
+   HLList<int> sets = HLList<int>();
+   HLList<int> set_starts = HLList<int>();
+   HLList<int> trans = HLList<int>();
+   HLList<int> accept = HLList<int>();
+
+   // Hash table of DFA states, by their NFA state sets:
+   const int table_size = MAX_DFA_STATES*2;
+   int *table = new int[table_size];
+   memset(table, -1, table_size*sizeof(int));
+
+   unsigned *marks = new unsigned[m_states.count];
+   memset(marks, 0, m_states.count*sizeof(unsigned));
+   unsigned mark = 0;
+   int *stack = new int[m_states.count*2+1];
+
+   HLList<int> next = HLList<int>();
+   bool ok = true;
+
+   // Lambda function returning the DFA state for the set in `next`, adding it if new:
+   auto fstate = [&]()
+      {
+         qsort(next.items, next.count, sizeof(int), int_sorter);
+
+         unsigned hash = 2166136261u;
+         for (int i=0; i<next.count; ++i)
+            hash = (hash ^ static_cast<unsigned>(next.items[i])) * 16777619u;
+
+         int slot = hash & (table_size-1);
+         for (; table[slot]>=0; slot = (slot+1) & (table_size-1))
+         {
+            int d = table[slot];
+            int len = set_starts.items[d+1] - set_starts.items[d];
+            if (len==next.count
+                && memcmp(sets.items+set_starts.items[d], next.items, len*sizeof(int))==0)
+               return d;
+         }
+
+         if (accept.count==MAX_DFA_STATES)
+         {
+            ok = fail("patterns too complex");
+            return -1;
+         }
+
+         int d = accept.count;
+         table[slot] = d;
+
+         int id = -1;
+         for (int i=0; i<next.count; ++i)
+         {
+            sets.append(next.items[i]);
+            const NFA_State &ns = m_states.items[next.items[i]];
+            if (ns.op==N_MATCH && (id<0 || ns.id<id))
+               id = ns.id;
+         }
+         set_starts.append(sets.count);
+         accept.append(id);
+
+         return d;
+      };
+
+   // The start state holds the start states of all the patterns:
+   set_starts.append(0);
+   ++mark;
+   for (int i=0; i<m_starts.count; ++i)
+      closure(m_starts.items[i], next, marks, mark, stack);
+   fstate();
+
+   for (int d=0; ok && d<accept.count; ++d)
+   {
+      for (int ch=0; ch<256; ++ch)
+      {
+         next.count = 0;
+         ++mark;
+
+         if (ch)
+         {
+            for (int i=set_starts.items[d]; i<set_starts.items[d+1]; ++i)
+            {
+               const NFA_State &ns = m_states.items[sets.items[i]];
+               if (ns.op==N_SET && m_sets.items[ns.set].has(ch))
+                  closure(ns.out, next, marks, mark, stack);
+            }
+         }
+
+         trans.append(next.count ? fstate() : -1);
+      }
+   }
+
+   delete [] table;
+   delete [] marks;
+   delete [] stack;
+   delete [] next.items;
+   delete [] sets.items;
+   delete [] set_starts.items;
+
+   if (!ok)
+   {
+      delete [] trans.items;
+      delete [] accept.items;
+      return false;
+   }
+
+   m_trans = trans.items;
+   m_accept = accept.items;
+   m_dfa_count = accept.count;
+
+   for (int ch=0; ch<256; ++ch)
+      m_first[ch] = m_trans[ch]>=0;
+
+   return true;
+}
+
+/**
+ * @brief Find the longest pattern match at the start of @p str.
+ *
+ * A match that ends inside a word, that is, between two characters
+ * accepted by @p name_char, is not a match, so `[0-9]+` does not match
+ * the start of `0x1F`.  The text is read once, remembering the longest
+ * acceptable match as the DFA runs.
+ *
+ * @param str       '\0'-terminated text to match.
+ * @param length    Set to the length of the match, if any.
+ * @param name_char Word character test for the language of the text.
+ * @return Index of the matching pattern, or -1 if none match.  If two
+ *         patterns match the same text, the earlier pattern is returned.
+ */
+int HLRegex::match(const char *str, int *length, Name_Char_Func name_char) const
+{
+   if (!m_trans)
+      return -1;
+
+   const unsigned char *start = reinterpret_cast<const unsigned char*>(str);
+   const unsigned char *p = start;
+   int state = 0;
+   int rval = -1;
+
+   while (*p && (state = m_trans[state*256 + *p])>=0)
+   {
+      ++p;
+      if (m_accept[state]>=0 && !((*name_char)(p[-1]) && (*name_char)(*p)))
+      {
+         rval = m_accept[state];
+         *length = p - start;
+      }
+   }
+
+   return rval;
+}
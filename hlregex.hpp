@@ -0,0 +1,158 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -DEXCLUDE_TESTS -c -o hlregex.o hlregex.cpp"  -*-
+
+/** @file */
+
+#ifndef HLREGEX_HPP
+#define HLREGEX_HPP
+
+#include "hllist.hpp"
+
+/**
+ * @brief A set of simple regular expressions compiled to a single DFA.
+ *
+ * Highlighting files can name patterns rather than tags, for numbers,
+ * colors, or identifiers that cannot practically be listed.  Each pattern
+ * is added with add(), which parses it into a Thompson NFA.  compile()
+ * then combines the NFAs of all patterns into a single DFA by subset
+ * construction, so that match() finds the longest match of any pattern
+ * in one pass over the text, without backtracking.
+ *
+ * The pattern syntax is a subset of POSIX extended regular expressions:
+ *
+ * - Literal characters, and `\` to escape any special character
+ * - `.` for any character
+ * - Bracket expressions like `[0-9a-fA-F]` and `[^"]`
+ * - `\d`, `\w`, `\s` and their complements `\D`, `\W`, `\S`
+ * - Grouping with `(` and `)`, alternatives with `|`
+ * - Repetition with `*`, `+`, `?`, `{m}`, `{m,}` and `{m,n}`
+ *
+ * Patterns are always anchored at the position passed to match(), so
+ * there are no `^` or `$` anchors.
+ */
+class HLRegex
+{
+public:
+   HLRegex(void);
+   ~HLRegex();
+
+   bool add(const char *pattern, bool case_insensitive=false);
+   void remove_last(void);
+   bool compile(void);
+
+   /** @brief Number of patterns successfully added. */
+   inline int pattern_count(void) const     { return m_starts.count; }
+   /** @brief Message for the most recent add() or compile() failure. */
+   inline const char *error(void) const     { return m_error; }
+
+   /**
+    * @brief Returns true if some pattern could match text starting with @p ch.
+    *
+    * Only valid after a successful compile().
+    */
+   inline bool may_start(int ch) const      { return m_first[static_cast<unsigned char>(ch)]; }
+
+   /** Word character test used by match() to find the end of a word. */
+   typedef bool (*Name_Char_Func)(int ch);
+
+   int match(const char *str, int *length, Name_Char_Func name_char) const;
+
+private:
+   enum
+   {
+      MAX_REPEAT     = 255,     /**< Largest count in a `{m,n}` repetition. */
+      MAX_NFA_STATES = 32768,   /**< Limit on the combined size of the patterns. */
+      MAX_DFA_STATES = 4096     /**< Limit on the size of the compiled DFA. */
+   };
+
+   /** @brief Kinds of NFA states. */
+   enum NFA_Op
+   {
+      N_SET,     /**< Consume a character in the byte set, then go to `out`. */
+      N_SPLIT,   /**< Go to both `out` and `out1`. */
+      N_EPS,     /**< Go to `out` without consuming a character. */
+      N_MATCH    /**< Pattern `id` has matched. */
+   };
+
+   struct NFA_State
+   {
+      int op;
+      int out;
+      int out1;
+      int set;   /**< Index in m_sets for N_SET states. */
+      int id;    /**< Pattern index for N_MATCH states. */
+   };
+
+   /** @brief A set of bytes, one bit per byte value. */
+   struct Byte_Set
+   {
+      unsigned char bits[32];
+
+      inline void add(int ch)            { bits[ch>>3] |= 1<<(ch&7); }
+      inline bool has(int ch) const      { return bits[ch>>3] & (1<<(ch&7)); }
+   };
+
+   /**
+    * @brief A partially-built NFA: a start state and a list of unconnected exits.
+    *
+    * The exits are a linked list threaded through the unconnected `out`
+    * and `out1` members themselves, each link being a state index times
+    * two, plus one for `out1`.
+    */
+   struct Frag
+   {
+      int start;
+      int outs;
+   };
+
+   HLList<NFA_State> m_states;
+   HLList<Byte_Set>  m_sets;
+   HLList<int>       m_starts;   /**< Start state of each pattern. */
+
+   /** @brief Sizes of m_states and m_sets before a pattern was added. */
+   struct Mark
+   {
+      int states;
+      int sets;
+   };
+   HLList<Mark>      m_marks;    /**< Where each pattern's states begin, for remove_last(). */
+
+   const char *m_p;              /**< Parse position in the pattern being added. */
+   bool       m_ci;              /**< Pattern being added is case-insensitive. */
+   const char *m_error;
+
+   int  *m_trans;                /**< 256 transitions for each DFA state, -1 for none. */
+   int  *m_accept;               /**< Pattern matched by each DFA state, or -1. */
+   int  m_dfa_count;
+   bool m_first[256];            /**< Bytes with a transition from the DFA start state. */
+
+   // NFA building:
+   int new_state(int op, int out=-1, int out1=-1, int set=-1);
+   int new_set(const Byte_Set &set);
+   int &exit_ref(int ref);
+   void patch(int outs, int target);
+   int join(int outs1, int outs2);
+
+   Frag set_frag(const Byte_Set &set);
+   Frag concat(const Frag &lh, const Frag &rh);
+
+   // Pattern parsing:
+   bool fail(const char *msg)  { m_error = msg; return false; }
+   bool parse_alt(Frag &f);
+   bool parse_concat(Frag &f);
+   bool parse_repeat(Frag &f);
+   bool parse_atom(Frag &f);
+   bool parse_bracket(Byte_Set &set);
+   bool parse_escape(Byte_Set &set);
+   bool parse_count(int &count);
+   void fold_case(Byte_Set &set) const;
+
+   // DFA building:
+   void closure(int state, HLList<int> &set,
+                unsigned *marks, unsigned mark, int *stack) const;
+
+   // Delete effc++ requested operators
+   HLRegex(const HLRegex &)             = delete;
+   HLRegex & operator=(const HLRegex &) = delete;
+};
+
+#endif
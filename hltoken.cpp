@@ -0,0 +1,276 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -DEXCLUDE_TESTS -c -o hltoken.o hltoken.cpp"  -*-
+
+/** @file */
+
+#include "hltoken.hpp"
+#include "utf8.hpp"
+
+#include <string.h>
+#include <alloca.h>  // for alloca()
+
+HLTokenizer::HLTokenizer(const HLIndex *ndx)
+   : m_index(ndx), m_open_pair(nullptr), m_spans(),
+     m_line_buff(nullptr), m_line_buff_size(0)
+{
+}
+
+HLTokenizer::~HLTokenizer()
+{
+   delete [] m_spans.items;
+   delete [] m_line_buff;
+}
+
+/** @brief Add a span for @p len characters at @p start of @p line, matched by @p tag. */
+void HLTokenizer::add_span(const char *line, const char *start, size_t len, const HLNode *tag)
+{
+   HLSpan span = { static_cast<unsigned>(start-line),
+                   static_cast<unsigned>(len),
+                   m_index->category_of(tag) };
+   m_spans.append(span);
+}
+
+/**
+ * @brief Returns the end of the text enclosed by a paired-delimiter tag.
+ *
+ * The end delimiter is the value of the @p pair tag line.  If the start and
+ * end delimiters are the same, as for most string literals, a backslash
+ * escapes the character that follows it.
+ *
+ * @param p    Position after the start delimiter, or the start of a line
+ *             continuing the enclosed text.
+ * @param pair Tag node with the start delimiter as tag and end delimiter as value.
+ * @return Position just after the end delimiter, or nullptr if the enclosed
+ *         text continues past the end of the line.
+ */
+const char *HLTokenizer::seek_pair_end(const char *p, const HLNode *pair)
+{
+   const char *end_delim = pair->value();
+   size_t len = strlen(end_delim);
+
+   if (strcmp(pair->tag(), end_delim)!=0)
+   {
+      p = strstr(p, end_delim);
+      return p ? p+len : nullptr;
+   }
+
+   while (*p)
+   {
+      if (*p=='\\' && *(p+1))
+         p += 2;
+      else if (strncmp(p, end_delim, len)==0)
+         return p+len;
+      else
+         ++p;
+   }
+
+   return nullptr;
+}
+
+/**
+ * @brief Add a span for the text enclosed by a paired-delimiter tag.
+ *
+ * If the end delimiter is not found on the line, the span runs to the end
+ * of the line and the pair remains open for the following lines.
+ *
+ * @param line Start of the line.
+ * @param p    Start of the span.
+ * @param from Position from which to seek the end delimiter.
+ * @param pair Tag node of the paired delimiters.
+ * @return Position after the enclosed text, or nullptr if the span runs
+ *         to the end of the line.
+ */
+const char *HLTokenizer::add_paired_span(const char *line, const char *p,
+                                         const char *from, const HLNode *pair)
+{
+   const char *end = seek_pair_end(from, pair);
+   add_span(line, p, end ? end-p : strlen(p), pair);
+
+   m_open_pair = end ? nullptr : pair;
+   return end;
+}
+
+/**
+ * @brief Find the highlighted runs of a line of code.
+ *
+ * The line is scanned for words, the criteria for which is a string
+ * of allowed characters surrounded by non-allowed characters.  This is to
+ * handle words that are terminated by operators or punctuation, as well as
+ * spaces.
+ *
+ * Each non-allowed character is matched against the set of comment strings
+ * in the highlighting file.  A comment runs to the end of the line.
+ *
+ * A tag with a value is a paired delimiter, the start and end of a block
+ * comment or string that may span lines.  Text between the delimiters is
+ * one span, without looking for other tags.
+ *
+ * Where no tag matches at the start of a word or at a non-word character,
+ * the patterns of the highlighting file are tried.
+ *
+ * If the highlighting file allows Unicode letters, a line with non-ASCII
+ * characters is stepped through a UTF-8 character at a time, so a word
+ * runs through its non-ASCII letters.  A pure ASCII line, found so by
+ * is_ascii(), is stepped through a byte at a time as for other files.
+ *
+ * @param line '\0'-terminated line of code, without its newline.
+ * @return The number of spans, which are available from spans().
+ */
+int HLTokenizer::tokenize_line(const char *line)
+{
+   m_spans.count = 0;
+
+   const HLNode *tagnode;
+   const char *p = line;
+   int len;
+
+   // Finish text enclosed by delimiters from a previous line:
+   if (m_open_pair && !(p=add_paired_span(line, p, p, m_open_pair)))
+      return m_spans.count;
+
+   bool utf8 = m_index->unicode_letters() && !is_ascii(p, strlen(p));
+
+   while (*p)
+   {
+      if (utf8 ? m_index->name_char_length(p) : m_index->allowed_in_name(*p))
+      {
+         if ((tagnode = m_index->seek_word(p)))
+         {
+            size_t taglen = strlen(tagnode->tag());
+            if (tagnode->has_value())
+            {
+               if (!(p=add_paired_span(line, p, p+taglen, tagnode)))
+                  break;
+            }
+            else
+            {
+               add_span(line, p, taglen, tagnode);
+               p += taglen;
+            }
+         }
+         else if (m_index->may_start_pattern(*p)
+                  && (tagnode = m_index->seek_pattern(p, &len)))
+         {
+            add_span(line, p, len, tagnode);
+            p += len;
+         }
+         else if (utf8)
+         {
+            // Skip to end-of-word, a character at a time:
+            while ((len=m_index->name_char_length(p)))
+               p += len;
+         }
+         else
+         {
+            // Skip to end-of-word:
+            while (m_index->allowed_in_name(*p))
+               ++p;
+         }
+      }
+      else if ((tagnode = m_index->seek_comment(p)))
+      {
+         if (tagnode->has_value())
+         {
+            if (!(p=add_paired_span(line, p, p+strlen(tagnode->tag()), tagnode)))
+               break;
+         }
+         else
+         {
+            // Line comments run to the end of the line:
+            add_span(line, p, strlen(p), tagnode);
+            break;
+         }
+      }
+      else if (m_index->may_start_pattern(*p)
+               && (tagnode = m_index->seek_pattern(p, &len)))
+      {
+         add_span(line, p, len, tagnode);
+         p += len;
+      }
+      else
+         p += utf8 ? utf8_length(p) : 1;
+   }
+
+   return m_spans.count;
+}
+
+/**
+ * @brief Find the highlighted runs of a buffer of code, all of one language.
+ *
+ * The buffer is tokenized line by line, continuing from the state left
+ * by earlier calls.
+ *
+ * @param buff  The code, which need not be '\0'-terminated.
+ * @param len   Number of characters in @p buff.
+ * @param spans List to which the spans are appended, with offsets from @p buff.
+ * @return The number of spans appended.
+ */
+int HLTokenizer::tokenize(const char *buff, size_t len, HLList<HLSpan> &spans)
+{
+   int count = spans.count;
+   const char *p = buff;
+   const char *end = buff + len;
+
+   while (p < end)
+   {
+      const char *eol = static_cast<const char*>(memchr(p, '\n', end-p));
+      size_t linelen = (eol ? eol : end) - p;
+
+      if (linelen >= m_line_buff_size)
+      {
+         delete [] m_line_buff;
+         m_line_buff_size = linelen + 1024;
+         m_line_buff = new char[m_line_buff_size];
+      }
+
+      memcpy(m_line_buff, p, linelen);
+      m_line_buff[linelen] = '\0';
+
+      unsigned offset = p - buff;
+      tokenize_line(m_line_buff);
+      for (int i=0; i<m_spans.count; ++i)
+      {
+         HLSpan span = m_spans.items[i];
+         span.offset += offset;
+         spans.append(span);
+      }
+
+      p += linelen + (eol ? 1 : 0);
+   }
+
+   return spans.count - count;
+}
+
+/**
+ * @brief Return matching HLNode if the word is matched in the current HLIndex.
+ *
+ * The function makes a lower-case copy of the word to compare against the work
+ * in the HLIndex.  If a match is made, a pointer to the HLNode is returned.
+ *
+ * @param  start Address of start of the word.
+ * @param  end   Address of the last character in the word.
+ * @return Pointer to an HLNode whose tag matches the word.  NULL if not found.
+ */
+const HLNode *HLTokenizer::is_highlight_tag(const char *start, const char *end) const
+{
+   // Make lower-case copy in a stack memory block:
+   size_t len_of_string = end - start + 1;
+   char *word = static_cast<char*>(alloca(len_of_string+1));
+
+   char *ptarget = word;
+   const char *psource = start;
+
+   while (psource <= end)
+   {
+      if (*psource>=65 && *psource<=90)
+         *ptarget = *psource + 32;
+      else
+         *ptarget = *psource;
+
+      ++ptarget;
+      ++psource;
+   }
+   *ptarget = '\0';
+
+   // Use lower-case copy to find a node:
+   return m_index->seek(word);
+}
@@ -0,0 +1,82 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -DEXCLUDE_TESTS -c -o hltoken.o hltoken.cpp"  -*-
+
+/** @file */
+
+#ifndef HLTOKEN_HPP
+#define HLTOKEN_HPP
+
+#include <stddef.h>
+#include "hlindex.hpp"
+#include "hllist.hpp"
+
+/**
+ * @brief A run of highlighted text.
+ *
+ * The category is the number of the rule line whose tag matched, for
+ * HLIndex::category(), whose value is the rule for enclosing the text.
+ */
+struct HLSpan
+{
+   unsigned offset;     /**< Offset of the text from the start of the line or buffer. */
+   unsigned length;     /**< Number of characters of highlighted text. */
+   int      category;   /**< Rule line number of the matching tag. */
+};
+
+/**
+ * @brief Finds the tags of a highlighting file in code, reporting them as HLSpan runs.
+ *
+ * This is the matching half of highlighting, without the output.  Each
+ * line handed to tokenize_line() is searched for word tags, comment tags,
+ * paired delimiters and patterns, in the same way for every consumer, be
+ * it the HTML output of FencedFilter or a tool that only needs to know
+ * where the keywords are.
+ *
+ * A block comment or string that is not closed on its line is carried to
+ * the next line, so the lines of a fenced code block must be tokenized in
+ * order.  Call reset() at the start of a new block.
+ */
+class HLTokenizer
+{
+public:
+   HLTokenizer(const HLIndex *ndx=nullptr);
+   ~HLTokenizer();
+
+   /** @brief Start tokenizing a new block of code, with index @p ndx. */
+   inline void set_index(const HLIndex *ndx) { m_index = ndx; reset(); }
+   inline const HLIndex *index(void) const   { return m_index; }
+
+   /** @brief Forget any block comment or string left open by the previous line. */
+   inline void reset(void)                   { m_open_pair = nullptr; }
+
+   int tokenize_line(const char *line);
+   int tokenize(const char *buff, size_t len, HLList<HLSpan> &spans);
+
+   /** @brief Spans found by the last call to tokenize_line(). */
+   inline const HLSpan *spans(void) const    { return m_spans.items; }
+   inline int span_count(void) const         { return m_spans.count; }
+
+   const HLNode *is_highlight_tag(const char *start, const char *end) const;
+
+private:
+   const HLIndex *m_index;
+   const HLNode  *m_open_pair;  /**< Paired-delimiter tag (block comment or
+                                 *   string) whose end delimiter has not yet
+                                 *   been found.
+                                 */
+   HLList<HLSpan> m_spans;      /**< Spans of the most recent line. */
+
+   char   *m_line_buff;         /**< Line copy for tokenize(). */
+   size_t m_line_buff_size;
+
+   void add_span(const char *line, const char *start, size_t len, const HLNode *tag);
+   const char *add_paired_span(const char *line, const char *p,
+                               const char *from, const HLNode *pair);
+
+   static const char *seek_pair_end(const char *p, const HLNode *pair);
+
+   // Delete effc++ requested operators
+   HLTokenizer(const HLTokenizer &)             = delete;
+   HLTokenizer & operator=(const HLTokenizer &) = delete;
+};
+
+#endif
@@ -0,0 +1,174 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -DEXCLUDE_TESTS -c -o libfencedfilter.o libfencedfilter.cpp"  -*-
+
+/** @file */
+
+#include "libfencedfilter.h"
+
+#include <stdlib.h>  // for free()
+#include <string.h>
+#include <alloca.h>  // for alloca()
+#include <mutex>     // for std::call_once()
+
+#include "ffscanner.hpp"
+#include "markupemitter.hpp"
+#include "outsink.hpp"
+#include "hlbuiltin.hpp"
+#include "hlpath.hpp"
+
+/** @brief A document filter, which writes to memory. */
+struct ff_handle
+{
+   OutSink     out;
+   HTMLEmitter html;
+   FFScanner   scanner;
+
+   ff_handle(void) : out(), html(out), scanner(html) { scanner.set_log(nullptr); }
+
+   void filter(const char *in, size_t in_len, char *buff, size_t size, bool growable);
+
+   // Delete effc++ requested operators
+   ff_handle(const ff_handle &)             = delete;
+   ff_handle & operator=(const ff_handle &) = delete;
+};
+
+/** @brief Filter the document @p in into @p buff, see OutSink::set_buffer(). */
+void ff_handle::filter(const char *in, size_t in_len, char *buff, size_t size, bool growable)
+{
+   out.set_buffer(buff, size, growable);
+   scanner.reset();
+   scanner.scan_buffer(in, in_len);
+   out.flush();
+}
+
+/**
+ * @brief Create a document filter.
+ *
+ * Messages about the documents are not written unless a stream is
+ * named with ff_set_log().
+ *
+ * @return A new handle, to be released with ff_close().
+ */
+ff_handle *ff_open(void)
+{
+   // Handles may be opened by several threads at once:
+   static std::once_flag builtins_set;
+   std::call_once(builtins_set, HLIndex::set_builtins, hl_builtins, hl_builtin_count);
+
+   return new ff_handle;
+}
+
+/** @brief Release a handle from ff_open(). */
+void ff_close(ff_handle *ff)
+{
+   delete ff;
+}
+
+/** @brief Write messages about the documents of @p ff to @p log, or nowhere if NULL. */
+void ff_set_log(ff_handle *ff, FILE *log)
+{
+   ff->scanner.set_log(log);
+}
+
+/**
+ * @brief Add directories in which to seek highlighting files.
+ *
+ * @param ff   Handle, unused, as the search path is shared by all handles.
+ * @param dirs Colon-separated list of directories, as for `--hl-path`.
+ */
+void ff_add_search_dirs(ff_handle *ff, const char *dirs)
+{
+   HLPath::add_search_dirs(dirs);
+}
+
+/**
+ * @brief Highlight blocks of language @p alias with the highlighting file of @p type.
+ *
+ * Aliases are shared by all handles, as for ff_add_search_dirs().
+ */
+void ff_add_alias(ff_handle *ff, const char *alias, const char *type)
+{
+   HLIndex::add_alias(alias, type);
+}
+
+/**
+ * @brief Load the highlighting files of @p languages before they are needed.
+ *
+ * @param ff        Handle, unused, as loaded files are shared by all handles.
+ * @param languages Comma-separated list of languages, such as "sql,bash".
+ * @return Number of languages for which no highlighting file was found.
+ */
+int ff_load(ff_handle *ff, const char *languages)
+{
+   int missing = 0;
+   const char *p = languages;
+   while (*p)
+   {
+      const char *end = strchr(p, ',');
+      size_t len = end ? static_cast<size_t>(end-p) : strlen(p);
+      if (len)
+      {
+         char *language = static_cast<char*>(alloca(len+1));
+         memcpy(language, p, len);
+         language[len] = '\0';
+
+         if (!HLIndex::get_index(language))
+            ++missing;
+      }
+
+      p += len + (end ? 1 : 0);
+   }
+
+   return missing;
+}
+
+/**
+ * @brief Filter a document into a buffer provided by the caller.
+ *
+ * @param ff       Handle from ff_open().
+ * @param in       The document, which need not be '\0'-terminated.
+ * @param in_len   Number of characters in @p in.
+ * @param out      Buffer for the output, which is not '\0'-terminated.
+ * @param out_size Number of characters available at @p out.
+ * @param out_len  Set to the length of the output, even if it did not fit.
+ * @return FF_OK, or FF_TOO_SMALL if @p out holds only the first @p out_size
+ *         characters, in which case the call can be repeated with a buffer
+ *         of @p *out_len characters.
+ */
+int ff_filter(ff_handle *ff, const char *in, size_t in_len,
+              char *out, size_t out_size, size_t *out_len)
+{
+   ff->filter(in, in_len, out, out_size, false);
+
+   *out_len = ff->out.length();
+   return ff->out.overflowed() ? FF_TOO_SMALL : FF_OK;
+}
+
+/**
+ * @brief Filter a document into a buffer that grows to fit the output.
+ *
+ * @param ff      Handle from ff_open().
+ * @param in      The document, which need not be '\0'-terminated.
+ * @param in_len  Number of characters in @p in.
+ * @param out     Set to the output, which is not '\0'-terminated, in a
+ *                buffer to be released with `free`.
+ * @param out_len Set to the length of the output.
+ * @return FF_OK, or FF_NO_MEMORY if the buffer could not be enlarged, in
+ *         which case @p *out is NULL.
+ */
+int ff_filter_alloc(ff_handle *ff, const char *in, size_t in_len,
+                    char **out, size_t *out_len)
+{
+   ff->filter(in, in_len, nullptr, 0, true);
+
+   if (ff->out.failed())
+   {
+      free(ff->out.buffer());
+      *out = nullptr;
+      *out_len = 0;
+      return FF_NO_MEMORY;
+   }
+
+   *out = ff->out.buffer();
+   *out_len = ff->out.length();
+   return FF_OK;
+}
@@ -0,0 +1,83 @@
+/** @file */
+
+/**
+ * @page LIBFENCEDFILTER The FencedFilter Library
+ *
+ * `libfencedfilter.a` and `libfencedfilter.so` let a program filter
+ * documents in-process, with the C functions declared in libfencedfilter.h,
+ * rather than running `fencedfilter` for each file.  Highlighting files
+ * loaded for one document stay loaded for the next, so a Doxygen wrapper or
+ * preview server pays for each `.hl` file only once.
+ *
+ * ~~~{.c}
+ * ff_handle *ff = ff_open();
+ * ff_load(ff, "sql");
+ *
+ * char *html;
+ * size_t len;
+ * if (ff_filter_alloc(ff, doc, doc_len, &html, &len)==FF_OK)
+ * {
+ *    fwrite(html, 1, len, stdout);
+ *    free(html);
+ * }
+ *
+ * ff_close(ff);
+ * ~~~
+ *
+ * Link with `-lfencedfilter -lz -lm`, and with `-lstdc++` if linking
+ * the static library into a C program.
+ *
+ * Highlighting files, search directories and aliases are shared by all
+ * handles of a process.  A handle holds the state of one document at a
+ * time, so a thread should use its own handle.  Threads may filter
+ * documents at the same time, even in a language none has loaded yet:
+ * the first thread to need a highlighting file loads it, and the others
+ * wait for it.  Search directories and aliases should be set before
+ * documents are filtered.
+ */
+
+#ifndef LIBFENCEDFILTER_H
+#define LIBFENCEDFILTER_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#if defined(__GNUC__)
+#define FF_API __attribute__((visibility("default")))
+#else
+#define FF_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Results of the ff_filter functions. */
+enum ff_result
+{
+   FF_OK = 0,        /**< The output is complete. */
+   FF_TOO_SMALL,     /**< The output buffer was too small, see ff_filter(). */
+   FF_NO_MEMORY      /**< The output buffer could not be enlarged. */
+};
+
+/** @brief Opaque state of a document filter. */
+typedef struct ff_handle ff_handle;
+
+FF_API ff_handle *ff_open(void);
+FF_API void ff_close(ff_handle *ff);
+
+FF_API void ff_set_log(ff_handle *ff, FILE *log);
+FF_API void ff_add_search_dirs(ff_handle *ff, const char *dirs);
+FF_API void ff_add_alias(ff_handle *ff, const char *alias, const char *type);
+FF_API int  ff_load(ff_handle *ff, const char *languages);
+
+FF_API int ff_filter(ff_handle *ff, const char *in, size_t in_len,
+                     char *out, size_t out_size, size_t *out_len);
+FF_API int ff_filter_alloc(ff_handle *ff, const char *in, size_t in_len,
+                           char **out, size_t *out_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
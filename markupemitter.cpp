@@ -0,0 +1,305 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -DEXCLUDE_TESTS -c -o markupemitter.o markupemitter.cpp"  -*-
+
+/** @file */
+
+#include "markupemitter.hpp"
+#include "skipscan.hpp"
+
+#include <string.h>
+
+MarkupDelimiters::~MarkupDelimiters()
+{
+   delete [] m_delims;
+   delete [] m_pool;
+}
+
+/**
+ * @brief Render the delimiters of the categories of @p ndx.
+ *
+ * @param ndx   Index whose rule lines are rendered.
+ * @param open  Function to render the markup that begins a span.
+ * @param close Function to render the markup that ends a span.
+ */
+void MarkupDelimiters::render(const HLIndex *ndx, Render_Func open, Render_Func close)
+{
+   delete [] m_delims;
+   delete [] m_pool;
+   m_delims = nullptr;
+   m_pool = nullptr;
+   m_index = ndx;
+
+   int count = ndx->category_count();
+   if (!count)
+      return;
+
+   // Render into a scratch buffer, then move to a pool of the total size:
+   const size_t max_delim = 256;
+   char *scratch = new char[count * 2 * max_delim];
+   size_t *lengths = new size_t[count * 2];
+   size_t total = 0;
+
+   for (int i=0; i<count; ++i)
+   {
+      const char *action = ndx->category(i)->value();
+      if (!action)
+         action = "";
+
+      char *buff = scratch + i*2*max_delim;
+      total += (lengths[i*2] = (*open)(buff, max_delim, action));
+      total += (lengths[i*2+1] = (*close)(buff+max_delim, max_delim, action));
+   }
+
+   m_delims = new MarkupDelimiter[count];
+   m_pool = new char[total+1];
+
+   char *pool = m_pool;
+   for (int i=0; i<count; ++i)
+   {
+      MarkupDelimiter &delim = m_delims[i];
+      char *buff = scratch + i*2*max_delim;
+
+      delim.open_len = lengths[i*2];
+      delim.close_len = lengths[i*2+1];
+
+      // Share the text of an earlier category with the same markup:
+      int same;
+      for (same=0; same<i; ++same)
+      {
+         const MarkupDelimiter &prev = m_delims[same];
+         if (prev.open_len==delim.open_len && prev.close_len==delim.close_len
+             && memcmp(prev.open, buff, delim.open_len)==0
+             && memcmp(prev.close, buff+max_delim, delim.close_len)==0)
+            break;
+      }
+
+      if (same<i)
+      {
+         delim.open = m_delims[same].open;
+         delim.close = m_delims[same].close;
+         continue;
+      }
+
+      delim.open = pool;
+      memcpy(pool, buff, delim.open_len);
+      pool += delim.open_len;
+
+      delim.close = pool;
+      memcpy(pool, buff+max_delim, delim.close_len);
+      pool += delim.close_len;
+   }
+
+   delete [] lengths;
+   delete [] scratch;
+}
+
+/**
+ * @brief Append @p len characters of @p str to the render buffer @p buff.
+ *
+ * @return Length of the rendered text so far, which stops growing at @p size.
+ */
+inline size_t render_append(char *buff, size_t size, size_t used, const char *str, size_t len)
+{
+   if (used+len > size)
+      len = size - used;
+   memcpy(buff+used, str, len);
+   return used + len;
+}
+
+/** @brief The characters written as entities by write_xml_translated(). */
+static const SkipScanner xml_significant("@<>&\"'");
+
+/**
+ * @brief Write @p len characters of @p str, converting XML-significant
+ *        characters to their entity names.
+ *
+ * Runs of characters that need no conversion, including the bytes of
+ * UTF-8 characters, are found by a SkipScanner and written in one piece.
+ * The '@' is converted, too, to keep Doxygen from seeing commands in code.
+ */
+void write_xml_translated(OutSink &out, const char *str, size_t len)
+{
+   const char *end = str + len;
+   while (str < end)
+   {
+      const char *next = xml_significant.find(str, end);
+      out.write(str, next-str);
+      if (next < end)
+      {
+         switch(*next)
+         {
+            case '@':
+               out.write("&commat;", 8);
+               break;
+            case '<':
+               out.write("&lt;", 4);
+               break;
+            case '>':
+               out.write("&gt;", 4);
+               break;
+            case '&':
+               out.write("&amp;", 5);
+               break;
+            case '"':
+               out.write("&quot;", 6);
+               break;
+            case '\'':
+               out.write("&apos;", 6);
+               break;
+         }
+         ++next;
+      }
+
+      str = next;
+   }
+}
+
+/**
+ * @brief Render the start tag of the element of @p action, like `span.keyword`.
+ *
+ * The part of @p action before a period is the element name, the part
+ * after it the class attribute, so `span.keyword` is rendered as
+ * `<span class="keyword">`.
+ */
+size_t render_element_open(char *buff, size_t size, const char *action)
+{
+   const char *period = strchr(action, '.');
+   size_t len = period ? period-action : strlen(action);
+
+   size_t used = render_append(buff, size, 0, "<", 1);
+   used = render_append(buff, size, used, action, len);
+   if (period)
+   {
+      used = render_append(buff, size, used, " class=\"", 8);
+      used = render_append(buff, size, used, period+1, strlen(period+1));
+      used = render_append(buff, size, used, "\"", 1);
+   }
+
+   return render_append(buff, size, used, ">", 1);
+}
+
+/** @brief Render the end tag of the element of @p action. */
+size_t render_element_close(char *buff, size_t size, const char *action)
+{
+   const char *period = strchr(action, '.');
+   size_t len = period ? period-action : strlen(action);
+
+   size_t used = render_append(buff, size, 0, "</", 2);
+   used = render_append(buff, size, used, action, len);
+   return render_append(buff, size, used, ">", 1);
+}
+
+/** @brief Render the ANSI color that begins a span of @p action. */
+size_t render_ansi_open(char *buff, size_t size, const char *action)
+{
+   const char *color;
+   if (strstr(action, "comment"))
+      color = "\x1b[32m";        // green
+   else if (strstr(action, "string") || strstr(action, "literal"))
+      color = "\x1b[33m";        // yellow
+   else if (strstr(action, "keyword"))
+      color = "\x1b[1;34m";      // bold blue
+   else if (strstr(action, "type"))
+      color = "\x1b[36m";        // cyan
+   else if (strstr(action, "preprocessor") || strstr(action, "directive"))
+      color = "\x1b[35m";        // magenta
+   else
+      color = "\x1b[1m";         // bold
+
+   return render_append(buff, size, 0, color, strlen(color));
+}
+
+/** @brief Render the ANSI attribute reset that ends every span. */
+size_t render_ansi_close(char *buff, size_t size, const char *action)
+{
+   return render_append(buff, size, 0, "\x1b[0m", 4);
+}
+
+/**
+ * @brief Write @p len characters of @p str, escaping the characters
+ *        that remain special in a LaTeX `alltt` environment.
+ */
+void write_latex_translated(OutSink &out, const char *str, size_t len)
+{
+   const char *run = str;
+   const char *end = str + len;
+   while (str < end)
+   {
+      if (*str=='\\' || *str=='{' || *str=='}')
+      {
+         out.write(run, str-run);
+         if (*str=='\\')
+            out.write("\\textbackslash{}", 16);
+         else
+         {
+            out.put('\\');
+            out.put(*str);
+         }
+         run = str+1;
+      }
+
+      ++str;
+   }
+
+   out.write(run, str-run);
+}
+
+/** @brief Render the LaTeX command that begins a span of @p action. */
+size_t render_latex_open(char *buff, size_t size, const char *action)
+{
+   if (strstr(action, "comment"))
+      return render_append(buff, size, 0, "\\textit{", 8);
+   else
+      return render_append(buff, size, 0, "\\textbf{", 8);
+}
+
+/** @brief Render the brace that ends every LaTeX span. */
+size_t render_latex_close(char *buff, size_t size, const char *action)
+{
+   return render_append(buff, size, 0, "}", 1);
+}
+
+/**
+ * @brief Create the emitter for the `--format` option value @p format.
+ *
+ * The compact `html` format drops the `div.line` elements for the single
+ * `pre` element of the `pre` format, as they would otherwise be most of
+ * the output.
+ *
+ * @param format  One of "html", "pre", "ansi", or "latex".
+ * @param compact TRUE to merge adjacent spans of the same class.
+ * @param out     Destination of the output.
+ * @return A new emitter, or nullptr if @p format is not recognized.
+ */
+FFEmitter *new_markup_emitter(const char *format, bool compact, OutSink &out)
+{
+   if (strcmp(format, "html")==0)
+   {
+      if (compact)
+         return new MarkupEmitter<HTMLPrePolicy, true>(out);
+      else
+         return new MarkupEmitter<HTMLDivPolicy>(out);
+   }
+   else if (strcmp(format, "pre")==0)
+   {
+      if (compact)
+         return new MarkupEmitter<HTMLPrePolicy, true>(out);
+      else
+         return new MarkupEmitter<HTMLPrePolicy>(out);
+   }
+   else if (strcmp(format, "ansi")==0)
+   {
+      if (compact)
+         return new MarkupEmitter<ANSIPolicy, true>(out);
+      else
+         return new MarkupEmitter<ANSIPolicy>(out);
+   }
+   else if (strcmp(format, "latex")==0)
+   {
+      if (compact)
+         return new MarkupEmitter<LaTeXPolicy, true>(out);
+      else
+         return new MarkupEmitter<LaTeXPolicy>(out);
+   }
+   else
+      return nullptr;
+}
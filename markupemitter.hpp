@@ -0,0 +1,284 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -DEXCLUDE_TESTS -c -o markupemitter.o markupemitter.cpp"  -*-
+
+/** @file */
+
+#ifndef MARKUPEMITTER_HPP
+#define MARKUPEMITTER_HPP
+
+#include "ffscanner.hpp"
+#include "outsink.hpp"
+
+/**
+ * @brief Pre-rendered markup to enclose the spans of one category.
+ *
+ * Categories whose markup is the same share the same `open` text, so
+ * spans of the same class can be recognized by comparing pointers.
+ */
+struct MarkupDelimiter
+{
+   const char *open;
+   const char *close;
+   unsigned   open_len;
+   unsigned   close_len;
+};
+
+/**
+ * @brief The delimiters of each category of an HLIndex, rendered once for a backend.
+ *
+ * A markup backend turns the value of a rule line, like `span.keyword`, into
+ * the text that opens and closes a highlighted span.  Rendering them when a
+ * fenced code block begins leaves only two copies per span for code_line().
+ */
+class MarkupDelimiters
+{
+public:
+   /** @brief Function to write the markup for @p action to @p buff, returning its length. */
+   typedef size_t (*Render_Func)(char *buff, size_t size, const char *action);
+
+   MarkupDelimiters(void) : m_index(nullptr), m_delims(nullptr), m_pool(nullptr) { }
+   ~MarkupDelimiters();
+
+   void render(const HLIndex *ndx, Render_Func open, Render_Func close);
+
+   /** @brief Index whose categories were last rendered. */
+   inline const HLIndex *index(void) const                  { return m_index; }
+   inline const MarkupDelimiter &operator[](int category) const { return m_delims[category]; }
+
+private:
+   const HLIndex   *m_index;
+   MarkupDelimiter *m_delims;
+   char            *m_pool;    /**< Text of all delimiters. */
+
+   // Delete effc++ requested operators
+   MarkupDelimiters(const MarkupDelimiters &)             = delete;
+   MarkupDelimiters & operator=(const MarkupDelimiters &) = delete;
+};
+
+void   write_xml_translated(OutSink &out, const char *str, size_t len);
+size_t render_element_open(char *buff, size_t size, const char *action);
+size_t render_element_close(char *buff, size_t size, const char *action);
+
+/**
+ * @brief Doxygen HTML with a div.line element for each line, like Doxygen's own code.
+ *
+ * This is the output of FencedFilter since its beginning.  The value of a
+ * rule line is an element and class, such as `span.keyword`.
+ */
+struct HTMLDivPolicy
+{
+   static inline void code_start(OutSink &out) { out.write("  @htmlonly <div class=\"fragment\">\n"); }
+   static inline void code_end(OutSink &out)   { out.write("  </div> @endhtmlonly\n"); }
+   static inline void line_start(OutSink &out) { out.write("  <div class=\"line\">"); }
+   static inline void line_end(OutSink &out)   { out.write("</div>\n"); }
+
+   static inline void translate(OutSink &out, const char *str, size_t len)
+   {
+      write_xml_translated(out, str, len);
+   }
+
+   static inline size_t render_open(char *buff, size_t size, const char *action)
+   {
+      return render_element_open(buff, size, action);
+   }
+
+   static inline size_t render_close(char *buff, size_t size, const char *action)
+   {
+      return render_element_close(buff, size, action);
+   }
+};
+
+/** @brief Doxygen HTML as a single `pre` element, with spans as for HTMLDivPolicy. */
+struct HTMLPrePolicy : public HTMLDivPolicy
+{
+   static inline void code_start(OutSink &out) { out.write("  @htmlonly <pre class=\"fragment\"><code>"); }
+   static inline void code_end(OutSink &out)   { out.write("</code></pre> @endhtmlonly\n"); }
+   static inline void line_start(OutSink &out) { }
+   static inline void line_end(OutSink &out)   { out.put('\n'); }
+};
+
+size_t render_ansi_open(char *buff, size_t size, const char *action);
+size_t render_ansi_close(char *buff, size_t size, const char *action);
+
+/**
+ * @brief ANSI terminal colors, to preview highlighting without Doxygen.
+ *
+ * The color of a span is chosen from words in the value of its rule line,
+ * so that `span.comment` and `span.keyword` differ as they would in HTML.
+ */
+struct ANSIPolicy
+{
+   static inline void code_start(OutSink &out) { }
+   static inline void code_end(OutSink &out)   { }
+   static inline void line_start(OutSink &out) { out.write("    ", 4); }
+   static inline void line_end(OutSink &out)   { out.put('\n'); }
+
+   static inline void translate(OutSink &out, const char *str, size_t len)
+   {
+      out.write(str, len);
+   }
+
+   static inline size_t render_open(char *buff, size_t size, const char *action)
+   {
+      return render_ansi_open(buff, size, action);
+   }
+
+   static inline size_t render_close(char *buff, size_t size, const char *action)
+   {
+      return render_ansi_close(buff, size, action);
+   }
+};
+
+void   write_latex_translated(OutSink &out, const char *str, size_t len);
+size_t render_latex_open(char *buff, size_t size, const char *action);
+size_t render_latex_close(char *buff, size_t size, const char *action);
+
+/**
+ * @brief LaTeX in a Doxygen `@latexonly` section, for PDF documentation.
+ *
+ * Lines are set in an `alltt` environment, which Doxygen's LaTeX output
+ * already uses, with comments in italics and other spans in bold.
+ */
+struct LaTeXPolicy
+{
+   static inline void code_start(OutSink &out) { out.write("  @latexonly\n\\begin{alltt}\n"); }
+   static inline void code_end(OutSink &out)   { out.write("\\end{alltt}\n  @endlatexonly\n"); }
+   static inline void line_start(OutSink &out) { }
+   static inline void line_end(OutSink &out)   { out.put('\n'); }
+
+   static inline void translate(OutSink &out, const char *str, size_t len)
+   {
+      write_latex_translated(out, str, len);
+   }
+
+   static inline size_t render_open(char *buff, size_t size, const char *action)
+   {
+      return render_latex_open(buff, size, action);
+   }
+
+   static inline size_t render_close(char *buff, size_t size, const char *action)
+   {
+      return render_latex_close(buff, size, action);
+   }
+};
+
+/**
+ * @brief Writes the output of an FFScanner with the markup of backend @p Policy.
+ *
+ * Text outside of fenced code blocks is written unchanged.  Fenced code
+ * blocks that FencedFilter handles are framed by the code and line
+ * delimiters of the policy, with each HLSpan enclosed in the pre-rendered
+ * delimiters of its category.  The policy's functions are inlined into
+ * code_line(), so the output of a line involves no choices of backend.
+ *
+ * A policy is a struct of static functions:
+ * - `code_start`, `code_end`, `line_start` and `line_end` write the frame,
+ * - `translate` writes code text, escaping characters as needed, and
+ * - `render_open` and `render_close` render the delimiters of a rule.
+ *
+ * If @p Compact, spans of the same class separated only by spaces and tabs
+ * are merged into one, as for `NOT NULL DEFAULT` in SQL, to reduce the
+ * size of the output and the work of whatever reads it.
+ */
+template <class Policy, bool Compact=false>
+class MarkupEmitter : public FFEmitter
+{
+public:
+   MarkupEmitter(OutSink &out) : m_out(out), m_delims() { }
+
+   virtual void text(const char *str, size_t len)     { m_out.write(str, len); }
+   virtual void text_ref(const char *str, size_t len) { m_out.write_ref(str, len); }
+
+   /** @brief Replace the opening fence line of a block FencedFilter handles. */
+   virtual void fence_open(const FFFence &fence)
+   {
+      if (fence.index)
+         set_index(fence.index);
+
+      if (fence.mode!=FF_DOXYGEN)
+         Policy::code_start(m_out);
+   }
+
+   /** @brief Replace the closing fence line of a block FencedFilter handles. */
+   virtual void fence_close(const FFFence &fence)
+   {
+      if (fence.mode!=FF_DOXYGEN)
+         Policy::code_end(m_out);
+   }
+
+   /** @brief Write a fenced code line, enclosing each span in the delimiters of its category. */
+   virtual void code_line(const char *line, size_t offset, const HLSpan *spans, int count)
+   {
+      Policy::line_start(m_out);
+
+      const char *p = line;
+      for (int i=0; i<count; ++i)
+      {
+         const HLSpan &span = spans[i];
+         const char *start = line + span.offset;
+         const char *end = start + span.length;
+         const MarkupDelimiter &delim = m_delims[span.category];
+
+         // Extend the span over following spans of the same class:
+         if (Compact)
+         {
+            while (i+1<count && m_delims[spans[i+1].category].open==delim.open)
+            {
+               const char *next = line + spans[i+1].offset;
+               if (!is_blank(end, next))
+                  break;
+
+               end = next + spans[++i].length;
+            }
+         }
+
+         Policy::translate(m_out, p, start-p);
+         m_out.write(delim.open, delim.open_len);
+         Policy::translate(m_out, start, end-start);
+         m_out.write(delim.close, delim.close_len);
+
+         p = end;
+      }
+
+      Policy::translate(m_out, p, strlen(p));
+
+      Policy::line_end(m_out);
+   }
+
+   /** @brief Set the index whose categories enclose the spans of code_line(). */
+   inline void set_index(const HLIndex *ndx)
+   {
+      if (ndx!=m_delims.index())
+         m_delims.render(ndx, Policy::render_open, Policy::render_close);
+   }
+
+private:
+   OutSink          &m_out;
+   MarkupDelimiters m_delims;
+
+   /** @brief Returns TRUE if [@p p, @p end) holds only spaces and tabs. */
+   static inline bool is_blank(const char *p, const char *end)
+   {
+      while (p<end && (*p==' ' || *p=='\t'))
+         ++p;
+      return p==end;
+   }
+
+   // Delete effc++ requested operators
+   MarkupEmitter(const MarkupEmitter &)             = delete;
+   MarkupEmitter & operator=(const MarkupEmitter &) = delete;
+};
+
+/** @brief The Doxygen HTML emitter of FencedFilter. */
+typedef MarkupEmitter<HTMLDivPolicy> HTMLEmitter;
+
+FFEmitter *new_markup_emitter(const char *format, bool compact, OutSink &out);
+
+/**
+ * @brief Function to filter the document open as @p fd with @p scanner to
+ *        @p out, closing @p fd.  @p filename names the document in messages.
+ *        Returns FALSE if the document could not be read or the output not
+ *        written.
+ */
+typedef bool (*FFLoad_Func)(FFScanner &scanner, OutSink &out, int fd, const char *filename);
+
+#endif
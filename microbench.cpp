@@ -0,0 +1,626 @@
+// -*- compile-command: "make microbench"  -*-
+
+/**
+ * @file
+ *
+ * @brief Times the matching and escaping kernels apart from the rest of a run.
+ *
+ * Usage: `microbench [--sizes n,...] [--lengths short,long,mixed] [--hits pct,...]
+ *                    [--reps n] [--min-ms n] [--kernel name]`
+ *
+ * For each vocabulary size, tag-length distribution and hit rate, a
+ * highlighting file of random tags is written to a temporary directory and
+ * loaded with HLIndex::build().  Each kernel is then run over a list of
+ * query words, of which the hit rate are tags of the vocabulary and the
+ * rest are near misses that share their leading characters with the tags.
+ *
+ * A kernel is run once to warm up, then @e reps times, each repetition
+ * long enough to take at least @e min-ms milliseconds.  The minimum, median
+ * and maximum nanoseconds per operation of the repetitions are reported,
+ * and bytes of query per cycle at the median.  Cycles are counted with the
+ * time stamp counter where there is one, which ticks at the nominal clock
+ * rate rather than the current one.
+ *
+ * The kernels:
+ * - `match`, `match-ci`: HLIndex::str_match_sensitive() and
+ *   HLIndex::str_match_insensitive() of each query against a tag.
+ * - `seek-word`: HLIndex::seek_word() of each query.
+ * - `seek-comment`: HLIndex::seek_comment() of each query as a comment.
+ * - `is-tag`: HLTokenizer::is_highlight_tag() of each query.
+ * - `escape`: write_xml_translated() of the queries, the hit rate being
+ *   the share of XML-significant characters, for each length distribution.
+ * - `load`: HLIndex::build() of the highlighting file, with bytes of file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>     // for __rdtsc()
+#define HAVE_TSC 1
+#endif
+
+#include "hlindex.hpp"
+#include "hltoken.hpp"
+#include "markupemitter.hpp"
+#include "outsink.hpp"
+
+/** @brief Lengths of tags and queries, with their `--lengths` names. */
+enum Length_Dist { LEN_SHORT, LEN_LONG, LEN_MIXED };
+static const char *length_names[] = { "short", "long", "mixed" };
+
+/** @brief Number of query words run per operation batch. */
+static const int query_count = 1024;
+
+/** @brief Options of the run, from the command line. */
+struct Settings
+{
+   int         sizes[16];
+   int         size_count;
+   int         lengths[3];
+   int         length_count;
+   int         hits[16];
+   int         hit_count;
+   int         reps;
+   double      min_ns;
+   const char *kernel;
+};
+
+/** @brief The words of a benchmark case: a vocabulary and the queries against it. */
+struct Case
+{
+   char        **tags;          /**< Vocabulary, unique, in no particular order. */
+   int         tag_count;
+   char        *queries;        /**< Query words, each between a '%' and a space. */
+   const char  **query_starts;  /**< Start of each query word in @p queries. */
+   const char  **query_tags;    /**< Tag compared with each query by `match`. */
+   char        *upper_queries;  /**< @p queries in upper case, for `match-ci`. */
+   size_t      query_bytes;     /**< Characters of the query words, without spaces. */
+   char        hl_path[256];    /**< Highlighting file of the vocabulary. */
+   size_t      hl_bytes;
+};
+
+/** @brief Result of a kernel's repetitions. */
+struct Timing
+{
+   double min_ns;
+   double median_ns;
+   double max_ns;
+   double cycles;               /**< Median cycles per operation, 0 if unknown. */
+};
+
+/** @brief Source of random numbers, the same from run to run. */
+static unsigned long long s_seed = 88172645463325252ULL;
+
+inline unsigned rnd(unsigned limit)
+{
+   s_seed ^= s_seed << 13;
+   s_seed ^= s_seed >> 7;
+   s_seed ^= s_seed << 17;
+   return static_cast<unsigned>(s_seed % limit);
+}
+
+inline double now_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+inline unsigned long long cycles_now(void)
+{
+#ifdef HAVE_TSC
+   return __rdtsc();
+#else
+   return 0;
+#endif
+}
+
+/** @brief Keeps the compiler from discarding the result of a kernel. */
+static volatile long s_sink;
+
+/** @brief Returns a random tag length of the distribution @p dist. */
+int random_length(int dist)
+{
+   switch(dist)
+   {
+      case LEN_SHORT:
+         return 2 + rnd(5);         // 2-6, like keywords
+      case LEN_LONG:
+         return 8 + rnd(17);        // 8-24, like CSS properties
+      default:
+         // Mostly short, with a long tail:
+         return rnd(4) ? 2 + rnd(6) : 8 + rnd(25);
+   }
+}
+
+/**
+ * @brief Fill @p buff with a random word of @p len letters.
+ *
+ * Tags use 'a' through 'y', so a 'z' makes a word that is no tag.
+ */
+void random_word(char *buff, int len)
+{
+   for (int i=0; i<len; ++i)
+      buff[i] = static_cast<char>('a' + rnd(25));
+   buff[len] = '\0';
+}
+
+int str_sorter(const void *lh, const void *rh)
+{
+   return strcmp(*static_cast<char* const*>(lh), *static_cast<char* const*>(rh));
+}
+
+/**
+ * @brief Make the vocabulary and queries of a case, and write its highlighting file.
+ *
+ * @return TRUE if the highlighting file was written.
+ */
+bool make_case(Case &c, const char *dir, int size, int dist, int hit_pct)
+{
+   // Draw more than enough tags, then drop the duplicates:
+   int drawn = size + size/4 + 16;
+   char **tags = new char*[drawn];
+   for (int i=0; i<drawn; ++i)
+   {
+      int len = random_length(dist);
+      tags[i] = new char[len+1];
+      random_word(tags[i], len);
+   }
+
+   qsort(tags, drawn, sizeof(char*), str_sorter);
+   int unique = 0;
+   for (int i=0; i<drawn; ++i)
+   {
+      if (unique && strcmp(tags[unique-1], tags[i])==0)
+         delete [] tags[i];
+      else
+         tags[unique++] = tags[i];
+   }
+
+   // Shuffle, so the vocabulary is a random sample rather than the first tags:
+   for (int i=unique-1; i>0; --i)
+   {
+      int j = rnd(i+1);
+      char *t = tags[i];
+      tags[i] = tags[j];
+      tags[j] = t;
+   }
+
+   while (unique > size)
+      delete [] tags[--unique];
+
+   c.tags = tags;
+   c.tag_count = unique;
+
+   // Queries: tags for hits, tags with a 'z' for misses.  The '%' before
+   // each makes it a comment for `seek-comment`:
+   size_t total = query_count * (32+2);
+   c.queries = new char[total+1];
+   c.upper_queries = new char[total+1];
+   c.query_starts = new const char*[query_count];
+   c.query_tags = new const char*[query_count];
+   c.query_bytes = 0;
+
+   char *p = c.queries;
+   for (int i=0; i<query_count; ++i)
+   {
+      const char *tag = tags[rnd(unique)];
+      size_t len = strlen(tag);
+      *p++ = '%';
+      memcpy(p, tag, len);
+
+      bool hit = static_cast<int>(rnd(100)) < hit_pct;
+      if (!hit)
+         p[len>1 ? 1+rnd(len-1) : 0] = 'z';
+
+      c.query_starts[i] = p;
+      c.query_tags[i] = tag;
+      c.query_bytes += len;
+      p += len;
+      *p++ = ' ';
+   }
+   *p = '\0';
+
+   for (size_t i=0; i<=static_cast<size_t>(p-c.queries); ++i)
+   {
+      char ch = c.queries[i];
+      c.upper_queries[i] = (ch>='a' && ch<='z') ? ch-32 : ch;
+   }
+
+   // Write the highlighting file, words and comments in their own categories:
+   snprintf(c.hl_path, sizeof(c.hl_path), "%s/bench.hl", dir);
+   FILE *f = fopen(c.hl_path, "w");
+   if (!f)
+   {
+      fprintf(stderr, "Unable to write \"%s\".\n", c.hl_path);
+      return false;
+   }
+
+   fputs("comment : span.comment\n", f);
+   for (int i=0; i<unique; ++i)
+      fprintf(f, "   %%%s\n", tags[i]);
+
+   fputs("keyword : span.keyword\n", f);
+   for (int i=0; i<unique; ++i)
+      fprintf(f, "   %s\n", tags[i]);
+
+   c.hl_bytes = ftell(f);
+   fclose(f);
+   return true;
+}
+
+void free_case(Case &c)
+{
+   for (int i=0; i<c.tag_count; ++i)
+      delete [] c.tags[i];
+   delete [] c.tags;
+   delete [] c.queries;
+   delete [] c.upper_queries;
+   delete [] c.query_starts;
+   delete [] c.query_tags;
+   unlink(c.hl_path);
+}
+
+/** @brief A kernel to time, running @p count operations of the case @p data. */
+typedef void (*Kernel_Func)(const void *data, long count);
+
+/**
+ * @brief Time @p kernel, returning per-operation statistics of its repetitions.
+ *
+ * The number of operations per repetition is doubled from one until a
+ * repetition takes at least the minimum time, which also warms up the
+ * caches and branch predictors.
+ */
+Timing time_kernel(const Settings &settings, Kernel_Func kernel, const void *data)
+{
+   long count = 1;
+   for (;;)
+   {
+      double start = now_ns();
+      (*kernel)(data, count);
+      if (now_ns()-start >= settings.min_ns || count >= (1L<<40))
+         break;
+      count *= 2;
+   }
+
+   double *ns = new double[settings.reps];
+   double *cycles = new double[settings.reps];
+   for (int r=0; r<settings.reps; ++r)
+   {
+      unsigned long long c0 = cycles_now();
+      double start = now_ns();
+      (*kernel)(data, count);
+      ns[r] = (now_ns()-start) / count;
+      cycles[r] = static_cast<double>(cycles_now()-c0) / count;
+   }
+
+   // Sort both, the median of each being at the middle:
+   for (int i=1; i<settings.reps; ++i)
+      for (int j=i; j>0 && ns[j]<ns[j-1]; --j)
+      {
+         double t = ns[j]; ns[j] = ns[j-1]; ns[j-1] = t;
+      }
+   for (int i=1; i<settings.reps; ++i)
+      for (int j=i; j>0 && cycles[j]<cycles[j-1]; --j)
+      {
+         double t = cycles[j]; cycles[j] = cycles[j-1]; cycles[j-1] = t;
+      }
+
+   Timing timing = { ns[0], ns[settings.reps/2], ns[settings.reps-1], cycles[settings.reps/2] };
+   delete [] ns;
+   delete [] cycles;
+   return timing;
+}
+
+/** @brief A case and the objects its kernels run against. */
+struct Bench
+{
+   const Case    *c;
+   const HLIndex *index;
+   HLTokenizer   *tokenizer;
+   OutSink       *out;
+   char          *out_buff;
+   size_t        out_size;
+};
+
+void kernel_match(const void *data, long count)
+{
+   const Bench &b = *static_cast<const Bench*>(data);
+   long sum = 0;
+   for (long n=0; n<count; ++n)
+   {
+      int i = n % query_count;
+      sum += HLIndex::str_match_sensitive(b.c->query_starts[i], b.c->query_tags[i], true);
+   }
+   s_sink = sum;
+}
+
+void kernel_match_ci(const void *data, long count)
+{
+   const Bench &b = *static_cast<const Bench*>(data);
+   long sum = 0;
+   for (long n=0; n<count; ++n)
+   {
+      int i = n % query_count;
+      const char *q = b.c->upper_queries + (b.c->query_starts[i] - b.c->queries);
+      sum += HLIndex::str_match_insensitive(q, b.c->query_tags[i], true);
+   }
+   s_sink = sum;
+}
+
+void kernel_seek_word(const void *data, long count)
+{
+   const Bench &b = *static_cast<const Bench*>(data);
+   long sum = 0;
+   for (long n=0; n<count; ++n)
+      sum += b.index->seek_word(b.c->query_starts[n % query_count]) != nullptr;
+   s_sink = sum;
+}
+
+void kernel_seek_comment(const void *data, long count)
+{
+   const Bench &b = *static_cast<const Bench*>(data);
+   long sum = 0;
+   for (long n=0; n<count; ++n)
+   {
+      const char *q = b.c->query_starts[n % query_count];
+      sum += b.index->seek_comment(q-1) != nullptr;
+   }
+   s_sink = sum;
+}
+
+void kernel_is_tag(const void *data, long count)
+{
+   const Bench &b = *static_cast<const Bench*>(data);
+   long sum = 0;
+   for (long n=0; n<count; ++n)
+   {
+      int i = n % query_count;
+      const char *start = b.c->query_starts[i];
+      const char *end = start + strlen(b.c->query_tags[i]) - 1;
+      sum += b.tokenizer->is_highlight_tag(start, end) != nullptr;
+   }
+   s_sink = sum;
+}
+
+void kernel_escape(const void *data, long count)
+{
+   const Bench &b = *static_cast<const Bench*>(data);
+   for (long n=0; n<count; ++n)
+   {
+      int i = n % query_count;
+      if (i==0)
+      {
+         b.out->flush();
+         b.out->set_buffer(b.out_buff, b.out_size, false);
+      }
+
+      const char *start = b.c->query_starts[i];
+      write_xml_translated(*b.out, start, strlen(b.c->query_tags[i]));
+   }
+   b.out->flush();
+   s_sink = b.out->length();
+}
+
+void kernel_load(const void *data, long count)
+{
+   const Bench &b = *static_cast<const Bench*>(data);
+   for (long n=0; n<count; ++n)
+   {
+      HLIndex::publish("bench", HLIndex::build("bench", b.c->hl_path));
+      HLIndex::reclaim();
+   }
+}
+
+/** @brief Print a result line of a kernel that processed @p bytes per operation. */
+void report(const char *kernel, const Case &c, int dist, int hit_pct,
+            const Timing &t, double bytes)
+{
+   printf("%-13s %7d %-6s %4d%% %12.1f %12.1f %12.1f",
+          kernel, c.tag_count, length_names[dist], hit_pct,
+          t.min_ns, t.median_ns, t.max_ns);
+   if (t.cycles > 0)
+      printf(" %11.4g\n", bytes / t.cycles);
+   else
+      printf(" %11s\n", "-");
+   fflush(stdout);
+}
+
+inline bool selected(const Settings &settings, const char *kernel)
+{
+   return !settings.kernel || strcmp(settings.kernel, kernel)==0;
+}
+
+/** @brief Run the selected kernels over a case. */
+void run_case(const Settings &settings, const Case &c, int dist, int hit_pct, bool first_size)
+{
+   Bench b = { &c, nullptr, nullptr, nullptr, nullptr, 0 };
+   double query_len = static_cast<double>(c.query_bytes) / query_count;
+
+   HLIndex::publish("bench", HLIndex::build("bench", c.hl_path));
+   HLIndex::reclaim();
+   b.index = HLIndex::get_index("bench");
+   if (!b.index)
+   {
+      fprintf(stderr, "Unable to load \"%s\".\n", c.hl_path);
+      return;
+   }
+
+   HLTokenizer tokenizer(b.index);
+   b.tokenizer = &tokenizer;
+
+   // The vocabulary size doesn't matter to these, so run them once:
+   if (first_size)
+   {
+      if (selected(settings, "match"))
+         report("match", c, dist, hit_pct, time_kernel(settings, kernel_match, &b), query_len);
+      if (selected(settings, "match-ci"))
+         report("match-ci", c, dist, hit_pct, time_kernel(settings, kernel_match_ci, &b), query_len);
+   }
+
+   if (selected(settings, "seek-word"))
+      report("seek-word", c, dist, hit_pct, time_kernel(settings, kernel_seek_word, &b), query_len);
+   if (selected(settings, "seek-comment"))
+      report("seek-comment", c, dist, hit_pct, time_kernel(settings, kernel_seek_comment, &b), query_len+1);
+   if (selected(settings, "is-tag"))
+      report("is-tag", c, dist, hit_pct, time_kernel(settings, kernel_is_tag, &b), query_len);
+   // Last, as it replaces the index of the other kernels:
+   if (selected(settings, "load"))
+      report("load", c, dist, hit_pct, time_kernel(settings, kernel_load, &b), c.hl_bytes);
+}
+
+/**
+ * @brief Run the `escape` kernel over queries with @p hit_pct percent
+ *        XML-significant characters.
+ */
+void run_escape(const Settings &settings, Case &c, int dist, int hit_pct)
+{
+   static const char significant[] = "<>&\"'@";
+
+   char *saved = new char[strlen(c.queries)+1];
+   strcpy(saved, c.queries);
+
+   for (char *p=c.queries; *p; ++p)
+      if (*p>='a' && *p<='z' && static_cast<int>(rnd(100)) < hit_pct)
+         *p = significant[rnd(sizeof(significant)-1)];
+
+   // Every character could become an 8-character entity:
+   Bench b = { &c, nullptr, nullptr, nullptr, nullptr, 0 };
+   OutSink out;
+   b.out = &out;
+   b.out_size = c.query_bytes * 8 + 1;
+   b.out_buff = new char[b.out_size];
+   out.set_buffer(b.out_buff, b.out_size, false);
+
+   double query_len = static_cast<double>(c.query_bytes) / query_count;
+   report("escape", c, dist, hit_pct, time_kernel(settings, kernel_escape, &b), query_len);
+
+   out.set_buffer(nullptr, 0, false);
+   delete [] b.out_buff;
+
+   strcpy(c.queries, saved);
+   delete [] saved;
+}
+
+/** @brief Parse a comma-separated list of numbers, returning the count. */
+int parse_numbers(const char *str, int *numbers, int max)
+{
+   int count = 0;
+   while (*str && count<max)
+   {
+      char *end;
+      numbers[count++] = strtol(str, &end, 10);
+      str = *end==',' ? end+1 : end;
+      if (*end && *end!=',')
+         break;
+   }
+   return count;
+}
+
+int parse_lengths(const char *str, int *lengths)
+{
+   int count = 0;
+   for (int i=0; i<3; ++i)
+   {
+      const char *found = strstr(str, length_names[i]);
+      if (found)
+         lengths[count++] = i;
+   }
+   return count;
+}
+
+void show_help(void)
+{
+   printf("Usage: microbench [--sizes n,...] [--lengths short,long,mixed] [--hits pct,...]\n"
+          "                  [--reps n] [--min-ms n] [--kernel name]\n\n"
+          "Kernels: match, match-ci, seek-word, seek-comment, is-tag, escape, load.\n"
+          "Defaults: --sizes 10,100,1000,10000,100000 --lengths short,long,mixed\n"
+          "          --hits 0,50,100 --reps 7 --min-ms 20\n\n");
+}
+
+int main(int argc, char **argv)
+{
+   Settings settings = { { 10, 100, 1000, 10000, 100000 }, 5,
+                         { LEN_SHORT, LEN_LONG, LEN_MIXED }, 3,
+                         { 0, 50, 100 }, 3,
+                         7, 20e6, nullptr };
+
+   for (int i=1; i<argc; ++i)
+   {
+      const char *arg = argv[i];
+      const char *value = i+1<argc ? argv[i+1] : nullptr;
+      if (strcmp(arg, "--help")==0)
+      {
+         show_help();
+         return 0;
+      }
+      else if (!value)
+      {
+         fprintf(stderr, "Missing value for \"%s\".\n", arg);
+         return 1;
+      }
+      else if (strcmp(arg, "--sizes")==0)
+         settings.size_count = parse_numbers(value, settings.sizes, 16);
+      else if (strcmp(arg, "--lengths")==0)
+         settings.length_count = parse_lengths(value, settings.lengths);
+      else if (strcmp(arg, "--hits")==0)
+         settings.hit_count = parse_numbers(value, settings.hits, 16);
+      else if (strcmp(arg, "--reps")==0)
+         settings.reps = atoi(value);
+      else if (strcmp(arg, "--min-ms")==0)
+         settings.min_ns = atof(value) * 1e6;
+      else if (strcmp(arg, "--kernel")==0)
+         settings.kernel = value;
+      else
+      {
+         fprintf(stderr, "Unknown option \"%s\".\n", arg);
+         return 1;
+      }
+      ++i;
+   }
+
+   if (settings.reps < 1)
+      settings.reps = 1;
+
+   char dir[] = "/tmp/microbench.XXXXXX";
+   if (!mkdtemp(dir))
+   {
+      perror("mkdtemp");
+      return 1;
+   }
+
+#ifndef HAVE_TSC
+   fputs("No cycle counter, bytes/cycle not reported.\n", stderr);
+#endif
+
+   printf("%-13s %7s %-6s %5s %12s %12s %12s %11s\n",
+          "kernel", "tags", "length", "hits", "min ns/op", "med ns/op", "max ns/op", "bytes/cycle");
+
+   for (int l=0; l<settings.length_count; ++l)
+   {
+      int dist = settings.lengths[l];
+      for (int h=0; h<settings.hit_count; ++h)
+      {
+         int hit_pct = settings.hits[h];
+         for (int s=0; s<settings.size_count; ++s)
+         {
+            Case c;
+            if (make_case(c, dir, settings.sizes[s], dist, hit_pct))
+            {
+               run_case(settings, c, dist, hit_pct, s==0);
+               if (s==0 && selected(settings, "escape"))
+                  run_escape(settings, c, dist, hit_pct);
+            }
+
+            free_case(c);
+         }
+      }
+   }
+
+   rmdir(dir);
+   return 0;
+}
@@ -0,0 +1,302 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -DEXCLUDE_TESTS -c -o outsink.o outsink.cpp"  -*-
+
+/** @file */
+
+#include "outsink.hpp"
+
+#include <errno.h>
+#include <stdlib.h>     // for realloc()
+#include <unistd.h>     // for write()
+#include <fcntl.h>      // for vmsplice()
+#include <sys/stat.h>   // for fstat()
+
+OutSink::OutSink(int fd)
+   : m_fd(fd), m_is_pipe(false), m_failed(false),
+     m_stage(), m_staged(0), m_sealed(0),
+     m_iovecs(), m_iovec_count(0),
+     m_mapped_begin(nullptr), m_mapped_end(nullptr),
+     m_mem(nullptr), m_mem_size(0), m_mem_length(0), m_mem_growable(false),
+     m_gz(nullptr)
+{
+   struct stat st;
+   if (fstat(fd, &st)==0)
+      m_is_pipe = S_ISFIFO(st.st_mode);
+}
+
+/** Constructor for output to memory, see set_buffer(). */
+OutSink::OutSink(void)
+   : m_fd(-1), m_is_pipe(false), m_failed(false),
+     m_stage(), m_staged(0), m_sealed(0),
+     m_iovecs(), m_iovec_count(0),
+     m_mapped_begin(nullptr), m_mapped_end(nullptr),
+     m_mem(nullptr), m_mem_size(0), m_mem_length(0), m_mem_growable(false),
+     m_gz(nullptr)
+{
+}
+
+/** Destructor writes any output not yet flushed. */
+OutSink::~OutSink()
+{
+   flush();
+
+   if (m_gz)
+      gzclose(m_gz);
+}
+
+/**
+ * @brief Compress all further output with gzip at compression @p level.
+ *
+ * Output is no longer spliced into a pipe, as it must pass through zlib.
+ *
+ * @return TRUE if compression is set, FALSE if the sink has no file
+ *         descriptor or zlib could not open a stream on it.
+ */
+bool OutSink::set_gzip(int level)
+{
+   if (m_fd<0 || m_gz)
+      return m_gz!=nullptr;
+
+   flush();
+
+   int fd = dup(m_fd);
+   if (fd<0)
+      return false;
+
+   char mode[] = "wb?";
+   mode[2] = level>=0 && level<=9 ? static_cast<char>('0'+level) : '\0';
+
+   if (!(m_gz=gzdopen(fd, mode)))
+   {
+      close(fd);
+      return false;
+   }
+
+   gzbuffer(m_gz, STAGE_SIZE);
+   m_is_pipe = false;
+   return true;
+}
+
+/**
+ * @brief Direct the output of an OutSink without a file to @p buff.
+ *
+ * @param buff     Buffer of @p size characters, which may be nullptr if
+ *                 @p growable.
+ * @param size     Number of characters available at @p buff.
+ * @param growable If TRUE, @p buff was allocated with `malloc` and is
+ *                 enlarged with `realloc` as needed, so buffer() must be
+ *                 used for the result.
+ */
+void OutSink::set_buffer(char *buff, size_t size, bool growable)
+{
+   m_mem = buff;
+   m_mem_size = size;
+   m_mem_length = 0;
+   m_mem_growable = growable;
+   m_failed = false;
+}
+
+/** @brief Copy @p len characters of @p str to the memory buffer, enlarging it if allowed. */
+void OutSink::write_memory(const char *str, size_t len)
+{
+   size_t needed = m_mem_length + len;
+   if (needed > m_mem_size && m_mem_growable)
+   {
+      size_t size = m_mem_size ? m_mem_size*2 : STAGE_SIZE;
+      while (size < needed)
+         size *= 2;
+
+      char *bigger = static_cast<char*>(realloc(m_mem, size));
+      if (bigger)
+      {
+         m_mem = bigger;
+         m_mem_size = size;
+      }
+      else
+         m_failed = true;
+   }
+
+   if (m_mem_length < m_mem_size)
+   {
+      size_t room = m_mem_size - m_mem_length;
+      memcpy(m_mem+m_mem_length, str, len<room ? len : room);
+   }
+
+   m_mem_length = needed;
+}
+
+/** @brief Copy @p len characters of @p str to the output. */
+void OutSink::write(const char *str, size_t len)
+{
+   while (len)
+   {
+      if (m_staged==STAGE_SIZE)
+         flush();
+
+      size_t room = STAGE_SIZE - m_staged;
+      size_t count = len<room ? len : room;
+      memcpy(m_stage+m_staged, str, count);
+      m_staged += count;
+      str += count;
+      len -= count;
+   }
+}
+
+/**
+ * @brief Add @p len characters of @p str to the output without copying them.
+ *
+ * The characters must stay in place until the next flush().  Short spans
+ * are copied anyway, since an `iovec` for a few bytes costs more than the copy.
+ */
+void OutSink::write_ref(const char *str, size_t len)
+{
+   if (len < MIN_REF)
+   {
+      write(str, len);
+      return;
+   }
+
+   if (m_is_pipe && len>=MIN_SPLICE
+       && str>=m_mapped_begin && str+len<=m_mapped_end)
+   {
+      flush();
+      if (splice_fully(str, len))
+         return;
+   }
+
+   seal();
+   if (m_iovec_count==MAX_IOVECS)
+      flush();
+
+   m_iovecs[m_iovec_count].iov_base = const_cast<char*>(str);
+   m_iovecs[m_iovec_count].iov_len = len;
+   ++m_iovec_count;
+}
+
+/** @brief Add the staged characters not yet in an `iovec` as a new `iovec`. */
+void OutSink::seal(void)
+{
+   if (m_staged > m_sealed)
+   {
+      if (m_iovec_count==MAX_IOVECS)
+         flush();
+      else
+      {
+         m_iovecs[m_iovec_count].iov_base = m_stage + m_sealed;
+         m_iovecs[m_iovec_count].iov_len = m_staged - m_sealed;
+         ++m_iovec_count;
+         m_sealed = m_staged;
+      }
+   }
+}
+
+/** @brief Write all pending output, emptying the staging buffer. */
+void OutSink::flush(void)
+{
+   if (m_staged > m_sealed)
+   {
+      m_iovecs[m_iovec_count].iov_base = m_stage + m_sealed;
+      m_iovecs[m_iovec_count].iov_len = m_staged - m_sealed;
+      ++m_iovec_count;
+   }
+
+   struct iovec *iov = m_iovecs;
+   int count = m_iovec_count;
+
+   if (m_fd<0)
+   {
+      for (int i=0; i<count; ++i)
+         write_memory(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+      count = 0;
+   }
+   else if (m_gz)
+   {
+      for (int i=0; i<count && !m_failed; ++i)
+         if (gzwrite(m_gz, iov[i].iov_base, iov[i].iov_len)==0 && iov[i].iov_len)
+            m_failed = true;
+      count = 0;
+   }
+
+   while (count && !m_failed)
+   {
+      ssize_t written = writev(m_fd, iov, count);
+      if (written<0)
+      {
+         if (errno!=EINTR)
+            m_failed = true;
+         continue;
+      }
+
+      // Skip the buffers written, and the written part of a partly-written buffer:
+      size_t left = written;
+      while (count && left>=iov->iov_len)
+      {
+         left -= iov->iov_len;
+         ++iov;
+         --count;
+      }
+      if (count)
+      {
+         iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+         iov->iov_len -= left;
+      }
+   }
+
+   m_iovec_count = 0;
+   m_staged = m_sealed = 0;
+}
+
+/** @brief Write @p len characters of @p str directly, retrying after partial writes. */
+void OutSink::write_fully(const char *str, size_t len)
+{
+   while (len && !m_failed)
+   {
+      ssize_t written = ::write(m_fd, str, len);
+      if (written<0)
+      {
+         if (errno!=EINTR)
+            m_failed = true;
+         continue;
+      }
+
+      str += written;
+      len -= written;
+   }
+}
+
+/**
+ * @brief Move @p len characters of mapped input at @p str into the output pipe.
+ *
+ * @return TRUE if the characters have been output, FALSE if `vmsplice` is
+ *         unavailable, in which case nothing has been output.
+ */
+bool OutSink::splice_fully(const char *str, size_t len)
+{
+#ifdef __linux__
+   bool spliced = false;
+   while (len && !m_failed)
+   {
+      struct iovec iov = { const_cast<char*>(str), len };
+      ssize_t moved = vmsplice(m_fd, &iov, 1, 0);
+      if (moved<0)
+      {
+         if (errno==EINTR)
+            continue;
+
+         // Once part of the span is in the pipe, the rest must follow it:
+         if (!spliced)
+            return false;
+
+         write_fully(str, len);
+         break;
+      }
+
+      spliced = true;
+      str += moved;
+      len -= moved;
+   }
+
+   return true;
+#else
+   return false;
+#endif
+}
@@ -0,0 +1,119 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -DEXCLUDE_TESTS -c -o outsink.o outsink.cpp"  -*-
+
+/** @file */
+
+#ifndef OUTSINK_HPP
+#define OUTSINK_HPP
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/uio.h>   // for struct iovec
+#include <zlib.h>      // for gzFile
+
+/**
+ * @brief Collects output as a list of buffers, written with a single `writev`.
+ *
+ * Most of a document passes through FencedFilter unchanged.  Rather than
+ * copying that text into an output buffer, write_ref() records where it is
+ * in the input buffer, and flush() hands the kernel a list of `iovec`s
+ * pointing into the input, interleaved with the generated markup, which is
+ * copied into a staging buffer by write() and put().
+ *
+ * When the output is a pipe, as when Doxygen runs FencedFilter as an input
+ * filter, large spans of a memory-mapped input file are moved into the pipe
+ * with `vmsplice`, which passes references to the pages rather than copying
+ * them.  Spans are only spliced from the region named with set_mapped_input(),
+ * which must not change until the reader has consumed the output.
+ *
+ * Text referenced with write_ref() must stay in place until the next flush().
+ *
+ * An OutSink made without a file descriptor collects its output in memory
+ * instead, in a buffer named with set_buffer().  A fixed-size buffer keeps
+ * what fits, while length() continues to count the characters written so
+ * that a caller can learn how much room the output needs.
+ *
+ * Output to a file descriptor can instead be compressed with gzip, see
+ * set_gzip().
+ */
+class OutSink
+{
+public:
+   OutSink(int fd);
+   OutSink(void);
+   ~OutSink();
+
+   void set_buffer(char *buff, size_t size, bool growable);
+   bool set_gzip(int level);
+
+   void write(const char *str, size_t len);
+   void write_ref(const char *str, size_t len);
+   void flush(void);
+
+   /** @brief Copy the '\0'-terminated @p str to the output. */
+   inline void write(const char *str)     { write(str, strlen(str)); }
+
+   /** @brief Copy the single character @p ch to the output. */
+   inline void put(char ch)
+   {
+      if (m_staged==STAGE_SIZE)
+         flush();
+      m_stage[m_staged++] = ch;
+   }
+
+   /** @brief Name the memory-mapped input, whose spans may be spliced to a pipe. */
+   inline void set_mapped_input(const char *begin, const char *end)
+   {
+      m_mapped_begin = begin;
+      m_mapped_end = end;
+   }
+
+   /** @brief Memory buffer of an OutSink without a file, see set_buffer(). */
+   inline char *buffer(void) const       { return m_mem; }
+   /** @brief Number of characters flushed to the memory buffer, including any that did not fit. */
+   inline size_t length(void) const      { return m_mem_length; }
+   /** @brief Returns TRUE if output was lost to a write or allocation failure. */
+   inline bool failed(void) const        { return m_failed; }
+   /** @brief Returns TRUE if the output did not fit in the memory buffer. */
+   inline bool overflowed(void) const    { return m_mem_length > m_mem_size; }
+
+private:
+   enum
+   {
+      STAGE_SIZE = 64*1024,    /**< Size of the buffer for copied output. */
+      MAX_IOVECS = 256,        /**< Buffers per `writev` call, at most IOV_MAX. */
+      MIN_REF    = 256,        /**< Shorter spans are copied rather than referenced. */
+      MIN_SPLICE = 64*1024     /**< Shorter spans are not worth a `vmsplice` call. */
+   };
+
+   int    m_fd;
+   bool   m_is_pipe;
+   bool   m_failed;           /**< A write failed, discard further output. */
+
+   char   m_stage[STAGE_SIZE];
+   size_t m_staged;           /**< Bytes used in m_stage. */
+   size_t m_sealed;           /**< Bytes of m_stage already in m_iovecs. */
+
+   struct iovec m_iovecs[MAX_IOVECS+1];  /**< One more for flush() to add the staged tail. */
+   int          m_iovec_count;
+
+   const char *m_mapped_begin;
+   const char *m_mapped_end;
+
+   char   *m_mem;             /**< Output buffer if there is no file descriptor. */
+   size_t m_mem_size;
+   size_t m_mem_length;
+   bool   m_mem_growable;     /**< m_mem may be enlarged with `realloc`. */
+
+   gzFile m_gz;               /**< Compressed stream of m_fd if set_gzip(). */
+
+   void seal(void);
+   void write_memory(const char *str, size_t len);
+   void write_fully(const char *str, size_t len);
+   bool splice_fully(const char *str, size_t len);
+
+   // Delete effc++ requested operators
+   OutSink(const OutSink &)             = delete;
+   OutSink & operator=(const OutSink &) = delete;
+};
+
+#endif
@@ -0,0 +1,111 @@
+// -*- compile-command: "g++ -std=c++11 -Wall -Werror -Weffc++ -pedantic -ggdb -fsyntax-only utf8.hpp"  -*-
+
+/** @file */
+
+#ifndef UTF8_HPP
+#define UTF8_HPP
+
+#include <stddef.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * @brief Returns true if none of the @p len bytes at @p str has its high bit set.
+ *
+ * Most code is pure ASCII, for which the byte-at-a-time scanning needs no
+ * UTF-8 decoding.  Where SSE2 is available, sixteen bytes are or'd together
+ * at once, and the high bits of the result tested once for the buffer.
+ */
+inline bool is_ascii(const char *str, size_t len)
+{
+   const unsigned char *p = reinterpret_cast<const unsigned char*>(str);
+   const unsigned char *end = p + len;
+
+#if defined(__SSE2__)
+   __m128i bits = _mm_setzero_si128();
+   while (end - p >= 16)
+   {
+      bits = _mm_or_si128(bits, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+      p += 16;
+   }
+
+   if (_mm_movemask_epi8(bits))
+      return false;
+#endif
+
+   unsigned char tail = 0;
+   while (p < end)
+      tail |= *p++;
+
+   return tail < 0x80;
+}
+
+/**
+ * @brief Decode the UTF-8 character at @p str.
+ *
+ * Overlong forms, surrogates and code points beyond U+10FFFF are invalid.
+ * A sequence cut short by the '\0' terminator is invalid, too, so the
+ * decoding never reads past the end of a string.
+ *
+ * @param str    Start of a character in a '\0'-terminated string.
+ * @param length Set to the number of bytes of the character, 1 if invalid.
+ * @return The code point, or -1 if @p str does not start a valid sequence.
+ */
+inline long utf8_decode(const char *str, int *length)
+{
+   const unsigned char *p = reinterpret_cast<const unsigned char*>(str);
+   unsigned char lead = *p;
+
+   *length = 1;
+   if (lead < 0x80)
+      return lead;
+
+   int  count;
+   long cp;
+   long least;
+   if (lead>=0xC2 && lead<0xE0)
+   {
+      count = 1;
+      cp = lead & 0x1F;
+      least = 0x80;
+   }
+   else if (lead>=0xE0 && lead<0xF0)
+   {
+      count = 2;
+      cp = lead & 0x0F;
+      least = 0x800;
+   }
+   else if (lead>=0xF0 && lead<0xF5)
+   {
+      count = 3;
+      cp = lead & 0x07;
+      least = 0x10000;
+   }
+   else
+      return -1;
+
+   for (int i=1; i<=count; ++i)
+   {
+      if ((p[i] & 0xC0)!=0x80)
+         return -1;
+      cp = (cp << 6) | (p[i] & 0x3F);
+   }
+
+   if (cp<least || cp>0x10FFFF || (cp>=0xD800 && cp<=0xDFFF))
+      return -1;
+
+   *length = count + 1;
+   return cp;
+}
+
+/** @brief Returns the number of bytes of the UTF-8 character at @p str, 1 if invalid. */
+inline int utf8_length(const char *str)
+{
+   int length;
+   utf8_decode(str, &length);
+   return length;
+}
+
+#endif